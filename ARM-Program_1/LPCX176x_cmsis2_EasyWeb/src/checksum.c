@@ -0,0 +1,123 @@
+//*****************************************************************************
+// checksum.c - Internet checksum (RFC 1071 / RFC 1624) for the easyWEB stack
+//
+// All sums are calculated on halfwords in memory order (little endian on the
+// LPC1768), which gives the checksum field in memory order as well, so no
+// byte swapping is needed when it is stored into a frame.
+//*****************************************************************************
+
+#include "checksum.h"
+
+// adds the 32 bit word 'Word' to the one's complement sum 'Sum'
+// (the carry out of bit 31 is added back in, on the M3 this compiles
+// to an ADDS / ADC pair)
+
+#define ADD_CARRY(Sum, Word)   { uint64_t t = (uint64_t)(Sum) + (Word); \
+                                 (Sum) = (uint32_t)t + (uint32_t)(t >> 32); }
+
+// returns the (unfolded) one's complement sum of 'Count' bytes from
+// 'Start' added to 'Sum'. the bytes are summed as if 'Start' was an even
+// offset of the frame, whatever its address is.
+
+uint32_t ChecksumPartial(const void *Start, unsigned short Count, uint32_t Sum)
+{
+  const unsigned char *pByte = Start;
+  const unsigned short *pHalf;
+  const uint32_t *pWord;
+
+  if ((uintptr_t)pByte & 1)                  // odd address: build halfwords by hand
+  {                                              // (only used for a few bytes)
+    while (Count > 1) {
+      ADD_CARRY(Sum, pByte[0] | (pByte[1] << 8));
+      pByte += 2;
+      Count -= 2;
+    }
+    if (Count)
+      ADD_CARRY(Sum, pByte[0]);
+    return Sum;
+  }
+
+  pHalf = (const unsigned short *)pByte;
+  if (((uintptr_t)pHalf & 2) && (Count > 1)) // align to a word
+  {
+    ADD_CARRY(Sum, *pHalf++);
+    Count -= 2;
+  }
+
+  pWord = (const uint32_t *)pHalf;
+  while (Count >= 16) {                          // 4 words per loop
+    ADD_CARRY(Sum, pWord[0]);
+    ADD_CARRY(Sum, pWord[1]);
+    ADD_CARRY(Sum, pWord[2]);
+    ADD_CARRY(Sum, pWord[3]);
+    pWord += 4;
+    Count -= 16;
+  }
+  while (Count >= 4) {
+    ADD_CARRY(Sum, *pWord++);
+    Count -= 4;
+  }
+
+  pHalf = (const unsigned short *)pWord;
+  if (Count > 1) {
+    ADD_CARRY(Sum, *pHalf++);
+    Count -= 2;
+  }
+  if (Count)                                     // add left-over byte, if any
+    ADD_CARRY(Sum, *(const unsigned char *)pHalf);
+
+  return Sum;
+}
+
+// folds a partial sum to 16 bits (NOT complemented)
+
+unsigned short ChecksumFold(uint32_t Sum)
+{
+  Sum = (Sum & 0xFFFF) + (Sum >> 16);
+  Sum = (Sum & 0xFFFF) + (Sum >> 16);
+  return Sum;
+}
+
+// a folded sum of bytes starting at an odd frame offset has to be
+// byte swapped before it's added to the sum of the frame
+
+unsigned short ChecksumSwap(unsigned short Sum)
+{
+  return (Sum >> 8) | (Sum << 8);
+}
+
+// RFC 1624, eqn. 3: updates the checksum field 'Check' when a halfword
+// of the checksummed data changes from 'Old' to 'New'
+// HC' = ~(~HC + ~m + m')
+
+unsigned short ChecksumUpdate(unsigned short Check, unsigned short Old, unsigned short New)
+{
+  uint32_t Sum;
+
+  Sum = (unsigned short)~Check;
+  Sum += (unsigned short)~Old;
+  Sum += New;
+  return ~ChecksumFold(Sum);
+}
+
+// replaces 'Count' bytes 'Old' by 'New' in the partial sum 'Sum'
+// ('OddOffset' != 0 if they start at an odd offset of the frame)
+
+uint32_t ChecksumReplace(uint32_t Sum, const void *Old, const void *New,
+                         unsigned short Count, unsigned char OddOffset)
+{
+  unsigned short OldSum, NewSum;
+
+  OldSum = ChecksumFold(ChecksumPartial(Old, Count, 0));
+  NewSum = ChecksumFold(ChecksumPartial(New, Count, 0));
+
+  if (OddOffset)
+  {
+    OldSum = ChecksumSwap(OldSum);
+    NewSum = ChecksumSwap(NewSum);
+  }
+
+  ADD_CARRY(Sum, (unsigned short)~OldSum);       // subtract the old bytes...
+  ADD_CARRY(Sum, NewSum);                        // ...and add the new ones
+  return Sum;
+}
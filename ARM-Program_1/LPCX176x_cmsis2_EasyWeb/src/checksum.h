@@ -0,0 +1,23 @@
+//*****************************************************************************
+// checksum.h - Internet checksum (RFC 1071 / RFC 1624) for the easyWEB stack
+//
+// Partial sums are 32 bit one's complement accumulators. They may be added
+// together as long as every piece starts at an even offset of the frame
+// (else swap its folded sum first, see ChecksumSwap()). They are uint32_t,
+// the same type as unsigned long on the M3, so the module builds unchanged
+// for the host tests in ../tools.
+//*****************************************************************************
+
+#ifndef __CHECKSUM_H
+#define __CHECKSUM_H
+
+#include <stdint.h>
+
+uint32_t ChecksumPartial(const void *Start, unsigned short Count, uint32_t Sum);
+unsigned short ChecksumFold(uint32_t Sum);
+unsigned short ChecksumSwap(unsigned short Sum);
+unsigned short ChecksumUpdate(unsigned short Check, unsigned short Old, unsigned short New);
+uint32_t ChecksumReplace(uint32_t Sum, const void *Old, const void *New,
+                         unsigned short Count, unsigned char OddOffset);
+
+#endif
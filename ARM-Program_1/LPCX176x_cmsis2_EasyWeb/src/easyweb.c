@@ -24,6 +24,9 @@
 #include "stdio.h"
 #include "string.h"
 
+// the board parts are left out of the host build (tools/Makefile), it
+// runs the server from a main() of its own, see EasyWebPoll()
+#ifndef EASYWEB_HOST
 #include <cr_section_macros.h>
 #include <NXP/crp.h>
 
@@ -31,6 +34,7 @@
 // by the linker when "Enable Code Read Protect" selected.
 // See crp.h header for more information
 __CRP const unsigned int CRP_WORD = CRP_NO_CRP ;
+#endif
 
 
 // CodeRed - added #define extern on next line (else variables
@@ -49,7 +53,10 @@ __CRP const unsigned int CRP_WORD = CRP_NO_CRP ;
 // CodeRed - include .h rather than .c file
 // #include "tcpip.c"                               // easyWEB TCP/IP stack
 #include "tcpip.h"                               // easyWEB TCP/IP stack
+#include "checksum.h"
+#include "telemetry.h"
 
+#ifndef EASYWEB_HOST
 // CodeRed - added NXP LPC register definitions header
 #include "LPC17xx.h"
 
@@ -62,18 +69,24 @@ __CRP const unsigned int CRP_WORD = CRP_NO_CRP ;
 			                  LCD_TERMINAL_NoNL,COLOR_YELLOW, COLOR_BLUE)
 #define LCD_PRINT_IPADDRESS(a,b,c,d) LCD_PRINT_IPADDRESS_1(a,b,c,d)
 
+#endif
 #endif
 
 // CodeRed - include renamed .h rather than .c file
 // #include "webside.c"                             // webside for our HTTP server (HTML)
 #include "webside.h"                             // webside for our HTTP server (HTML)
 
+// the HTTP-header, the webside and the telemetry batches must fit into the
+// AHB SRAM left behind the TxFrame1s (array size gets negative and compiling
+// fails otherwise)
+typedef char HTTPResponseFits[(TELEMETRY_BUFFERS_OFS + TELEMETRY_BUFFERS_SIZE <= ETH_RAM_SIZE) ? 1 : -1];
 
 
 // CodeRed - added for use in dynamic side of web page
 unsigned int aaPagecounter=0;
 unsigned int adcValue = 0;
 
+#ifndef EASYWEB_HOST
 int main (void)
 {
 // CodeRed - removed init functions as not required for LPC1776
@@ -105,7 +118,42 @@ int main (void)
 	LCD_PRINT_IPADDRESS(MYIP_1, MYIP_2, MYIP_3, MYIP_4);
 #endif
 	
-	TCPLowLevelInit();
+	EasyWebInit();
+
+// CodeRed - added info message
+#ifdef __LPCXPRESSO__
+	  // LPCXpresso 176x board
+  printf ("Up and running!\n");
+#else
+  LCD_PrintString2Terminal ("Up and running!\n", LCD_TERMINAL_NoNL,COLOR_YELLOW, COLOR_BLUE);
+#endif
+  
+  while (1)                                      // repeat forever
+  {
+    EasyWebPoll();
+#ifdef EASYWEB_BENCHMARK
+    NetBenchReport();
+#endif
+
+    __disable_irq();                                       // sleep until the EMAC or the
+    if (!TCPWorkPending())                                 // TCP timer has work for us
+      __WFI();                                             // (wakes on a pending interrupt
+    __enable_irq();                                        // even though they're masked)
+  }
+}
+#endif
+
+// starts the stack and the servers: the HTTP server on every
+// connection and the telemetry publisher
+
+void EasyWebInit(void)
+{
+  unsigned char i;
+
+  TCPLowLevelInit();
+  InitHTTPResponse();                            // copy the page to AHB SRAM once
+  InitDynamicValues();                           // find the strings to replace once
+  TelemetryInit(TELEMETRY_BUFFERS, GetTelemetryVal); // publish samples to subscribers
 
 /*
   *(unsigned char *)RemoteIP = 24;               // uncomment those lines to get the
@@ -124,90 +172,133 @@ int main (void)
   }
 */
 
-  HTTPStatus = 0;                                // clear HTTP-server's flag register
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)      // every connection serves HTTP
+  {
+    TCPSelect(i);
+    HTTPStatus = 0;                              // clear HTTP-server's flag register
 
-  TCPLocalPort = TCP_PORT_HTTP;                  // set port we want to listen to
- 
-// CodeRed - added info message
-#ifdef __LPCXPRESSO__
-	  // LPCXpresso 176x board
-  printf ("Up and running!\n");
-#else
-  LCD_PrintString2Terminal ("Up and running!\n", LCD_TERMINAL_NoNL,COLOR_YELLOW, COLOR_BLUE);
-#endif
-  
-  while (1)                                      // repeat forever
+    TCPLocalPort = TCP_PORT_HTTP;                // set port we want to listen to
+  }
+}
+
+// one pass of the main loop. the board sleeps after it until
+// TCPWorkPending(), the host build calls it from its own loop
+
+void EasyWebPoll(void)
+{
+  unsigned char i;
+
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
   {
-    if (!(SocketStatus & SOCK_ACTIVE)) TCPPassiveOpen();   // listen for incoming TCP-connection
-    DoNetworkStuff();                                      // handle network and easyWEB-stack
-                                                           // events
-    HTTPServer();
+    TCPSelect(i);
+    if (!(SocketStatus & SOCK_ACTIVE)) TCPPassiveOpen(); // listen for incoming TCP-connection
   }
+  DoNetworkStuff();                                      // handle network and easyWEB-stack
+                                                         // events
+  HTTPServer();
+  TelemetryPoll();                                       // sample, send full batches
 }
 
 // This function implements a very simple dynamic HTTP-server.
 // It waits until connected, then sends a HTTP-header and the
 // HTML-code stored in memory. Before sending, it replaces
 // some special strings with dynamic values.
-// NOTE: For strings crossing page boundaries, replacing will
-// not work. In this case, simply add some extra lines
-// (e.g. CR and LFs) to the HTML-code.
+// Several clients are served at the same time, one per TCP
+// connection.
 
 void HTTPServer(void)
 {
-  if (SocketStatus & SOCK_CONNECTED)             // check if somebody has connected to our TCP
-  {
-    if (SocketStatus & SOCK_DATA_AVAILABLE)      // check if remote TCP sent data
-      TCPReleaseRxBuffer();                      // and throw it away
+  unsigned char i;
+  unsigned int Count;                            // bytes in the next segment
+  unsigned long Sum;                             // checksum partial sum of a segment
+
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)      // serve every connection in turn,
+  {                                              // each has its own buffers and page pointer
+    TCPSelect(i);
 
-    if (SocketStatus & SOCK_TX_BUF_RELEASED)     // check if buffer is free for TX
+    if (SocketStatus & SOCK_CONNECTED)             // check if somebody has connected to our TCP
     {
-      if (!(HTTPStatus & HTTP_SEND_PAGE))        // init byte-counter and pointer to webside
-      {                                          // if called the 1st time
-        HTTPBytesToSend = sizeof(WebSide) - 1;   // get HTML length, ignore trailing zero
-        PWebSide = (unsigned char *)WebSide;     // pointer to HTML-code
-      }
+      if (SocketStatus & SOCK_DATA_AVAILABLE)      // check if remote TCP sent data
+        TCPReleaseRxBuffer();                      // and throw it away
 
-      if (HTTPBytesToSend > MAX_TCP_TX_DATA_SIZE)     // transmit a segment of MAX_SIZE
+      if (SocketStatus & SOCK_TX_BUF_RELEASED)     // check if buffer is free for TX
       {
-        if (!(HTTPStatus & HTTP_SEND_PAGE))           // 1st time, include HTTP-header
-        {
-          memcpy(TCP_TX_BUF, GetResponse, sizeof(GetResponse) - 1);
-          memcpy(TCP_TX_BUF + sizeof(GetResponse) - 1, PWebSide, MAX_TCP_TX_DATA_SIZE - sizeof(GetResponse) + 1);
-          HTTPBytesToSend -= MAX_TCP_TX_DATA_SIZE - sizeof(GetResponse) + 1;
-          PWebSide += MAX_TCP_TX_DATA_SIZE - sizeof(GetResponse) + 1;
+        BENCH_START();
+
+        if (!(HTTPStatus & HTTP_SEND_PAGE))        // init byte-counter and pointer to webside
+        {                                          // if called the 1st time
+          HTTPBytesToSend = HTTP_RESPONSE_SIZE;    // HTTP-header and HTML
+          PWebSide = HTTPResponse;                 // pointer to HTTP-header
+          FormatDynamicValues();                   // sample the values for this page
         }
-        else
-        {
-          memcpy(TCP_TX_BUF, PWebSide, MAX_TCP_TX_DATA_SIZE);
-          HTTPBytesToSend -= MAX_TCP_TX_DATA_SIZE;
-          PWebSide += MAX_TCP_TX_DATA_SIZE;
+
+        while (HTTPBytesToSend && (SocketStatus & SOCK_TX_BUF_RELEASED))
+        {                                          // fill the send window with segments
+          Count = HTTPBytesToSend;                 // of the MSS or the leftover bytes
+          if (Count > TCPTxMSS)
+            Count = TCPTxMSS;
+          if (Count > MAX_TCP_TX_DATA_SIZE)        // too many strings to send it in pieces?
+            if (2 * DynamicValuesWithin(PWebSide - HTTPResponse, Count) + 1 > TCP_MAX_TX_FRAGS)
+              Count = MAX_TCP_TX_DATA_SIZE;        // it's copied to TCP_TX_BUF
+
+          Sum = InsertDynamicValues(PWebSide - HTTPResponse, Count,
+                                    WebSideSegmentSum(PWebSide - HTTPResponse, Count));
+          TCPTxDataCount = Count;                  // bytes to xfer
+          TCPTransmitTxBufferSum(Sum);             // xfer the segment
+          HTTPBytesToSend -= Count;
+          PWebSide += Count;
+
+          if (!HTTPBytesToSend)                    // last segment sent,
+          {
+            TCPClose();                            // close connection
+            BENCH_COUNT(Pages);
+          }
         }
-          
-        TCPTxDataCount = MAX_TCP_TX_DATA_SIZE;   // bytes to xfer
-        InsertDynamicValues();                   // exchange some strings...
-        TCPTransmitTxBuffer();                   // xfer buffer
-      }
-      else if (HTTPBytesToSend)                  // transmit leftover bytes
-      {
-        memcpy(TCP_TX_BUF, PWebSide, HTTPBytesToSend);
-        TCPTxDataCount = HTTPBytesToSend;        // bytes to xfer
-        InsertDynamicValues();                   // exchange some strings...
-        TCPTransmitTxBuffer();                   // send last segment
-        TCPClose();                              // and close connection
-        HTTPBytesToSend = 0;                     // all data sent
-      }
 
-      HTTPStatus |= HTTP_SEND_PAGE;              // ok, 1st loop executed
+        HTTPStatus |= HTTP_SEND_PAGE;              // ok, 1st loop executed
+        BENCH_STOP(PageCycles);
+      }
     }
+    else
+      HTTPStatus &= ~HTTP_SEND_PAGE;               // reset help-flag if not connected
   }
-  else
-    HTTPStatus &= ~HTTP_SEND_PAGE;               // reset help-flag if not connected
 }
 
 
 
 
+// prints the benchmark counters each 10 s and clears them:
+// * frames handled per s, and how many the CPU could handle (cycles
+//   per frame, incl. parsing, the TCP and the answers)
+// * cycles per page served (segments, checksums, dynamic values)
+// * retransmissions and connections given up, e.g. with frames
+//   dropped on purpose (ETH_TX_DROP_EVERY)
+// NOTE: printing by semihosting stalls the CPU, the counters are
+//       cleared after it
+
+#ifdef EASYWEB_BENCHMARK
+void NetBenchReport(void)
+{
+  unsigned long Ms = TCPTime - NetStats.Since;
+
+  if (Ms < 10000) return;
+
+#ifdef __LPCXPRESSO__
+  printf("%lu frames/s, %lu cycles/frame (max. %lu frames/s)\n",
+         NetStats.RxFrames * 1000 / Ms,
+         NetStats.RxFrames ? NetStats.RxCycles / NetStats.RxFrames : 0,
+         NetStats.RxCycles ? (unsigned long)((unsigned long long)SystemCoreClock * NetStats.RxFrames / NetStats.RxCycles) : 0);
+  printf("%lu pages, %lu cycles/page\n",
+         NetStats.Pages, NetStats.Pages ? NetStats.PageCycles / NetStats.Pages : 0);
+  printf("%lu retransmissions, %lu timeouts, %lu frames dropped\n",
+         NetStats.Retransmissions, NetStats.Timeouts, GetErrors_EthMAC()->TxDropped);
+#endif
+
+  memset(&NetStats, 0, sizeof(NetStats));
+  NetStats.Since = TCPTime;
+}
+#endif
+
 // Code Red - GetAD7Val function replaced
 // Rather than using the AD convertor, in this version we simply increment
 // a counter the function is called, wrapping at 1024. 
@@ -220,6 +311,14 @@ unsigned int GetAD7Val(void)
   return aaScrollbar;
 }
 
+// returns the pseudo-ADconverter value for the telemetry publisher
+// (without stepping it on, that's done by the web page)
+
+unsigned short GetTelemetryVal(void)
+{
+  return aaScrollbar;
+}
+
 // Code Red - Original MSP430 version of GetAD7Val() removed
 /*
 // samples and returns the AD-converter value of channel 7
@@ -301,51 +400,215 @@ unsigned int GetTempVal(void)
 */
 
 
-// searches the TX-buffer for special strings and replaces them
-// with dynamic values (AD-converter results)
+// copies the HTTP-header and the webside into the AHB SRAM behind the
+// TxFrame1s, so that the EMAC can send the page from there, and sums
+// it up in chunks for WebSideSegmentSum()
 
-// Code Red - new version of InsertDynamicValues()
-void InsertDynamicValues(void)
+void InitHTTPResponse(void)
 {
-  unsigned char *Key;
-           char NewKey[6];
   unsigned int i;
-  
-  if (TCPTxDataCount < 4) return;                     // there can't be any special string
-  
-  Key = TCP_TX_BUF;
-  
-  for (i = 0; i < (TCPTxDataCount - 3); i++)
+
+  memcpy(HTTPResponse, GetResponse, sizeof(GetResponse) - 1);
+  memcpy(HTTPResponse + sizeof(GetResponse) - 1, WebSide, sizeof(WebSide) - 1);
+
+  for (i = 0; (i < WEBSIDE_SUM_CHUNKS) && ((i + 1) * WEBSIDE_SUM_CHUNK <= HTTP_RESPONSE_SIZE); i++)
+    WebSideSums[i] = ChecksumFold(ChecksumPartial(HTTPResponse + i * WEBSIDE_SUM_CHUNK, WEBSIDE_SUM_CHUNK, 0));
+}
+
+// searches the webside once for special strings ("AD8%", "AD7%"
+// and "AD1%") and notes where they are, so that sending a segment
+// only has to patch those places instead of scanning every byte
+
+void InitDynamicValues(void)
+{
+  unsigned int i;
+  unsigned char Width;
+
+  DynamicValueCount = 0;
+
+  for (i = 0; i + 3 < HTTP_RESPONSE_SIZE; i++)
   {
-    if (*Key == 'A')
-     if (*(Key + 1) == 'D')
-       if (*(Key + 3) == '%')
-         switch (*(Key + 2))
+    if (HTTPResponse[i] == 'A')
+     if (HTTPResponse[i + 1] == 'D')
+       if (HTTPResponse[i + 3] == '%')
+       {
+         switch (HTTPResponse[i + 2])
          {
-           case '8' :                                 // "AD8%"?
-           {
-             sprintf(NewKey, "%04d", GetAD7Val());     // insert pseudo-ADconverter value
-             memcpy(Key, NewKey, 4);                  
-             break;
-           }
-           case '7' :                                 // "AD7%"?
-           {
-             sprintf(NewKey, "%3u", adcValue);     // copy saved value from previous read
-             memcpy(Key, NewKey, 3);                 
-             break;
-           }
-		   case '1' :                                 // "AD1%"?
-           {
- 			 sprintf(NewKey, "%4u", ++aaPagecounter);    // increment and insert page counter
-             memcpy(Key, NewKey, 4);  
-//			 *(Key + 3) = ' ';  
-             break;
-           }
+           case '8' : { Width = 4; break; }     // "AD8%" -> pseudo-ADconverter value
+           case '7' : { Width = 3; break; }     // "AD7%" -> saved value, keeps the '%'
+           case '1' : { Width = 4; break; }     // "AD1%" -> page counter
+           default :  { Width = 0; break; }
          }
-    Key++;
+
+         if (Width && (DynamicValueCount < MAX_DYNAMIC_VALUES))
+         {
+           DynamicValues[DynamicValueCount].Offset = i;
+           DynamicValues[DynamicValueCount].Key = HTTPResponse[i + 2];
+           DynamicValues[DynamicValueCount].Width = Width;
+           DynamicValueCount++;
+         }
+       }
   }
 }
 
+// samples the dynamic values once per page served, in the order they
+// appear on the page (so "AD7%" shows the value read for "AD8%")
+
+void FormatDynamicValues(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < DynamicValueCount; i++)
+    switch (DynamicValues[i].Key)
+    {
+      case '8' :                                      // insert pseudo-ADconverter value
+      {
+        FormatDecimal(HTTPValues[i], GetAD7Val(), 4, '0');
+        break;
+      }
+      case '7' :                                      // copy saved value from previous read
+      {
+        FormatDecimal(HTTPValues[i], adcValue, 3, ' ');
+        break;
+      }
+      case '1' :                                      // increment and insert page counter
+      {
+        FormatDecimal(HTTPValues[i], ++aaPagecounter, 4, ' ');
+        break;
+      }
+    }
+}
+
+// returns the checksum partial sum of the static segment at 'PageOffset'.
+// the segment size depends on the client's MSS and window, so the sum is
+// put together from the sums of the whole chunks the segment covers
+// ('WebSideSums'), only its ends are summed up here.
+// NOTE: 'PageOffset' must be even (chunks then start at even offsets
+//       of the segment and their sums can simply be added)
+
+unsigned long WebSideSegmentSum(unsigned int PageOffset, unsigned int Count)
+{
+  unsigned int Chunk, Size;
+  unsigned int End = PageOffset + Count;
+  unsigned long Sum = 0;
+
+  while (PageOffset < End)
+  {
+    Chunk = PageOffset / WEBSIDE_SUM_CHUNK;
+    Size = (Chunk + 1) * WEBSIDE_SUM_CHUNK - PageOffset;   // rest of this chunk
+    if (Size > End - PageOffset)
+      Size = End - PageOffset;
+
+    if ((Size == WEBSIDE_SUM_CHUNK) && (Chunk < WEBSIDE_SUM_CHUNKS))
+      Sum += WebSideSums[Chunk];                           // whole chunk (folded, so
+                                                           // 128 of them can't overflow)
+    else
+      Sum = ChecksumPartial(HTTPResponse + PageOffset, Size, Sum);
+
+    PageOffset += Size;
+  }
+  return Sum;
+}
+
+// returns the nr. of "ADx%" strings (partly) within the segment of
+// 'Count' bytes at 'PageOffset'
+
+unsigned int DynamicValuesWithin(unsigned int PageOffset, unsigned int Count)
+{
+  unsigned int i, Within = 0;
+
+  for (i = 0; i < DynamicValueCount; i++)
+    if ((DynamicValues[i].Offset + DynamicValues[i].Width > PageOffset) &&
+        (DynamicValues[i].Offset < PageOffset + Count))
+      Within++;
+
+  return Within;
+}
+
+// hands the segment of 'Count' bytes at 'PageOffset' to the TCP as
+// pieces (TCPTxFragment()): the static parts straight from 'HTTPResponse',
+// the dynamic values from copies in 'TCP_TX_BUF'. a string crossing the
+// segment's borders gets the matching part of its value in each segment.
+// if the segment holds too many strings for the pieces, it's copied
+// to 'TCP_TX_BUF' and patched there instead.
+// 'Sum' is the checksum partial sum of the unpatched segment, the
+// function returns it corrected for the replaced bytes (RFC 1624).
+// NOTE: * 'PageOffset' must be even (segments are 'TCPTxMSS' long, which is even)
+//       * the copy needs 'Count' <= MAX_TCP_TX_DATA_SIZE, see DynamicValuesWithin()
+
+unsigned long InsertDynamicValues(unsigned int PageOffset, unsigned int Count, unsigned long Sum)
+{
+  unsigned int i, First, Last;
+  unsigned int From, To, Done;
+  unsigned char *Value, *Copy;
+
+  First = 0;                                          // values within this segment
+  while ((First < DynamicValueCount) &&
+         (DynamicValues[First].Offset + DynamicValues[First].Width <= PageOffset))
+    First++;
+  Last = First;
+  while ((Last < DynamicValueCount) && (DynamicValues[Last].Offset < PageOffset + Count))
+    Last++;
+
+  Copy = 0;
+  if (2 * (Last - First) + 1 > TCP_MAX_TX_FRAGS)      // static part, value, static part...
+  {
+    Copy = TCP_TX_BUF;
+    memcpy(Copy, HTTPResponse + PageOffset, Count);
+  }
+
+  Value = TCP_TX_BUF;                                 // AHB copies of the values
+  Done = PageOffset;
+
+  for (i = First; i < Last; i++)
+  {
+    From = DynamicValues[i].Offset;
+    To = From + DynamicValues[i].Width;
+
+    if (From < PageOffset) From = PageOffset;         // clip to this segment
+    if (To > PageOffset + Count) To = PageOffset + Count;
+
+    Sum = ChecksumReplace(Sum, HTTPResponse + From, &HTTPValues[i][From - DynamicValues[i].Offset],
+                          To - From, (From - PageOffset) & 1);
+
+    if (Copy)
+      memcpy(Copy + From - PageOffset, &HTTPValues[i][From - DynamicValues[i].Offset], To - From);
+    else
+    {
+      if (From > Done)
+        TCPTxFragment(HTTPResponse + Done, From - Done);
+      memcpy(Value, &HTTPValues[i][From - DynamicValues[i].Offset], To - From);
+      TCPTxFragment(Value, To - From);
+      Value += To - From;
+    }
+    Done = To;
+  }
+
+  if (!Copy && (Done < PageOffset + Count))
+    TCPTxFragment(HTTPResponse + Done, PageOffset + Count - Done);
+
+  return Sum;
+}
+
+// writes 'Value' right-aligned into 'Width' chars, padded with 'Fill'
+// (a fixed-width replacement for "%04d" / "%3u", no trailing zero).
+// values with more digits than 'Width' keep their lower digits.
+
+void FormatDecimal(unsigned char *Dest, unsigned int Value, unsigned char Width, unsigned char Fill)
+{
+  Dest += Width;
+
+  do                                             // at least one digit, also for 0
+  {
+    *--Dest = '0' + Value % 10;
+    Value /= 10;
+    Width--;
+  } while (Value && Width);
+
+  while (Width--)
+    *--Dest = Fill;
+}
+
 
 // Code Red - commented out original InsertDynamicValues()
 /*
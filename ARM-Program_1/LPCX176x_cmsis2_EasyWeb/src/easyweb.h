@@ -14,6 +14,8 @@
 #ifndef __EASYWEB_H
 #define __EASYWEB_H
 
+#include "tcpip.h"                               // TCP_MAX_CONNECTIONS, TCPCurrent
+
 const unsigned char GetResponse[] =              // 1st thing our server sends to a client
 {
   "HTTP/1.0 200 OK\r\n"                          // protocol ver 1.0, code 200, reason OK
@@ -21,17 +23,61 @@ const unsigned char GetResponse[] =              // 1st thing our server sends t
   "\r\n"                                         // indicate end of HTTP-header
 };
 void start(void);
+void EasyWebInit(void);
+void EasyWebPoll(void);
 void InitOsc(void);                              // prototypes
 void InitPorts(void);
 void HTTPServer(void);
-void InsertDynamicValues(void);
+void InitHTTPResponse(void);
+void InitDynamicValues(void);
+void FormatDynamicValues(void);
+unsigned long InsertDynamicValues(unsigned int PageOffset, unsigned int Count, unsigned long Sum);
+unsigned long WebSideSegmentSum(unsigned int PageOffset, unsigned int Count);
+unsigned int DynamicValuesWithin(unsigned int PageOffset, unsigned int Count);
+void FormatDecimal(unsigned char *Dest, unsigned int Value, unsigned char Width, unsigned char Fill);
 unsigned int GetAD7Val(void);
+unsigned short GetTelemetryVal(void);
+void NetBenchReport(void);
 unsigned int GetTempVal(void);
 
-unsigned char *PWebSide;                         // pointer to webside
-unsigned int HTTPBytesToSend;                    // bytes left to send
+#define MAX_DYNAMIC_VALUES           8           // "ADx%" strings the webside may contain
+#define DYNAMIC_VALUE_SIZE           4           // max. chars a value replaces
+
+typedef struct {                                 // a "ADx%" string found in the webside
+  unsigned short Offset;                         // position in 'HTTPResponse'
+  unsigned char Key;                             // the 'x'
+  unsigned char Width;                           // nr. of chars replaced
+} TDynamicValue;
+
+TDynamicValue DynamicValues[MAX_DYNAMIC_VALUES]; // sorted by offset
+unsigned char DynamicValueCount;
+
+typedef struct {                                 // state of one client's page transfer
+  unsigned char *PWebSide;                       // pointer into 'HTTPResponse'
+  unsigned int BytesToSend;                      // bytes left to send
+  unsigned char Status;                          // status byte
+  unsigned char Values[MAX_DYNAMIC_VALUES][DYNAMIC_VALUE_SIZE]; // dynamic values of this page
+} THTTPSession;
+
+THTTPSession HTTPSessions[TCP_MAX_CONNECTIONS];  // one per TCP connection
+
+#define PWebSide        (HTTPSessions[TCPCurrent].PWebSide)
+#define HTTPBytesToSend (HTTPSessions[TCPCurrent].BytesToSend)
+#define HTTPStatus      (HTTPSessions[TCPCurrent].Status)
+#define HTTPValues      (HTTPSessions[TCPCurrent].Values)
+
+// the HTTP-header and the webside are copied once into the AHB SRAM
+// behind the TxFrame1s, the EMAC sends the segments straight from there
+#define HTTPResponse    ((unsigned char *)TCP_TX_FRAMES_END)
+#define HTTP_RESPONSE_SIZE (sizeof(GetResponse) - 1 + sizeof(WebSide) - 1) // w/o trailing zeros
+
+// the telemetry batches follow, word aligned
+#define TELEMETRY_BUFFERS_OFS ((TCP_TX_FRAMES_OFS + HTTP_RESPONSE_SIZE + 3) & ~3)
+#define TELEMETRY_BUFFERS ((unsigned char *)(ETH_RAM_BASE + TELEMETRY_BUFFERS_OFS))
 
-unsigned char HTTPStatus;                        // status byte 
+#define WEBSIDE_SUM_CHUNK            64          // bytes summed up at once (even!)
+#define WEBSIDE_SUM_CHUNKS           128         // chunks whose checksum is kept (8 kB)
+unsigned short WebSideSums[WEBSIDE_SUM_CHUNKS];  // folded sums of the static chunks
 #define HTTP_SEND_PAGE               0x01        // help flag
 
 #endif
@@ -24,9 +24,31 @@
 #include "tcpip.h"
 #include "LPC17xx.h"
 
-// CodeRed - new static pointers for receive and transmit
-static unsigned short *rxptr;
-static unsigned short *txptr;
+// events from ENET_IRQHandler() to the stack. lock-free: only the
+// interrupt writes 'EventHead', only the stack writes 'EventTail'
+static volatile unsigned char EventQueue[ETH_EVENT_QUEUE_SIZE];
+static volatile unsigned char EventHead;
+static volatile unsigned char EventTail;
+static volatile TEthErrors Errors;
+static volatile unsigned char RxOverrunPending;  // RX stopped, see ResetRx_EthMAC()
+#if ETH_TX_DROP_EVERY
+static unsigned int TxDropCount;                 /* frames since the last one dropped */
+#endif
+
+// returns 1 if the next frame is to be dropped (ETH_TX_DROP_EVERY)
+
+static unsigned int DropTxFrame(void)
+{
+#if ETH_TX_DROP_EVERY
+  if (++TxDropCount >= ETH_TX_DROP_EVERY)
+  {
+    TxDropCount = 0;
+    Errors.TxDropped++;
+    return 1;
+  }
+#endif
+  return 0;
+}
 
 // CodeRed - function added to write to external ethernet PHY chip
 void WriteToPHY (int reg, int writeval)
@@ -93,6 +115,29 @@ void Init8900(void)
 }
 */
 
+// (re)initialises the RX descriptors and hands them all to the EMAC
+
+static void InitRxDescriptors(void)
+{
+  unsigned int loop;
+
+  for (loop = 0; loop < NUM_RX_FRAG; loop++) {
+    RX_DESC_PACKET(loop)  = RX_BUF(loop);
+    RX_DESC_CTRL(loop)    = RCTRL_INT | (ETH_FRAG_SIZE-1);
+    RX_STAT_INFO(loop)    = 0;
+    RX_STAT_HASHCRC(loop) = 0;
+  }
+
+  // Set up the Receive Descriptor Base address register
+  LPC_EMAC->RxDescriptor    = RX_DESC_BASE;
+  // Set up the Receive Status Base address register
+  LPC_EMAC->RxStatus        = RX_STAT_BASE;
+  // Setup the Receive Number of Descriptor register
+  LPC_EMAC->RxDescriptorNumber = NUM_RX_FRAG-1;
+  //  Set Receive Consume Index register to 0
+  LPC_EMAC->RxConsumeIndex  = 0;
+}
+
 // Ethernet power/clock control bit in PCONP register
 #define PCENET 0x40000000
 // Ethernet configuration for PINSEL2, as per user guide section 5.3
@@ -235,21 +280,7 @@ void Init_EthMAC(void)
 
  
   // Now initialise the Rx descriptors    
-  for (loop = 0; loop < NUM_RX_FRAG; loop++) {
-    RX_DESC_PACKET(loop)  = RX_BUF(loop);
-    RX_DESC_CTRL(loop)    = RCTRL_INT | (ETH_FRAG_SIZE-1);
-    RX_STAT_INFO(loop)    = 0;
-    RX_STAT_HASHCRC(loop) = 0;
-  }
-
-  // Set up the Receive Descriptor Base address register
-  LPC_EMAC->RxDescriptor    = RX_DESC_BASE;
-  // Set up the Receive Status Base address register
-  LPC_EMAC->RxStatus        = RX_STAT_BASE;
-  // Setup the Receive Number of Descriptor register
-  LPC_EMAC->RxDescriptorNumber = NUM_RX_FRAG-1;
-  //  Set Receive Consume Index register to 0
-  LPC_EMAC->RxConsumeIndex  = 0;
+  InitRxDescriptors();
 
   // Now initialise the Tx descriptors 
   for (loop = 0; loop < NUM_TX_FRAG; loop++) {
@@ -274,11 +305,18 @@ void Init_EthMAC(void)
   LPC_EMAC->RxFilterCtrl = RFC_BCAST_EN | RFC_PERFECT_EN;					 
  
   // Enable interrupts MAC Module Control Interrupt Enable Register
-  LPC_EMAC->IntEnable = INT_RX_DONE | INT_TX_DONE;
+  // (INT_RX_ERR isn't used, the EMAC flags every type field > 1500 as
+  // a range error)
+  LPC_EMAC->IntEnable = INT_RX_DONE | INT_TX_DONE |
+                        INT_RX_OVERRUN | INT_TX_UNDERRUN | INT_TX_ERR;
 
   // Reset all ethernet interrupts in MAC module
   LPC_EMAC->IntClear  = 0xFFFF;
 
+  EventHead = EventTail = 0;
+  RxOverrunPending = 0;
+  NVIC_EnableIRQ(ENET_IRQn);
+
   // Finally enable receive and transmit mode in ethernet core
   LPC_EMAC->Command  |= (CR_RX_EN | CR_TX_EN);
   LPC_EMAC->MAC1     |= MAC1_REC_EN;
@@ -326,51 +364,70 @@ void WriteFrame8900(unsigned int Data)
 }
 */
 
-// writes a word in little-endian byte order to TX_BUFFER
-void WriteFrame_EthMAC(unsigned short Data)
-{
-  *txptr++ = Data;
-}
+// returns the EMAC TX buffer the next frame will be sent from, so the
+// frame can be built there in place (no copying). the buffer belongs to
+// the caller until SendTxBuffer_EthMAC(). returns 0 if the EMAC is still
+// busy with all of its buffers.
 
+unsigned char *GetTxBuffer_EthMAC(void)
+{
+  if (!Rdy4Tx())
+    return 0;
 
+  return (unsigned char *)TX_BUF(LPC_EMAC->TxProduceIndex);
+}
 
-// copies bytes from MCU-memory to frame port
-// NOTES: * an odd number of byte may only be transfered
-//          if the frame is written to the end!
-//        * MCU-memory MUST start at word-boundary
+// sends the frame built in GetTxBuffer_EthMAC()'s buffer
 
-// Code Red - rewritten for LPC1776
-/*
-void CopyToFrame8900(void *Source, unsigned int Size)
+void SendTxBuffer_EthMAC(unsigned short FrameSize)
 {
-  P5DIR = 0xFF;                                  // data port to output
-  
-  while (Size > 1) {
-    WriteFrame8900(*((unsigned int *)Source)++);
-    Size -= 2;
-  }
-  
-  if (Size)                                      // if odd num. of bytes...
-    WriteFrame8900(*(unsigned char *)Source);    // write leftover byte (the LAN-controller
-}                                                // ignores the highbyte)
-*/
+  SendFrame_EthMAC((void *)TX_BUF(LPC_EMAC->TxProduceIndex), FrameSize);
+}
+
+// sends a frame straight from where it is, by pointing the next TX
+// descriptor at it (zero copy)
+// NOTES: * the frame MUST be in AHB SRAM (see USER_TX_BASE)
+//        * it mustn't be changed until the EMAC has sent it
+//        * check Rdy4Tx() before
 
-void CopyToFrame_EthMAC(void *Source, unsigned int Size)
+void SendFrame_EthMAC(void *Frame, unsigned short FrameSize)
 {
   unsigned int index;
-  unsigned short *pSource;
 
-  pSource = Source;
-  Size = (Size + 1) & 0xFFFE;    // round up Size to next even number
-  while (Size > 0) {
-    WriteFrame_EthMAC(*pSource++);
-    Size -= 2;
-  }
+  if (DropTxFrame()) return;
 
   index = LPC_EMAC->TxProduceIndex;
+  TX_DESC_PACKET(index) = (unsigned int)Frame;
+  TX_DESC_CTRL(index) = (FrameSize - 1) |        // size is minus-one encoded,
+                        TCTRL_LAST | TCTRL_INT;  // INT_TX_DONE once it's sent
   if (++index == NUM_TX_FRAG)
     index = 0;
-  LPC_EMAC->TxProduceIndex = index;
+  LPC_EMAC->TxProduceIndex = index;               // EMAC may go now
+}
+
+// sends a frame gathered from several pieces of AHB SRAM, one TX
+// descriptor per piece (scatter-gather), e.g. the headers from a small
+// buffer and the payload straight from where the data lives
+// NOTES: * same rules as SendFrame_EthMAC() for every fragment
+//        * check Rdy4TxFragments(Count) before
+
+void SendFragments_EthMAC(const TTxFragment *Fragment, unsigned int Count)
+{
+  unsigned int index;
+
+  if (DropTxFrame()) return;
+
+  index = LPC_EMAC->TxProduceIndex;
+  while (Count--)
+  {
+    TX_DESC_PACKET(index) = (unsigned int)Fragment->Data;
+    TX_DESC_CTRL(index) = (Fragment->Size - 1) |   // INT_TX_DONE after the last one
+                          (Count ? 0 : TCTRL_LAST | TCTRL_INT);
+    Fragment++;
+    if (++index == NUM_TX_FRAG)
+      index = 0;
+  }
+  LPC_EMAC->TxProduceIndex = index;               // hand over the whole frame at once
 }
 
 // CodeRed - Read8900() not needed
@@ -425,13 +482,6 @@ unsigned int ReadFrame8900(void)
 }
 */
 
-// reads a word in little-endian byte order from RX_BUFFER
-
-unsigned short ReadFrame_EthMAC(void)
-{
-  return (*rxptr++);
-}
-
 
 // reads a word in big-endian byte order from RX_FRAME_PORT
 // (useful to avoid permanent byte-swapping while reading
@@ -461,14 +511,6 @@ unsigned int ReadFrameBE8900(void)
 }
 */
 
-unsigned short ReadFrameBE_EthMAC(void)
-{
-  unsigned short ReturnValue;
-
-  ReturnValue = SwapBytes (*rxptr++);
-  return (ReturnValue);
-}
-
 // CodeRed  - not required for RDB1768 port
 /*
 // reads a word in little-endian byte order from
@@ -517,71 +559,38 @@ void CopyFromFrame8900(void *Dest, unsigned int Size)
 }                                                // for the highbyte
 */
 
-void CopyFromFrame_EthMAC(void *Dest, unsigned short Size)
-{
-  unsigned short *pDest; 
-
-  pDest = Dest;
-  while (Size > 1) {
-    *pDest++ = ReadFrame_EthMAC();
-    Size -= 2;
-  }
-  
-  if (Size) {                                         // check for leftover byte...
-    *(unsigned char *)pDest = (char)ReadFrame_EthMAC();// the LAN-Controller will return 0
-  }                                                   // for the highbyte
-}
-
-
+// the stack doesn't copy received frames any longer, it parses them
+// in place (see GetRxFrame_EthMAC())
 
-// does a dummy read on frame-I/O-port
-// NOTE: only an even number of bytes is read!
+// check if the EMAC has a free TX descriptor for
+// the frame we want to send
 
-// Code Red - updated for LPC1776
-//void DummyReadFrame8900(unsigned int Size)       // discards an EVEN number of bytes
-void DummyReadFrame_EthMAC(unsigned short Size)       // discards an EVEN number of bytes
-{                                                // from RX-fifo
-  while (Size > 1) {
-// Code Red - updated for LPC1776	  
-//    ReadFrame8900();
-    ReadFrame_EthMAC();
-    Size -= 2;
-  }
+unsigned int Rdy4Tx(void)
+{
+// Code Red - updated for LPC1768
+//  Write8900(ADD_PORT, PP_BusST);
+//  return (Read8900(DATA_PORT) & READY_FOR_TX_NOW);
+  return Rdy4TxFragments(1);
 }
 
-// requests space in CS8900's on-chip memory for
-// storing an outgoing frame
+// checks if the TX ring has Count free descriptors. one of them always
+// stays unused, as produce == consume means the ring is empty
 
-// CodeRed - updated for LPC1768 port
-/*
-void RequestSend(unsigned int FrameSize)
+unsigned int Rdy4TxFragments(unsigned int Count)
 {
-  Write8900(TX_CMD_PORT, TX_START_ALL_BYTES);
-  Write8900(TX_LEN_PORT, FrameSize);
-}
-*/
-void RequestSend(unsigned short FrameSize)
-{
-  unsigned int index;
-  index  = LPC_EMAC->TxProduceIndex;
-  txptr = (unsigned short *)TX_DESC_PACKET(index);
-  TX_DESC_CTRL(index) = FrameSize | TCTRL_LAST;
-}
+  unsigned int loop;
 
-// check if CS8900 is ready to accept the
-// frame we want to send
+  if (Count >= NUM_TX_FRAG)
+    return (0);
 
-unsigned int Rdy4Tx(void)
-{
-// Code Red - updated for LPC1768
-//  Write8900(ADD_PORT, PP_BusST);
-//  return (Read8900(DATA_PORT) & READY_FOR_TX_NOW);
+  // the ethernet controller transmits much faster than the
+  // CPU can build frames, so free descriptors show up soon
+  for (loop = 0; loop < TX_WAIT_LOOPS; loop++)
+    if ((LPC_EMAC->TxConsumeIndex + NUM_TX_FRAG - LPC_EMAC->TxProduceIndex - 1)
+        % NUM_TX_FRAG >= Count)
+      return (1);
 
-  // One the LPC the ethernet controller transmits
-  // much faster than the CPU can load its buffers
-  // so will always be ready to accept frame	
-  return (1); 
-               // 
+  return (0);
 }
 
 // CodeRed - New function
@@ -596,10 +605,18 @@ unsigned short StartReadingFrame(void)
 
   index = LPC_EMAC->RxConsumeIndex;
   ReceiveLength = (RX_STAT_INFO(index) & RINFO_SIZE) - 3;
-  rxptr = (unsigned short *)RX_DESC_PACKET(index);
   return(ReceiveLength);
 }
 
+// returns the EMAC RX buffer holding the received frame, so that it
+// can be parsed in place (no copying). it stays valid until
+// StopReadingFrame() gives it back to the EMAC.
+
+unsigned char *GetRxFrame_EthMAC(void)
+{
+  return (unsigned char *)RX_DESC_PACKET(LPC_EMAC->RxConsumeIndex);
+}
+
 // CodeRed - new function
 
 void StopReadingFrame(void)
@@ -610,6 +627,106 @@ void StopReadingFrame(void)
   LPC_EMAC->RxConsumeIndex = index;
 }
 
+// queues an event for the stack (interrupt side)
+
+static void PutEvent(unsigned char Event)
+{
+  unsigned char head;
+
+  head = (EventHead + 1) & (ETH_EVENT_QUEUE_SIZE - 1);
+  if (head == EventTail)                         // full, the stack is busy anyway
+  {                                              // and will look at the rings
+    Errors.EventsLost++;
+    return;
+  }
+  EventQueue[EventHead] = Event;
+  EventHead = head;                              // publish after the entry is written
+}
+
+// EMAC interrupt: notes what happened for the stack and counts errors,
+// the frames themselves are handled by DoNetworkStuff()
+
+void ENET_IRQHandler(void)
+{
+  unsigned int status;
+
+  status = LPC_EMAC->IntStatus & LPC_EMAC->IntEnable;
+  LPC_EMAC->IntClear = status;
+
+  if (status & (INT_RX_OVERRUN | INT_TX_UNDERRUN | INT_TX_ERR))
+  {
+    if (status & INT_RX_OVERRUN)
+    {
+      Errors.RxOverrun++;
+      RxOverrunPending = 1;                      // the stack resets the RX path
+    }
+    if (status & INT_TX_UNDERRUN) Errors.TxUnderrun++;
+    if (status & INT_TX_ERR)      Errors.TxError++;
+    PutEvent(ETH_EVENT_ERROR);
+  }
+  if (status & INT_RX_DONE) PutEvent(ETH_EVENT_RX);
+  if (status & INT_TX_DONE) PutEvent(ETH_EVENT_TX);
+}
+
+// takes the next event from the queue, ETH_EVENT_NONE if it's empty
+
+unsigned char GetEvent_EthMAC(void)
+{
+  unsigned char event;
+
+  if (EventTail == EventHead)
+    return ETH_EVENT_NONE;
+  event = EventQueue[EventTail];
+  EventTail = (EventTail + 1) & (ETH_EVENT_QUEUE_SIZE - 1);
+  return event;
+}
+
+// checks if there are events in the queue
+
+unsigned int EventPending_EthMAC(void)
+{
+  return (EventTail != EventHead);
+}
+
+// returns the error counters
+
+const volatile TEthErrors *GetErrors_EthMAC(void)
+{
+  return &Errors;
+}
+
+// returns the nr. of received frames not handed back yet, the one
+// being read included
+
+unsigned int RxFrameCount_EthMAC(void)
+{
+  return (LPC_EMAC->RxProduceIndex + NUM_RX_FRAG - LPC_EMAC->RxConsumeIndex) % NUM_RX_FRAG;
+}
+
+// returns 1 after an RX overrun: the EMAC doesn't receive any more
+// until ResetRx_EthMAC()
+
+unsigned int RxOverrun_EthMAC(void)
+{
+  return RxOverrunPending;
+}
+
+// recovers from an RX overrun: resets the receive datapath and rebuilds
+// the RX descriptors. the frames still in the ring are dropped (TCP sends
+// them again), so nothing may be read from them any more
+
+void ResetRx_EthMAC(void)
+{
+  LPC_EMAC->MAC1 &= ~MAC1_REC_EN;
+  LPC_EMAC->Command = (LPC_EMAC->Command & ~CR_RX_EN) | CR_RX_RES;
+
+  InitRxDescriptors();
+  RxOverrunPending = 0;
+
+  LPC_EMAC->Command |= CR_RX_EN;
+  LPC_EMAC->MAC1 |= MAC1_REC_EN;
+}
+
 // CodeRed - new function to check if frame has been received
 unsigned int CheckIfFrameReceived(void)
 { 
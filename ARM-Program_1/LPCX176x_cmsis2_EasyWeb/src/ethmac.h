@@ -278,21 +278,78 @@
 
 /* EMAC Memory Buffer configuration for 16K Ethernet RAM. */
 #define NUM_RX_FRAG         4           /* Num.of RX Fragments 4*1536= 6.0kB */
-#define NUM_TX_FRAG         2           /* Num.of TX Fragments 3*1536= 4.6kB */
+#define NUM_TX_FRAG         16          /* Num.of TX Descriptors (ring size) */
 #define ETH_FRAG_SIZE       1536        /* Packet Fragment size 1536 Bytes   */
+#define TX_BUF_SIZE         128         /* TX Buffer per descriptor 16*128=2kB*/
 
 #define ETH_MAX_FLEN        1536        /* Max. Ethernet Frame Size          */
 
 /* EMAC variables located in AHB SRAM bank 1*/
+/* The host build (tools/Makefile) has an array as AHB SRAM (defined by   */
+/* easyweb.c like the other globals), so the layout is given as offsets   */
+/* from ETH_RAM_BASE                                                      */
+#define ETH_RAM_SIZE        0x8000      /* AHB SRAM bank 0 and 1, 32 kB      */
+#ifdef EASYWEB_HOST
+extern unsigned long EthRAM[ETH_RAM_SIZE / sizeof(unsigned long)];
+#define ETH_RAM_BASE        ((unsigned long)EthRAM)
+#else
 // Below is base address for first silicon
-//#define RX_DESC_BASE        0x20004000
+//#define ETH_RAM_BASE        0x20004000
 // Below is base address for production silicon
-#define RX_DESC_BASE        0x2007c000
-#define RX_STAT_BASE        (RX_DESC_BASE + NUM_RX_FRAG*8)
-#define TX_DESC_BASE        (RX_STAT_BASE + NUM_RX_FRAG*8)
-#define TX_STAT_BASE        (TX_DESC_BASE + NUM_TX_FRAG*8)
-#define RX_BUF_BASE         (TX_STAT_BASE + NUM_TX_FRAG*4)
-#define TX_BUF_BASE         (RX_BUF_BASE  + NUM_RX_FRAG*ETH_FRAG_SIZE)
+#define ETH_RAM_BASE        0x2007c000
+#endif
+
+#define RX_DESC_OFS         0
+#define RX_STAT_OFS         (RX_DESC_OFS + NUM_RX_FRAG*8)
+#define TX_DESC_OFS         (RX_STAT_OFS + NUM_RX_FRAG*8)
+#define TX_STAT_OFS         (TX_DESC_OFS + NUM_TX_FRAG*8)
+#define RX_BUF_OFS          (TX_STAT_OFS + NUM_TX_FRAG*4)
+#define TX_BUF_OFS          (RX_BUF_OFS  + NUM_RX_FRAG*ETH_FRAG_SIZE)
+/* AHB SRAM after the EMAC buffers, for frames the stack builds in place  */
+/* and keeps (the EMAC DMA can't reach the local SRAM)                    */
+#define USER_TX_OFS         (TX_BUF_OFS  + NUM_TX_FRAG*TX_BUF_SIZE)
+
+#define RX_DESC_BASE        (ETH_RAM_BASE + RX_DESC_OFS)
+#define RX_STAT_BASE        (ETH_RAM_BASE + RX_STAT_OFS)
+#define TX_DESC_BASE        (ETH_RAM_BASE + TX_DESC_OFS)
+#define TX_STAT_BASE        (ETH_RAM_BASE + TX_STAT_OFS)
+#define RX_BUF_BASE         (ETH_RAM_BASE + RX_BUF_OFS)
+#define TX_BUF_BASE         (ETH_RAM_BASE + TX_BUF_OFS)
+#define USER_TX_BASE        (ETH_RAM_BASE + USER_TX_OFS)
+#define USER_TX_END         (ETH_RAM_BASE + ETH_RAM_SIZE)
+
+#define TX_WAIT_LOOPS       1000        /* Polls for a free TX descriptor    */
+
+/* Loss injection: every ETH_TX_DROP_EVERY'th frame isn't sent (counted   */
+/* as TxDropped), to see how the stack recovers. 0 sends all frames.     */
+#ifndef ETH_TX_DROP_EVERY
+#define ETH_TX_DROP_EVERY   0
+#endif
+
+/* Events ENET_IRQHandler() queues for the stack, see GetEvent_EthMAC()  */
+#define ETH_EVENT_QUEUE_SIZE 16         /* power of 2, one slot stays unused */
+#define ETH_EVENT_NONE      0
+#define ETH_EVENT_RX        1           /* frame(s) received                 */
+#define ETH_EVENT_TX        2           /* frame(s) sent, descriptors free   */
+#define ETH_EVENT_ERROR     3           /* see the error counters            */
+
+/* Error counters kept by ENET_IRQHandler()                              */
+typedef struct
+{
+  unsigned long RxOverrun;
+  unsigned long TxUnderrun;
+  unsigned long TxError;
+  unsigned long EventsLost;             /* queue was full                    */
+  unsigned long TxDropped;              /* see ETH_TX_DROP_EVERY             */
+} TEthErrors;
+
+/* One piece of a frame sent with SendFragments_EthMAC(). The data must */
+/* be in AHB SRAM too; any size and alignment is fine for TX fragments  */
+typedef struct
+{
+  const void *Data;
+  unsigned short Size;
+} TTxFragment;
 
 /* RX and TX descriptor and status definitions. */
 #define RX_DESC_PACKET(i)   (*(unsigned int *)(RX_DESC_BASE   + 8*i))
@@ -303,7 +360,7 @@
 #define TX_DESC_CTRL(i)     (*(unsigned int *)(TX_DESC_BASE+4 + 8*i))
 #define TX_STAT_INFO(i)     (*(unsigned int *)(TX_STAT_BASE   + 4*i))
 #define RX_BUF(i)           (RX_BUF_BASE + ETH_FRAG_SIZE*i)
-#define TX_BUF(i)           (TX_BUF_BASE + ETH_FRAG_SIZE*i)
+#define TX_BUF(i)           (TX_BUF_BASE + TX_BUF_SIZE*i)
 
 /* MAC Configuration Register 1 */
 #define MAC1_REC_EN         0x00000001  /* Receive Enable                    */
@@ -620,16 +677,33 @@ void RequestSend(unsigned int FrameSize);
 unsigned int Rdy4Tx(void);
 */
 
+/* Ethernet driver interface. The stack (tcpip.c) reaches the network    */
+/* only through these functions and the AHB SRAM layout above. The       */
+/* backend is chosen at link time: ethmac.c drives the EMAC, the host    */
+/* build (tools/Makefile) links tools/eth_host.c instead, an in-memory   */
+/* link with pcap record and replay. The timebase is in ew_systick.h.    */
+/* RX: CheckIfFrameReceived(), StartReadingFrame() / GetRxFrame_EthMAC()  */
+/*     of the oldest frame, StopReadingFrame() hands it back.            */
+/* TX: Rdy4Tx...() before, then GetTxBuffer_EthMAC() + SendTxBuffer...() */
+/*     or Send...() of frames in AHB SRAM.                               */
+/* Events wake the stack up, see TCPWorkPending().                       */
 void Init_EthMAC(void);
-unsigned short ReadFrameBE_EthMAC(void);
-void CopyToFrame_EthMAC(void *Source, unsigned int Size);
-void CopyFromFrame_EthMAC(void *Dest, unsigned short Size);
-void DummyReadFrame_EthMAC(unsigned short Size);
-void RequestSend(unsigned short FrameSize);
+unsigned char *GetTxBuffer_EthMAC(void);
+void SendTxBuffer_EthMAC(unsigned short FrameSize);
+void SendFrame_EthMAC(void *Frame, unsigned short FrameSize);
+void SendFragments_EthMAC(const TTxFragment *Fragment, unsigned int Count);
 unsigned int Rdy4Tx(void);
+unsigned int Rdy4TxFragments(unsigned int Count);
 unsigned short StartReadingFrame(void);
+unsigned char *GetRxFrame_EthMAC(void);
 void StopReadingFrame(void);
-unsigned int CheckIfFrameReceived(void); 
+unsigned int CheckIfFrameReceived(void);
+unsigned int RxFrameCount_EthMAC(void);
+unsigned int RxOverrun_EthMAC(void);
+void ResetRx_EthMAC(void);
+unsigned char GetEvent_EthMAC(void);
+unsigned int EventPending_EthMAC(void);
+const volatile TEthErrors *GetErrors_EthMAC(void); 
 
 #endif
 
@@ -25,22 +25,26 @@
 // CODE RED TECHNOLOGIES LTD. 
 
 #include "LPC17xx.h"
+#include "ew_systick.h"
 
 extern void TCPClockHandler(void);
 
+#define DWT_CTRL             (*(volatile unsigned long *)0xE0001000)
+#define DWT_CYCCNT           (*(volatile unsigned long *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA   0x00000001
+
 volatile uint32_t TimeTick = 0;
-volatile uint32_t TimeTick2 = 0;
 
 
 // ****************
 //  SysTick_Handler
 void SysTick_Handler(void)
 {
-	TimeTick++;		// Increment first SysTick counter
-	TimeTick2++;	// Increment second SysTick counter
+	TimeTick++;		// Increment SysTick counter
+	TCPClockHandler();	// Call TCP handler (millisecond timebase)
 	
-	// After 100 ticks (100 x 10ms = 1sec)
-	if (TimeTick >= 100) {
+	// After 1000 ticks (1000 x 1ms = 1sec)
+	if (TimeTick >= 1000) {
 	  TimeTick = 0;	// Reset counter
 #ifdef __LPCXPRESSO__
 	  // LPCXpresso 176x board
@@ -50,18 +54,45 @@ void SysTick_Handler(void)
 	  LPC_GPIO1->FIOPIN ^= 1 << 25;	// Toggle user LED
 #endif
 	}
-	// After 20 ticks (20 x 10ms = 1/5sec)
-	if (TimeTick2 >= 20) {
-	  TimeTick2 = 0; // Reset counter
-	  TCPClockHandler();  // Call TCP handler
-	}  
 }
 
 // ****************
-// Setup SysTick Timer to interrupt at 10 msec intervals
-void Start_SysTick10ms(void)
+// Setup SysTick Timer to interrupt at 1 msec intervals
+void Start_SysTick1ms(void)
 {
-	if (SysTick_Config(SystemCoreClock / 100)) { 
+#ifdef __LPCXPRESSO__
+	// LPCXpresso 176x board
+	LPC_GPIO0->FIODIR = 1 << 22;	// P0.22 defined as Output (LED)
+#else
+	//RDB1768 board
+	LPC_GPIO1->FIODIR = 1 << 25;	// P1.25 defined as Output (LED)
+#endif
+
+	if (SysTick_Config(SystemCoreClock / 1000)) { 
 		while (1);  // Capture error
 	}
 }
+
+// ****************
+// Low word of the initial sequence numbers: the SysTick counter runs
+// down at the CPU clock, so a connection's ISN depends on when within
+// the ms it's opened (TIM0, read before, is never started)
+unsigned short Get_ISNClock(void)
+{
+	return SysTick->VAL;
+}
+
+// ****************
+// DWT cycle counter for the EASYWEB_BENCHMARK figures, 32 bit at the
+// CPU clock
+void Start_CycleCounter(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;	// DWT on
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+unsigned long Get_CycleCounter(void)
+{
+	return DWT_CYCCNT;
+}
@@ -0,0 +1,17 @@
+//*****************************************************************************
+// ew_systick.h - timebase of the EasyWeb port
+//
+// The stack (tcpip.c) reaches the board only through these functions and
+// the ethernet driver (ethmac.h). ew_systick.c implements them on the
+// LPC17xx, tools/board_host.c for the host build (tools/Makefile).
+//*****************************************************************************
+
+#ifndef __EW_SYSTICK_H
+#define __EW_SYSTICK_H
+
+void Start_SysTick1ms(void);                     // TCPClockHandler() each ms, status LED
+unsigned short Get_ISNClock(void);               // fast running count, low word of the ISNs
+void Start_CycleCounter(void);                   // counter of the EASYWEB_BENCHMARK figures
+unsigned long Get_CycleCounter(void);            // (CPU cycles, ns on the host)
+
+#endif
@@ -21,13 +21,32 @@
 
 //CodeRed - added header for LPC ethernet controller
 #include "ethmac.h" 
+#include "checksum.h"
 // CodeRed - added library string handling header
 #include <string.h>
 
-// CodeRed - added NXP LPC register definitions header
-#include "LPC17xx.h"
+// the board (LPC17xx.h) is reached through the timebase and the driver only
+#include "ew_systick.h"
 
-void  Start_SysTick10ms(void);
+#if TCP_TX_FRAMES_OFS > ETH_RAM_SIZE
+#error "TxFrame1 buffers don't fit into the AHB SRAM, reduce TCP_MAX_CONNECTIONS or TCP_TX_SEGMENTS"
+#endif
+
+#if (ETH_HEADER_SIZE + MAX_ETH_TX_DATA_SIZE) > TX_BUF_SIZE
+#error "TxFrame2 doesn't fit into an EMAC TX buffer, increase TX_BUF_SIZE"
+#endif
+
+#if (TCP_MAX_TX_FRAGS + 1) >= NUM_TX_FRAG
+#error "a segment's fragments must fit into the TX ring, increase NUM_TX_FRAG"
+#endif
+
+#if TCP_MAX_CONNECTIONS > 8
+#error "TARPEntry.Waiting has a bit per connection, reduce TCP_MAX_CONNECTIONS"
+#endif
+
+#if (ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE + TCP_MSS_MAX) > ETH_FRAG_SIZE
+#error "received segments must fit into an EMAC RX buffer, reduce TCP_MSS_MAX"
+#endif
 
 // Code Red - moved myMAC definition in from original cs8900.h
 const unsigned char MyMAC[6] =   // "M1-M2-M3-M4-M5-M6"
@@ -41,6 +60,9 @@ const unsigned char MyMAC[6] =   // "M1-M2-M3-M4-M5-M6"
 
 void TCPLowLevelInit(void)
 {
+  unsigned char i, j;
+  TTCPSegment *Seg;
+
 // CodeRed - comment out original 8900 specific code
 /*	
   BCSCTL1 &= ~DIVA0;                             // ACLK = XT1 / 4 = 2 MHz
@@ -51,22 +73,58 @@ void TCPLowLevelInit(void)
   
   Init8900();
 */
-#ifdef __LPCXPRESSO__
-	// LPCXpresso 176x board
-	LPC_GPIO0->FIODIR = 1 << 22;               // P0.22 defined as Output (LED)
-#else
-	//RDB1768 board
-	LPC_GPIO1->FIODIR = 1 << 25;               // P1.25 defined as Output (LED)
-#endif
+  Start_SysTick1ms();	// Start SysTick timer running (1ms ticks, TCPTime), status LED
 
-  Start_SysTick10ms();	// Start SysTick timer running (10ms ticks)
+#ifdef EASYWEB_BENCHMARK
+  Start_CycleCounter();                          // count CPU cycles
+  memset(&NetStats, 0, sizeof(NetStats));
+#endif
   
   Init_EthMAC();
 	
   TransmitControl = 0;
-  TCPFlags = 0;
-  TCPStateMachine = CLOSED;
-  SocketStatus = 0;
+  memset(TCBHash, TCP_HASH_NONE, sizeof(TCBHash));   // all demux buckets empty
+  memset(ARPCache, 0, sizeof(ARPCache));             // all ARP entries free
+  memset(UDPSockets, 0, sizeof(UDPSockets));         // no UDP port bound
+
+  for (i = 0; i <= TCP_MAX_CONNECTIONS; i++)     // incl. the scratch TCB
+  {
+    TCPSelect(i);
+    TCPFlags = 0;
+    TCPStateMachine = CLOSED;
+    SocketStatus = 0;
+    TCB[i].HashBucket = TCP_HASH_NONE;
+    TCB[i].TxFragments = 0;
+    TCB[i].RxBuffer = 0;                         // set when data arrives
+    TCB[i].SendMSS = TCP_MSS_DEFAULT;
+    TCPClearSegments();
+    TCPInitRTO();
+
+    for (j = 0; j < TCP_TX_SEGMENTS; j++)
+    {
+      Seg = &TCB[i].Segment[j];
+      if (i < TCP_MAX_CONNECTIONS)               // scratch TCB never carries data
+        Seg->Buffer = (unsigned char *)(USER_TX_BASE + (i * TCP_TX_SEGMENTS + j) * TCP_TX_FRAME_SIZE);
+      else
+        Seg->Buffer = 0;
+      Seg->Fragment[0].Data = Seg->Buffer;       // headers for scatter-gather
+      Seg->Fragment[0].Size = ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE;
+    }
+  }
+
+  RxFrameOwner = RX_FRAME_FREE;                  // no rec'd data in use
+  RxCopyOwner = RX_FRAME_FREE;
+
+  TCPSelect(0);
+}
+
+// easyWEB-API function
+// selects the connection the other API functions and variables
+// ('SocketStatus', 'TCP_TX_BUF'...) work on
+
+void TCPSelect(unsigned char Connection)
+{
+  TCPCurrent = Connection;
 }
 
 // easyWEB-API function
@@ -78,6 +136,8 @@ void TCPPassiveOpen(void)
   if (TCPStateMachine == CLOSED)
   {
     TCPFlags &= ~TCP_ACTIVE_OPEN;                // let's do a passive open!
+    TCPClearSegments();                          // nothing left of the last connection
+    TCPInitRTO();                                // the next client may be far away
     TCPStateMachine = LISTENING;
     SocketStatus = SOCK_ACTIVE;                  // reset, socket now active
   }
@@ -93,10 +153,13 @@ void TCPActiveOpen(void)
   {
     TCPFlags |= TCP_ACTIVE_OPEN;                 // let's do an active open!
     TCPFlags &= ~IP_ADDR_RESOLVED;               // we haven't opponents MAC yet
+    TCPClearSegments();                          // nothing left of the last connection
+    TCPInitRTO();
   
-    PrepareARP_REQUEST();                        // ask for MAC by sending a broadcast
+    TCPHashInsert();                             // opponent is known, make us findable
     LastFrameSent = ARP_REQUEST;
     TCPStartRetryTimer();
+    TCPResolve();                                // take MAC from the cache or ask for it
     SocketStatus = SOCK_ACTIVE;                  // reset, socket now active    
   }
 }
@@ -125,10 +188,73 @@ void TCPClose(void)
   }
 }
 
+// easyWEB-API function
+// checks if DoNetworkStuff() has something to do. if it hasn't, the user
+// may sleep until the next interrupt (EMAC or timer), e.g.
+//   __disable_irq(); if (!TCPWorkPending()) __WFI(); __enable_irq();
+
+unsigned char TCPWorkPending(void)
+{
+  unsigned char i;
+
+  if (EventPending_EthMAC()) return 1;           // EMAC interrupt(s)
+
+  if (RxFrameOwner == RX_FRAME_FREE)
+  {
+    if (CheckIfFrameReceived()) return 1;        // frames left from the last call
+  }
+  else if (!(TCB[RxFrameOwner].Status & SOCK_DATA_AVAILABLE))
+    return 1;                                    // user released the rx-buffer
+  else if ((RxFrameCount_EthMAC() > 1) && TCPRxCopyFree())
+    return 1;                                    // frames wait, the held data can be copied
+
+  if (RxOverrun_EthMAC() && (RxFrameOwner == RX_FRAME_FREE))
+    return 1;                                    // RX path to reset
+
+  if (TransmitControl & SEND_FRAME2) return 1;
+
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+  {
+    if (TCB[i].Flags & TCP_SEND_FRAME1) return 1;  // segment waits for the EMAC
+    if ((TCB[i].Flags & TCP_TIMER_RUNNING) && TCPTimerExpired(i)) return 1;
+
+    switch (TCB[i].StateMachine)                 // see the state changes in DoNetworkStuff()
+    {
+      case CLOSED :
+      case LISTENING :
+      {
+        if ((TCB[i].Flags & (TCP_ACTIVE_OPEN | IP_ADDR_RESOLVED)) == (TCP_ACTIVE_OPEN | IP_ADDR_RESOLVED))
+          return 1;                              // SYN to send
+        break;
+      }
+      case SYN_RECD :
+      case ESTABLISHED :
+      {
+        if ((TCB[i].Flags & TCP_CLOSE_REQUESTED) && (TCB[i].SeqNr == TCB[i].UNASeqNr))
+          return 1;                              // FIN to send
+        break;
+      }
+      case CLOSE_WAIT :
+      {
+        if (TCB[i].SeqNr == TCB[i].UNASeqNr)
+          return 1;
+        break;
+      }
+      default : break;
+    }
+  }
+
+  return 0;
+}
+
 // easyWEB-API function
 // releases the receive-buffer and allows easyWEB to store new data
 // NOTE: rx-buffer MUST be released periodically, else the other TCP
 //       get no ACKs for the data it sent
+//       * the data is read in place in the EMAC's RX buffer. if more
+//         frames come in meanwhile, it's moved to 'RxCopyBuffer', see
+//         TCPCopyRxData(). a second connection holding data stalls RX
+//         until one of them is released, so release it soon
 
 void TCPReleaseRxBuffer(void)
 {
@@ -136,24 +262,196 @@ void TCPReleaseRxBuffer(void)
 }
 
 // easyWEB-API function
-// transmitts data stored in 'TCP_TX_BUF'
+// transmitts data stored in 'TCP_TX_BUF' (or the pieces added by
+// TCPTxFragment())
 // NOTE: * number of bytes to transmit must have been written to 'TCPTxDataCount'
-//       * data-count MUST NOT exceed 'MAX_TCP_TX_DATA_SIZE'
+//       * data-count MUST NOT exceed 'MAX_TCP_TX_DATA_SIZE' (size of 'TCP_TX_BUF')
+//         nor 'TCPTxMSS'
+//       * up to TCP_TX_SEGMENTS segments may be sent before the first one is
+//         ACKed. 'SOCK_TX_BUF_RELEASED' stays set until the window is full,
+//         each segment has its own 'TCP_TX_BUF'
 
 void TCPTransmitTxBuffer(void)
 {
+  if (TCB[TCPCurrent].TxFragments)
+    TCPTransmitTxBufferSum(TCPFragmentsSum());
+  else
+    TCPTransmitTxBufferSum(ChecksumPartial(TCP_TX_BUF, TCPTxDataCount, 0));
+}
+
+// easyWEB-API function
+// adds 'Size' bytes at 'Data' to the next segment instead of copying
+// them to 'TCP_TX_BUF'. the EMAC gathers the frame from TxFrame1's
+// headers and these pieces (scatter-gather), so the data is sent from
+// where it is. 'TCPTxDataCount' is set to the sum of the pieces.
+// returns 0 if the piece doesn't fit into the segment ('TCPTxMSS').
+// NOTE: * the data MUST be in AHB SRAM and stay unchanged until the
+//         segment has been ACKed (the connection is closed or all
+//         segments sent later are ACKed)
+//       * call it when the tx-buffer was released, then TCPTransmitTxBuffer()
+//         or TCPTransmitTxBufferSum()
+
+unsigned char TCPTxFragment(const void *Data, unsigned short Size)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  TTCPSegment *Seg = TCPNextSegment;
+
+  if (!Conn->TxFragments)
+    TCPTxDataCount = 0;                          // first piece of a new segment
+
+  if (Conn->TxFragments == TCP_MAX_TX_FRAGS) return 0;
+  if (TCPTxDataCount + Size > Conn->SendMSS) return 0;
+
+  Conn->TxFragments++;
+  Seg->Fragment[Conn->TxFragments].Data = Data;
+  Seg->Fragment[Conn->TxFragments].Size = Size;
+  TCPTxDataCount += Size;
+  return 1;
+}
+
+// easyWEB-API function
+// hands the datagrams sent to 'LocalPort' to 'Handler' (from
+// DoNetworkStuff()). returns 0 if all UDP sockets are in use.
+
+unsigned char UDPBind(unsigned short LocalPort, TUDPHandler Handler)
+{
+  unsigned char i;
+
+  UDPUnbind(LocalPort);                          // (a new handler replaces the old one)
+
+  for (i = 0; i < UDP_MAX_SOCKETS; i++)
+    if (!UDPSockets[i].Handler)
+    {
+      UDPSockets[i].LocalPort = LocalPort;
+      UDPSockets[i].Handler = Handler;
+      return 1;
+    }
+
+  return 0;
+}
+
+// easyWEB-API function
+// stops receiving datagrams sent to 'LocalPort'
+
+void UDPUnbind(unsigned short LocalPort)
+{
+  unsigned char i;
+
+  for (i = 0; i < UDP_MAX_SOCKETS; i++)
+    if (UDPSockets[i].Handler && (UDPSockets[i].LocalPort == LocalPort))
+      UDPSockets[i].Handler = 0;
+}
+
+// easyWEB-API function
+// sends 'Count' bytes at 'Data' as a datagram from 'LocalPort' to
+// 'IP:RemotePort'. only the headers are built (in the EMAC's next TX
+// buffer), the EMAC gathers the data from where it is.
+// returns 0 if the datagram couldn't be sent, it's dropped then (UDP):
+// * the MAC of the next hop isn't known yet (it's asked for, at most
+//   each ARP_REQUEST_INTERVAL)
+// * no EMAC descriptors free
+// NOTE: * the data MUST be in AHB SRAM and stay unchanged until the EMAC
+//         has sent it (e.g. use two buffers by turns)
+//       * 'Count' MUST NOT exceed UDP_MAX_DATA_SIZE
+
+unsigned char UDPSend(const unsigned short *IP, unsigned short RemotePort, unsigned short LocalPort,
+                      const void *Data, unsigned short Count)
+{
+  const unsigned short *NextHop = IPNextHop(IP);
+  unsigned short MAC[3];
+  unsigned char *Frame;
+  TARPEntry *Entry;
+  TTxFragment Fragment[2];
+  unsigned long Sum;
+  unsigned short Check;
+
+  if (Count > UDP_MAX_DATA_SIZE) return 0;
+  if (TransmitControl & SEND_FRAME2) return 0;   // TxFrame2 waits in the next EMAC buffer
+
+  if (!ARPLookup(NextHop, MAC))
+  {
+    Entry = &ARPCache[ARPHash(NextHop)];
+    if ((Entry->State != ARP_PENDING) || (Entry->IP[0] != NextHop[0]) || (Entry->IP[1] != NextHop[1]) ||
+        (TCPTime - Entry->Time >= ARP_REQUEST_INTERVAL))
+    {
+      ARPPending(NextHop)->Time = TCPTime;       // ask (again)
+      PrepareARP_REQUEST(NextHop);               // (sent by DoNetworkStuff())
+    }
+    return 0;
+  }
+
+  if (!Rdy4TxFragments(2)) return 0;             // EMAC descriptors free?
+  Frame = GetTxBuffer_EthMAC();                  // headers go to the next TX buffer
+
+  // Ethernet
+  memcpy(&Frame[ETH_DA_OFS], MAC, 6);
+  memcpy(&Frame[ETH_SA_OFS], &MyMAC, 6);
+  *(unsigned short *)&Frame[ETH_TYPE_OFS] = SWAPB(FRAME_IP);
+
+  // IP
+  *(unsigned short *)&Frame[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL | IP_TOS_T);
+  WriteWBE(&Frame[IP_TOTAL_LENGTH_OFS], IP_HEADER_SIZE + UDP_HEADER_SIZE + Count);
+  *(unsigned short *)&Frame[IP_IDENT_OFS] = 0;
+  *(unsigned short *)&Frame[IP_FLAGS_FRAG_OFS] = 0;
+  *(unsigned short *)&Frame[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_UDP);
+  *(unsigned short *)&Frame[IP_HEAD_CHKSUM_OFS] = 0;
+  memcpy(&Frame[IP_SOURCE_OFS], &MyIP, 4);
+  memcpy(&Frame[IP_DESTINATION_OFS], IP, 4);
+  *(unsigned short *)&Frame[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&Frame[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
+
+  // UDP
+  WriteWBE(&Frame[UDP_SRCPORT_OFS], LocalPort);
+  WriteWBE(&Frame[UDP_DESTPORT_OFS], RemotePort);
+  WriteWBE(&Frame[UDP_LENGTH_OFS], UDP_HEADER_SIZE + Count);
+  *(unsigned short *)&Frame[UDP_CHKSUM_OFS] = 0;
+
+  Sum = ChecksumPartial(Data, Count, 0);         // data starts at an even offset
+  Sum = ChecksumPartial(&Frame[UDP_SRCPORT_OFS], UDP_HEADER_SIZE, Sum);
+  Check = IPPseudoChecksum(Sum, IP, PROT_UDP, UDP_HEADER_SIZE + Count);
+  *(unsigned short *)&Frame[UDP_CHKSUM_OFS] = Check ? Check : 0xFFFF;   // 0: no checksum
+
+  if (!Count)
+  {
+    SendFrame_EthMAC(Frame, ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE);
+    return 1;
+  }
+
+  Fragment[0].Data = Frame;                      // headers + data
+  Fragment[0].Size = ETH_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE;
+  Fragment[1].Data = Data;
+  Fragment[1].Size = Count;
+  SendFragments_EthMAC(Fragment, 2);
+  return 1;
+}
+
+// easyWEB-API function
+// same as TCPTransmitTxBuffer(), for callers which already know the
+// checksum partial sum of the data in 'TCP_TX_BUF' (see checksum.h)
+
+void TCPTransmitTxBufferSum(unsigned long DataSum)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  TTCPSegment *Seg = TCPNextSegment;
+
   if ((TCPStateMachine == ESTABLISHED) || (TCPStateMachine == CLOSE_WAIT))
     if (SocketStatus & SOCK_TX_BUF_RELEASED)
     {
-      SocketStatus &= ~SOCK_TX_BUF_RELEASED;               // occupy tx-buffer
+      Seg->SeqNr = TCPUNASeqNr;                            // queue it behind the segments
+      Seg->DataCount = TCPTxDataCount;                     // in flight
+      Seg->DataSum = DataSum;                              // keep for (re)transmissions
+      Seg->Fragments = Conn->TxFragments;
+      Seg->Built = 0;                                      // new data, new headers
       TCPUNASeqNr += TCPTxDataCount;                       // advance UNA
-      
-      TxFrame1Size = ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE + TCPTxDataCount;
-      TransmitControl |= SEND_FRAME1;
-      
-      LastFrameSent = TCP_DATA_FRAME;
-      TCPStartRetryTimer();
+
+      Conn->SegCount++;
+      if (Conn->SegCount == TCP_TX_SEGMENTS)               // window full, wait for an ACK
+        SocketStatus &= ~SOCK_TX_BUF_RELEASED;
+
+      TCPFlags |= TCP_SEND_FRAME1;                         // TCPSendFrames() starts the
+      LastFrameSent = TCP_DATA_FRAME;                      // retry timer
     }
+
+  Conn->TxFragments = 0;                         // next segment starts from scratch
 }
 
 // CodeRed - New function to check if received frame
@@ -163,18 +461,16 @@ void TCPTransmitTxBuffer(void)
 // destination address is a broadcast message or not
 unsigned int BroadcastMessage(void)
 {
-  unsigned short FrameDestination[3]; // to hold 48 bit MAC address
-
   RecdFrameLength = StartReadingFrame();
+  RecdFrame = GetRxFrame_EthMAC();               // parse it where the EMAC put it
 
-  // Read destination address
-  CopyFromFrame_EthMAC(&FrameDestination,  6);
-  // Save it for reply
-  CopyFromFrame_EthMAC(&RecdFrameMAC, 6);          
+  // Save source address for reply
+  RecdFrameMAC = (unsigned short *)&RecdFrame[ETH_SA_OFS];
 
-  if ((FrameDestination[0] == 0xFFFF) && 
-      (FrameDestination[1] == 0xFFFF) && 
-      (FrameDestination[2] == 0xFFFF)) { 
+  // Check destination address
+  if ((*(unsigned short *)&RecdFrame[ETH_DA_OFS] == 0xFFFF) &&
+      (*(unsigned short *)&RecdFrame[ETH_DA_OFS + 2] == 0xFFFF) &&
+      (*(unsigned short *)&RecdFrame[ETH_DA_OFS + 4] == 0xFFFF)) {
     return(1); // Broadcast message
   } else {
     return (0);
@@ -188,6 +484,12 @@ unsigned int BroadcastMessage(void)
 
 void DoNetworkStuff(void)
 {
+  unsigned char UserConnection = TCPCurrent;     // don't disturb the user's selection
+  unsigned char i;
+
+  while (GetEvent_EthMAC() != ETH_EVENT_NONE);   // the queue just wakes us up, the
+                                                 // rings below tell what's to do
+
 // CodeRed - comment out original cs8900 code
 /*
 	unsigned int ActRxEvent;                       // copy of cs8900's RxEvent-Register
@@ -202,9 +504,34 @@ void DoNetworkStuff(void)
   }
 */
 	
-  // Check to see if packet received
-  if (CheckIfFrameReceived())                     
+  if (RxFrameOwner != RX_FRAME_FREE)             // user reads TCP data in place?
+    if (!(TCB[RxFrameOwner].Status & SOCK_DATA_AVAILABLE))
+    {                                            // done (or connection closed), now
+      StopReadingFrame();                        // release ethernet controller buffer
+      RxFrameOwner = RX_FRAME_FREE;
+    }
+
+  if (RxOverrun_EthMAC())                        // the EMAC stopped receiving (ETH_EVENT_ERROR)
+  {
+    if (RxFrameOwner != RX_FRAME_FREE)           // data read in place has to leave
+      TCPCopyRxData();                           // the ring first
+    if (RxFrameOwner == RX_FRAME_FREE)           // else wait until the user releases it
+      ResetRx_EthMAC();                          // drops the frames in the ring
+  }
+
+  // Check to see if packets received (frames wait in the EMAC
+  // while the user still reads the last one's data, unless it can
+  // be copied out). at most one ring's worth per call, so that
+  // timers and user aren't starved
+  for (i = 0; i < NUM_RX_FRAG; i++)
   {
+    if (!CheckIfFrameReceived()) break;
+    if (RxFrameOwner != RX_FRAME_FREE)
+      if (!TCPCopyRxData()) break;               // copy busy too, wait for the user
+
+    TCPSelect(TCP_RESET_TCB);                    // no connection until TCP demuxes one
+    BENCH_START();
+
 	// Was it a broadcast message?  
     if (BroadcastMessage()) {
       ProcessEthBroadcastFrame();
@@ -212,121 +539,371 @@ void DoNetworkStuff(void)
     else {
       ProcessEthIAFrame(); 
     }
-    // now release ethernet controller buffer
-    StopReadingFrame();                             
+    // now release ethernet controller buffer, unless TCP_RX_BUF
+    // points into it
+    if (RxFrameOwner == RX_FRAME_FREE)
+      StopReadingFrame();
+    TCPSendFrames();                             // answer before looking at the timers
+
+    BENCH_STOP(RxCycles);
+    BENCH_COUNT(RxFrames);
   }
   
   
 // CodeRed - now back to original code
   
-  if (TCPFlags & TCP_TIMER_RUNNING)
-    if (TCPFlags & TIMER_TYPE_RETRY)
-    {
-      if (TCPTimer > RETRY_TIMEOUT)
-      {
-        TCPRestartTimer();                       // set a new timeout
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)      // timers and state changes of
+  {                                              // every connection
+    TCPSelect(i);
 
-        if (RetryCounter)
+    if (TCPFlags & TCP_TIMER_RUNNING)
+      if (TCPTimerExpired(i))
+      {
+        if (TCPFlags & TIMER_TYPE_RETRY)
         {
-          TCPHandleRetransmission();             // resend last frame
-          RetryCounter--;
+          if (TCB[i].RTO < TCP_RTO_MAX / 2)        // back off, the network may be
+            TCB[i].RTO *= 2;                       // congested (RFC 6298)
+          else
+            TCB[i].RTO = TCP_RTO_MAX;
+          TCPRestartTimer();                       // set a new timeout
+
+          if (RetryCounter)
+          {
+            TCPHandleRetransmission();             // resend last frame
+            RetryCounter--;
+            BENCH_COUNT(Retransmissions);
+          }
+          else
+          {
+            TCPStopTimer();
+            TCPHandleTimeout();
+            BENCH_COUNT(Timeouts);
+          }
         }
         else
         {
-          TCPStopTimer();
-          TCPHandleTimeout();
+          TCPStateMachine = CLOSED;
+          TCPFlags = 0;                            // reset all flags, stop retransmission...
+          SocketStatus &= SOCK_DATA_AVAILABLE;     // clear all flags but data available
         }
       }
-    }
-    else if (TCPTimer > FIN_TIMEOUT)
-    {
-      TCPStateMachine = CLOSED;
-      TCPFlags = 0;                              // reset all flags, stop retransmission...
-      SocketStatus &= SOCK_DATA_AVAILABLE;       // clear all flags but data available
-    }
 
-  switch (TCPStateMachine)
-  {
-    case CLOSED :
-    case LISTENING :
+    switch (TCPStateMachine)
     {
-      if (TCPFlags & TCP_ACTIVE_OPEN)            // stack has to open a connection?
-        if (TCPFlags & IP_ADDR_RESOLVED)         // IP resolved?
-          if (!(TransmitControl & SEND_FRAME2))  // buffer free?
-          {
+      case CLOSED :
+      case LISTENING :
+      {
+        if (TCPFlags & TCP_ACTIVE_OPEN)            // stack has to open a connection?
+          if (TCPFlags & IP_ADDR_RESOLVED)         // IP resolved?
+            if (!(TransmitControl & SEND_FRAME2))  // buffer free?
+            {
 // CodeRed - change TAR -> TOTC to use LPC1768 clock
 //            TCPSeqNr = ((unsigned long)ISNGenHigh << 16) | TAR; // set local ISN
-   	        TCPSeqNr = ((unsigned long)ISNGenHigh << 16) | (LPC_TIM0->TC & 0xFFFF); // set local ISN
-            TCPUNASeqNr = TCPSeqNr;
-            TCPAckNr = 0;                                       // we don't know what to ACK!
-            TCPUNASeqNr++;                                      // count SYN as a byte
-            PrepareTCP_FRAME(TCP_CODE_SYN);                     // send SYN frame
-            LastFrameSent = TCP_SYN_FRAME;
-            TCPStartRetryTimer();                               // we NEED a retry-timeout
-            TCPStateMachine = SYN_SENT;
-          }
-      break;
-    }
-    case SYN_RECD :
-    case ESTABLISHED :
-    {
-      if (TCPFlags & TCP_CLOSE_REQUESTED)                  // user has user initated a close?
-        if (!(TransmitControl & (SEND_FRAME2 | SEND_FRAME1)))   // buffers free?
-          if (TCPSeqNr == TCPUNASeqNr)                          // all data ACKed?
+     	        TCPSeqNr = ((uint32_t)ISNGenHigh << 16) | Get_ISNClock(); // set local ISN
+              TCPUNASeqNr = TCPSeqNr;
+              TCPAckNr = 0;                                       // we don't know what to ACK!
+              TCPUNASeqNr++;                                      // count SYN as a byte
+              PrepareTCP_FRAME(TCP_CODE_SYN);                     // send SYN frame
+              LastFrameSent = TCP_SYN_FRAME;
+              TCPStartRetryTimer();                               // we NEED a retry-timeout
+              TCPStartRTT(TCPUNASeqNr);                           // 1st round trip time
+              TCPStateMachine = SYN_SENT;
+            }
+        break;
+      }
+      case SYN_RECD :
+      case ESTABLISHED :
+      {
+        if (TCPFlags & TCP_CLOSE_REQUESTED)                  // user has user initated a close?
+          if (!(TransmitControl & SEND_FRAME2) && !(TCPFlags & TCP_SEND_FRAME1))   // buffers free?
+            if (TCPSeqNr == TCPUNASeqNr)                          // all data ACKed?
+            {
+              TCPUNASeqNr++;
+              PrepareTCP_FRAME(TCP_CODE_FIN | TCP_CODE_ACK);
+              LastFrameSent = TCP_FIN_FRAME;
+              TCPStartRetryTimer();
+              TCPStateMachine = FIN_WAIT_1;
+            }
+        break;
+      }
+      case CLOSE_WAIT :
+      {
+        if (!(TransmitControl & SEND_FRAME2) && !(TCPFlags & TCP_SEND_FRAME1))     // buffers free?
+          if (TCPSeqNr == TCPUNASeqNr)                            // all data ACKed?
           {
-            TCPUNASeqNr++;
-            PrepareTCP_FRAME(TCP_CODE_FIN | TCP_CODE_ACK);
-            LastFrameSent = TCP_FIN_FRAME;
+            TCPUNASeqNr++;                                        // count FIN as a byte
+            PrepareTCP_FRAME(TCP_CODE_FIN | TCP_CODE_ACK);        // we NEED a retry-timeout
+            LastFrameSent = TCP_FIN_FRAME;                        // time to say goodbye...
             TCPStartRetryTimer();
-            TCPStateMachine = FIN_WAIT_1;
+            TCPStateMachine = LAST_ACK;
           }
-      break;
+        break;
+      }
     }
-    case CLOSE_WAIT :
+
+    TCPSendFrames();
+  }
+
+  TCPSelect(UserConnection);
+}
+
+// easyWEB internal function
+// hands the frames the current connection has prepared to the EMAC
+
+void TCPSendFrames(void)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  TTCPSegment *Seg;
+
+  if (TransmitControl & SEND_FRAME2)           // (its EMAC buffer was reserved
+  {                                              // by TCPAllocFrame2())
+    SendFrame2();
+    TransmitControl &= ~SEND_FRAME2;             // clear tx-flag
+  }
+
+  while (TCPFlags & TCP_SEND_FRAME1)             // segments of the window not sent yet
+  {
+    Seg = &Conn->Segment[(Conn->SegHead + Conn->SegSent) % TCP_TX_SEGMENTS];
+
+    if (Conn->SegSent == Conn->SegCount)         // all sent
     {
-      if (!(TransmitControl & (SEND_FRAME2 | SEND_FRAME1)))     // buffers free?
-        if (TCPSeqNr == TCPUNASeqNr)                            // all data ACKed?
-        {
-          TCPUNASeqNr++;                                        // count FIN as a byte
-          PrepareTCP_FRAME(TCP_CODE_FIN | TCP_CODE_ACK);        // we NEED a retry-timeout
-          LastFrameSent = TCP_FIN_FRAME;                        // time to say goodbye...
-          TCPStartRetryTimer();
-          TCPStateMachine = LAST_ACK;
-        }
+      TCPFlags &= ~TCP_SEND_FRAME1;              // clear tx-flag
       break;
     }
+
+    if (Conn->SegSent)                           // (the oldest one is always sent)
+      if (Seg->SeqNr + Seg->DataCount - TCPSeqNr > Conn->SendWindow)
+      {
+        TCPFlags &= ~TCP_SEND_FRAME1;            // other TCP can't take more, its
+        break;                                   // next ACK opens the window again
+      }
+
+    if (!Rdy4TxFragments(1 + Seg->Fragments))    // EMAC descriptors free?
+      break;                                     // else try again next time
+
+    if (!Seg->Built && !(TCPFlags & TCP_RTT_RUNNING))
+      TCPStartRTT(Seg->SeqNr + Seg->DataCount);  // time a 1st transmission (Karn)
+
+    PrepareTCP_DATA_FRAME(Seg);                  // build frame w/ actual ACK....
+    SendFrame1(Seg);
+    Conn->SegSent++;
+
+    if (!(TCPFlags & TCP_TIMER_RUNNING))         // times the oldest unACKed segment
+      TCPStartRetryTimer();
   }
+}
+
+// easyWEB internal function
+// looks for the MAC of the current connection's next hop in the ARP
+// cache. if it isn't there, the connection waits in the cache entry and
+// a request is broadcast (again, on a retransmission)
 
-  if (TransmitControl & SEND_FRAME2)
+void TCPResolve(void)
+{
+  if (ARPLookup(TCPNextHop(), RemoteMAC))
+  {
+    TCPStopTimer();                              // OK, now we've the MAC we wanted ;-)
+    TCPFlags |= IP_ADDR_RESOLVED;                // (DoNetworkStuff() sends the SYN)
+  }
+  else
   {
-    RequestSend(TxFrame2Size);
+    ARPPending(TCPNextHop())->Waiting |= 1 << TCPCurrent;
+    PrepareARP_REQUEST(TCPNextHop());            // ask for MAC by sending a broadcast
+  }
+}
 
-    if (Rdy4Tx())                                // NOTE: when using a very fast MCU, maybe
-      SendFrame2();                              // the CS8900 isn't ready yet, include
-    else {                                       // a kind of timer or counter here
-      TCPStateMachine = CLOSED;
-      SocketStatus = SOCK_ERR_ETHERNET;          // indicate an error to user
-      TCPFlags = 0;                              // clear all flags, stop timers etc.
-    }
+// easyWEB internal function
+// returns the ARP cache entry an IP is kept in. the hosts of a subnet
+// differ in the last byte, it's taken
 
-    TransmitControl &= ~SEND_FRAME2;             // clear tx-flag
+unsigned char ARPHash(const unsigned short *IP)
+{
+  return (IP[1] >> 8) & (ARP_CACHE_SIZE - 1);    // (IP is stored big-endian)
+}
+
+// easyWEB internal function
+// copies the MAC of 'IP' from the ARP cache to 'MAC'. returns 0 if
+// it isn't known (or too old, then the entry is freed)
+
+unsigned char ARPLookup(const unsigned short *IP, unsigned short *MAC)
+{
+  TARPEntry *Entry = &ARPCache[ARPHash(IP)];
+
+  if (Entry->State != ARP_RESOLVED) return 0;
+  if ((Entry->IP[0] != IP[0]) || (Entry->IP[1] != IP[1])) return 0;
+
+  if (TCPTime - Entry->Time > ARP_CACHE_TIMEOUT) // host may have changed its MAC
+  {
+    Entry->State = ARP_FREE;
+    return 0;
   }
 
-  if (TransmitControl & SEND_FRAME1)
+  memcpy(MAC, Entry->MAC, 6);
+  return 1;
+}
+
+// easyWEB internal function
+// returns the entry of 'IP', waiting for its MAC. the entry is taken
+// over if it's used by another host ('Time' is when it was taken over)
+
+TARPEntry *ARPPending(const unsigned short *IP)
+{
+  TARPEntry *Entry = &ARPCache[ARPHash(IP)];
+
+  if ((Entry->State != ARP_PENDING) || (Entry->IP[0] != IP[0]) || (Entry->IP[1] != IP[1]))
   {
-    PrepareTCP_DATA_FRAME();                     // build frame w/ actual SEQ, ACK....
-    RequestSend(TxFrame1Size);
-  
-    if (Rdy4Tx())                                // CS8900 ready to accept our frame?
-      SendFrame1();                              // (see note above)
-    else {
-      TCPStateMachine = CLOSED;
-      SocketStatus = SOCK_ERR_ETHERNET;          // indicate an error to user
-      TCPFlags = 0;                              // clear all flags, stop timers etc.
+    Entry->IP[0] = IP[0];
+    Entry->IP[1] = IP[1];
+    Entry->Time = TCPTime;
+    Entry->State = ARP_PENDING;
+    Entry->Waiting = 0;                          // (their retransmissions queue them again)
+  }
+  return Entry;
+}
+
+// easyWEB internal function
+// notes 'MAC' as the MAC of 'IP' if the host is in the ARP cache or
+// 'Add' is set, and hands it to the connections waiting for it
+
+void ARPLearn(const unsigned short *IP, const unsigned char *MAC, unsigned char Add)
+{
+  TARPEntry *Entry = &ARPCache[ARPHash(IP)];
+  unsigned char UserConnection = TCPCurrent;
+  unsigned char Waiting = 0;
+  unsigned char i;
+
+  if ((Entry->State != ARP_FREE) && (Entry->IP[0] == IP[0]) && (Entry->IP[1] == IP[1]))
+  {
+    if (Entry->State == ARP_PENDING)
+      Waiting = Entry->Waiting;                  // the answer we've been waiting for
+  }
+  else if (!Add) return;
+
+  Entry->IP[0] = IP[0];
+  Entry->IP[1] = IP[1];
+  memcpy(Entry->MAC, MAC, 6);
+  Entry->Time = TCPTime;
+  Entry->State = ARP_RESOLVED;
+  Entry->Waiting = 0;
+
+  for (i = 0; Waiting; i++, Waiting >>= 1)       // connections waiting for this host
+    if (Waiting & 1)
+    {
+      TCPSelect(i);
+      if ((TCPFlags & (TCP_ACTIVE_OPEN | IP_ADDR_RESOLVED)) == TCP_ACTIVE_OPEN)
+        if (!memcmp(TCPNextHop(), IP, 4))        // (still the same open?)
+        {
+          TCPStopTimer();                        // OK, now we've the MAC we wanted ;-)
+          memcpy(&RemoteMAC, MAC, 6);
+          TCPFlags |= IP_ADDR_RESOLVED;
+        }
     }
 
-    TransmitControl &= ~SEND_FRAME1;             // clear tx-flag
+  TCPSelect(UserConnection);
+}
+
+// easyWEB internal function
+// returns the checksum partial sum of the pieces added by TCPTxFragment()
+
+unsigned long TCPFragmentsSum(void)
+{
+  TTCPSegment *Seg = TCPNextSegment;
+  unsigned long Sum = 0;
+  unsigned short Part, Offset = 0;
+  unsigned char i;
+
+  for (i = 1; i <= TCB[TCPCurrent].TxFragments; i++)
+  {
+    Part = ChecksumFold(ChecksumPartial(Seg->Fragment[i].Data, Seg->Fragment[i].Size, 0));
+    if (Offset & 1)                              // piece starts at an odd offset
+      Part = ChecksumSwap(Part);
+    Sum += Part;
+    Offset += Seg->Fragment[i].Size;
+  }
+
+  return Sum;
+}
+
+// easyWEB internal function
+// empties the send window of the current connection
+
+void TCPClearSegments(void)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+
+  Conn->SegHead = 0;
+  Conn->SegCount = 0;
+  Conn->SegSent = 0;
+  Conn->SendWindow = 0;
+}
+
+// easyWEB internal function
+// frees the segments of the send window which are completely
+// ACKed by 'Ack' (cumulative ACK) and lets the window move on
+
+void TCPFreeSegments(uint32_t Ack)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  TTCPSegment *Seg;
+
+  while (Conn->SegCount)
+  {
+    Seg = &Conn->Segment[Conn->SegHead];
+    if ((int32_t)(Ack - (Seg->SeqNr + Seg->DataCount)) < 0) break;   // not all of it ACKed
+
+    Conn->SegHead = (Conn->SegHead + 1) % TCP_TX_SEGMENTS;
+    Conn->SegCount--;
+    if (Conn->SegSent) Conn->SegSent--;          // (0 after a retransmission timeout)
   }
+
+  if (Conn->SegSent < Conn->SegCount)            // send the rest if the window
+    TCPFlags |= TCP_SEND_FRAME1;                 // allows it now
+}
+
+// easyWEB internal function
+// returns the sequence number of the next byte sent, behind the
+// segments in flight (SND.NXT)
+
+uint32_t TCPSendNext(void)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  TTCPSegment *Seg;
+
+  if (!Conn->SegSent) return TCPSeqNr;
+
+  Seg = &Conn->Segment[(Conn->SegHead + Conn->SegSent - 1) % TCP_TX_SEGMENTS];
+  return Seg->SeqNr + Seg->DataCount;
+}
+
+// easyWEB internal function
+// returns the segment size the other TCP accepts, read from the MSS
+// option of the just rec'd SYN (RFC 879). it's kept even, so that the
+// segments of a page start at even offsets.
+
+unsigned short TCPParseMSS(unsigned char TCPHeaderSize)
+{
+  unsigned char *Option = &RecdFrame[TCP_DATA_OFS];
+  unsigned char *End = &RecdFrame[TCP_SRCPORT_OFS + TCPHeaderSize];
+  unsigned short MSS = TCP_MSS_DEFAULT;            // if there's no option
+
+  while (Option < End)
+  {
+    if (Option[0] == 0) break;                     // end of option list
+    if (Option[0] == 1)                            // no-operation
+    {
+      Option++;
+      continue;
+    }
+    if ((Option + 1 >= End) || (Option[1] < 2) || (Option + Option[1] > End))
+      break;                                       // bad option length
+    if ((Option[0] == (TCP_OPT_MSS >> 8)) && (Option[1] == TCP_OPT_MSS_SIZE))
+      MSS = ReadWBE(&Option[2]);
+    Option += Option[1];
+  }
+
+  if (MSS > TCP_MSS_MAX) MSS = TCP_MSS_MAX;        // our frames are no longer
+  if (MSS < TCP_MSS_MIN) MSS = TCP_MSS_MIN;        // don't crawl
+  return MSS & ~1;
 }
 
 // easyWEB internal function
@@ -334,10 +911,6 @@ void DoNetworkStuff(void)
 
 void ProcessEthBroadcastFrame(void)
 {
-// CodeRed - change from int to short
-//  unsigned int TargetIP[2];
-  unsigned short TargetIP[2];
-
 // CodeRed - remove CS8900 specific code block  
 /*
   // next two words MUST be read with High-Byte 1st (CS8900 AN181 Page 2)
@@ -349,19 +922,9 @@ void ProcessEthBroadcastFrame(void)
 // Code Red - end of CS8900 specific block
 */
   
-  if (ReadFrameBE_EthMAC() == FRAME_ARP)            // get frame type, check for ARP
-    if (ReadFrameBE_EthMAC() == HARDW_ETH10)        // Ethernet frame
-      if (ReadFrameBE_EthMAC() == FRAME_IP)         // check protocol
-        if (ReadFrameBE_EthMAC() == IP_HLEN_PLEN)   // check HLEN, PLEN
-          if (ReadFrameBE_EthMAC() == OP_ARP_REQUEST)
-          {
-            DummyReadFrame_EthMAC(6);               // ignore sender's hardware address
-            CopyFromFrame_EthMAC(&RecdFrameIP, 4);  // read sender's protocol address
-            DummyReadFrame_EthMAC(6);               // ignore target's hardware address
-            CopyFromFrame_EthMAC(&TargetIP, 4);     // read target's protocol address
-            if (!memcmp(&MyIP, &TargetIP, 4))    // is it for us?
-              PrepareARP_ANSWER();               // yes->create ARP_ANSWER frame
-          }
+  // the frame is parsed in place, each field is read once
+  if (ReadWBE(&RecdFrame[ETH_TYPE_OFS]) == FRAME_ARP)          // get frame type, check for ARP
+    ProcessARPFrame();
 }
 
 // easyWEB internal function
@@ -370,10 +933,6 @@ void ProcessEthBroadcastFrame(void)
 
 void ProcessEthIAFrame(void)
 {
-// CodeRed - change from int to short
-//unsigned int TargetIP[2];
-  unsigned short TargetIP[2];
-  unsigned char ProtocolType;
 // CodeRed - next few lines not needed for LPC1768 port
 /*  
   // next two words MUST be read with High-Byte 1st (CS8900 AN181 Page 2)
@@ -383,43 +942,30 @@ void ProcessEthIAFrame(void)
   DummyReadFrame_EthMAC(6);                         // ignore DA
   CopyFromFrame_EthMAC(&RecdFrameMAC, 6);           // store SA (for our answer)
 */
-  switch (ReadFrameBE_EthMAC())                     // get frame type
+  switch (ReadWBE(&RecdFrame[ETH_TYPE_OFS]))         // get frame type
   {
-    case FRAME_ARP :                             // check for ARP
-    {
-      if ((TCPFlags & (TCP_ACTIVE_OPEN | IP_ADDR_RESOLVED)) == TCP_ACTIVE_OPEN)
-        if (ReadFrameBE_EthMAC() == HARDW_ETH10)         // check for the right prot. etc.
-          if (ReadFrameBE_EthMAC() == FRAME_IP)
-            if (ReadFrameBE_EthMAC() == IP_HLEN_PLEN)
-              if (ReadFrameBE_EthMAC() == OP_ARP_ANSWER)
-              {
-                TCPStopTimer();                       // OK, now we've the MAC we wanted ;-)
-                CopyFromFrame_EthMAC(&RemoteMAC, 6);     // extract opponents MAC
-                TCPFlags |= IP_ADDR_RESOLVED;
-              }
+    case FRAME_ARP :                             // check for ARP (answers and
+    {                                            // unicast requests)
+      ProcessARPFrame();
       break;
     }
     case FRAME_IP :                                        // check for IP-type
     {
-      if ((ReadFrameBE_EthMAC() & 0xFF00 ) == IP_VER_IHL)     // IPv4, IHL=5 (20 Bytes Header)
+      if ((RecdFrame[IP_VER_IHL_TOS_OFS] << 8) == IP_VER_IHL)  // IPv4, IHL=5 (20 Bytes Header)
       {                                                    // ignore Type Of Service
-        RecdIPFrameLength = ReadFrameBE_EthMAC();             // get IP frame's length
-        ReadFrameBE_EthMAC();                                 // ignore identification
+        RecdIPFrameLength = ReadWBE(&RecdFrame[IP_TOTAL_LENGTH_OFS]); // get IP frame's length
+        if (RecdIPFrameLength > RecdFrameLength - ETH_HEADER_SIZE) break; // truncated frame
+        if (RecdIPFrameLength < IP_HEADER_SIZE) break;
 
-        if (!(ReadFrameBE_EthMAC() & (IP_FLAG_MOREFRAG | IP_FRAGOFS_MASK)))  // only unfragm. frames
+        if (!(ReadWBE(&RecdFrame[IP_FLAGS_FRAG_OFS]) & (IP_FLAG_MOREFRAG | IP_FRAGOFS_MASK)))  // only unfragm. frames
         {
-// CodeRed - add mask
-//        ProtocolType = ReadFrameBE_EthMAC() ;                // get protocol, ignore TTL        	
-          ProtocolType = ReadFrameBE_EthMAC() & 0xFF ;                // get protocol, ignore TTL
-          ReadFrameBE_EthMAC();                               // ignore checksum
-          CopyFromFrame_EthMAC(&RecdFrameIP, 4);              // get source IP
-          CopyFromFrame_EthMAC(&TargetIP, 4);                 // get destination IP
-
-          if (!memcmp(&MyIP, &TargetIP, 4))                // is it for us?
-            switch (ProtocolType) {
+          RecdFrameIP = (unsigned short *)&RecdFrame[IP_SOURCE_OFS]; // source IP
+
+          if (!memcmp(&MyIP, &RecdFrame[IP_DESTINATION_OFS], 4))    // is it for us?
+            switch (RecdFrame[IP_TTL_PROT_OFS + 1]) {              // get protocol, ignore TTL
               case PROT_ICMP : { ProcessICMPFrame(); break; }
               case PROT_TCP  : { ProcessTCPFrame(); break; }
-              case PROT_UDP  : break;                      // not implemented!
+              case PROT_UDP  : { ProcessUDPFrame(); break; }
             }
         }      
       }
@@ -428,20 +974,37 @@ void ProcessEthIAFrame(void)
   }
 }
 
+// easyWEB internal function
+// we've just rec'd an ARP-frame (broadcast or to us). the sender's MAC
+// is noted in the ARP cache (RFC 826: known hosts are updated, new
+// ones added if the frame is for us), requests for our IP are answered
+
+void ProcessARPFrame(void)
+{
+  unsigned char ForUs;
+
+  if (ReadWBE(&RecdFrame[ARP_HARDW_OFS]) != HARDW_ETH10) return;       // check for the right prot. etc.
+  if (ReadWBE(&RecdFrame[ARP_PROT_OFS]) != FRAME_IP) return;
+  if (ReadWBE(&RecdFrame[ARP_HLEN_PLEN_OFS]) != IP_HLEN_PLEN) return;
+
+  RecdFrameIP = (unsigned short *)&RecdFrame[ARP_SENDER_IP_OFS];      // sender's protocol address
+  ForUs = !memcmp(&MyIP, &RecdFrame[ARP_TARGET_IP_OFS], 4);           // is it for us?
+
+  ARPLearn(RecdFrameIP, &RecdFrame[ARP_SENDER_HA_OFS], ForUs);
+
+  if (ForUs && (ReadWBE(&RecdFrame[ARP_OPCODE_OFS]) == OP_ARP_REQUEST))
+    PrepareARP_ANSWER();                         // yes->create ARP_ANSWER frame
+}
+
 // easyWEB internal function
 // we've just rec'd an ICMP-frame (Internet Control Message Protocol)
 // check what to do and branch to the appropriate sub-function
 
 void ProcessICMPFrame(void)
 {
-// CodeRed - change from int to short
-//unsigned int ICMPTypeAndCode;	
-  unsigned short ICMPTypeAndCode;
+  if (RecdIPFrameLength < IP_HEADER_SIZE + ICMP_HEADER_SIZE) return;  // no room for a header
 
-  ICMPTypeAndCode = ReadFrameBE_EthMAC();           // get Message Type and Code
-  ReadFrameBE_EthMAC();                             // ignore ICMP checksum
-
-  switch (ICMPTypeAndCode >> 8) {                // check type
+  switch (RecdFrame[ICMP_TYPE_CODE_OFS]) {       // check type, ignore code and checksum
     case ICMP_ECHO :                             // is echo request?
     {
       PrepareICMP_ECHO_REPLY();                  // echo as much as we can...
@@ -467,33 +1030,39 @@ void ProcessTCPFrame(void)
 */
   unsigned short TCPSegSourcePort;                 // segment's source port
   unsigned short TCPSegDestPort;                   // segment's destination port
-  unsigned long TCPSegSeq;                       // segment's sequence number
-  unsigned long TCPSegAck;                       // segment's acknowledge number
+  uint32_t TCPSegSeq;                            // segment's sequence number
+  uint32_t TCPSegAck;                            // segment's acknowledge number
   unsigned short TCPCode;                          // TCP code and header length
   unsigned char TCPHeaderSize;                   // real TCP header length
   unsigned short NrOfDataBytes;                    // real number of data
   
   
-  TCPSegSourcePort = ReadFrameBE_EthMAC();                    // get ports
-  TCPSegDestPort = ReadFrameBE_EthMAC();
-
-  if (TCPSegDestPort != TCPLocalPort) return;              // drop segment if port doesn't match
-
-  TCPSegSeq = (unsigned long)ReadFrameBE_EthMAC() << 16;      // get segment sequence nr.
-  TCPSegSeq |= ReadFrameBE_EthMAC();
-
-  TCPSegAck = (unsigned long)ReadFrameBE_EthMAC() << 16;      // get segment acknowledge nr.
-  TCPSegAck |= ReadFrameBE_EthMAC();
+  if (RecdIPFrameLength < IP_HEADER_SIZE + TCP_HEADER_SIZE) return;  // no room for a header
+
+  TCPSegSourcePort = ReadWBE(&RecdFrame[TCP_SRCPORT_OFS]);    // get ports
+  TCPSegDestPort = ReadWBE(&RecdFrame[TCP_DESTPORT_OFS]);
+  TCPCode = ReadWBE(&RecdFrame[TCP_DATA_CODE_OFS]);          // get control bits, header length...
+
+  TCPSelect(TCPDemux(TCPSegDestPort, TCPSegSourcePort));  // find the segment's connection
+  if ((TCPCurrent == TCP_RESET_TCB) && ((TCPCode & (TCP_CODE_SYN | TCP_CODE_ACK | TCP_CODE_RST)) == TCP_CODE_SYN))
+    if (TCPReclaim(TCPSegDestPort) == TCP_BUSY_TCB) return; // no TCB free, drop the SYN and
+                                                           // let the client retry
+  if (TCPCurrent == TCP_RESET_TCB)                         // nobody wants it, answer with
+  {                                                        // a RST from the port it was sent to
+    TCPStateMachine = CLOSED;
+    TCPLocalPort = TCPSegDestPort;
+  }
 
-  TCPCode = ReadFrameBE_EthMAC();                             // get control bits, header length...
+  TCPSegSeq = ReadDWBE(&RecdFrame[TCP_SEQNR_OFS]);           // get segment sequence nr.
+  TCPSegAck = ReadDWBE(&RecdFrame[TCP_ACKNR_OFS]);           // get segment acknowledge nr.
 
   TCPHeaderSize = (TCPCode & DATA_OFS_MASK) >> 10;         // header length in bytes
+  if (TCPHeaderSize < TCP_HEADER_SIZE) return;             // bad header length
+  if (TCPHeaderSize > RecdIPFrameLength - IP_HEADER_SIZE) return;
   NrOfDataBytes = RecdIPFrameLength - IP_HEADER_SIZE - TCPHeaderSize;     // seg. text length
 
   if (NrOfDataBytes > MAX_TCP_RX_DATA_SIZE) return;        // packet too large for us :...-(
-
-  if (TCPHeaderSize > TCP_HEADER_SIZE)                     // ignore options if any
-    DummyReadFrame_EthMAC(TCPHeaderSize - TCP_HEADER_SIZE);
+                                                           // (options, if any, are skipped)
 
   switch (TCPStateMachine)                                 // implement the TCP state machine
   {
@@ -502,8 +1071,8 @@ void ProcessTCPFrame(void)
       if (!(TCPCode & TCP_CODE_RST))
       {
         TCPRemotePort = TCPSegSourcePort;
-        memcpy(&RemoteMAC, &RecdFrameMAC, 6);              // save opponents MAC and IP
-        memcpy(&RemoteIP, &RecdFrameIP, 4);                // for later use
+        memcpy(&RemoteMAC, RecdFrameMAC, 6);              // save opponents MAC and IP
+        memcpy(&RemoteIP, RecdFrameIP, 4);                // for later use
 
         if (TCPCode & TCP_CODE_ACK)                        // make the reset sequence
         {                                                  // acceptable to the other
@@ -525,8 +1094,8 @@ void ProcessTCPFrame(void)
       if (!(TCPCode & TCP_CODE_RST))                       // ignore segment containing RST
       {
         TCPRemotePort = TCPSegSourcePort;
-        memcpy(&RemoteMAC, &RecdFrameMAC, 6);              // save opponents MAC and IP
-        memcpy(&RemoteIP, &RecdFrameIP, 4);                // for later use
+        memcpy(&RemoteMAC, RecdFrameMAC, 6);              // save opponents MAC and IP
+        memcpy(&RemoteIP, RecdFrameIP, 4);                // for later use
 
         if (TCPCode & TCP_CODE_ACK)                        // reset a bad
         {                                                  // acknowledgement
@@ -538,19 +1107,23 @@ void ProcessTCPFrame(void)
           TCPAckNr = TCPSegSeq + 1;                           // get remote ISN, next byte we expect
 // CodeRed - change TAR -> TOTC to use LPC1768 clock
 //          TCPSeqNr = ((unsigned long)ISNGenHigh << 16) | TAR; // set local ISN
-          TCPSeqNr = ((unsigned long)ISNGenHigh << 16) | (LPC_TIM0->TC & 0xFFFF); // set local ISN
+          TCPSeqNr = ((uint32_t)ISNGenHigh << 16) | Get_ISNClock(); // set local ISN
           TCPUNASeqNr = TCPSeqNr + 1;                         // one byte out -> increase by one
+          TCB[TCPCurrent].SendMSS = TCPParseMSS(TCPHeaderSize);  // what the other TCP accepts
+          TCB[TCPCurrent].SendWindow = ReadWBE(&RecdFrame[TCP_WINDOW_OFS]);
           PrepareTCP_FRAME(TCP_CODE_SYN | TCP_CODE_ACK);
           LastFrameSent = TCP_SYN_ACK_FRAME;
           TCPStartRetryTimer();
+          TCPStartRTT(TCPUNASeqNr);                           // 1st round trip time
           TCPStateMachine = SYN_RECD;
+          TCPHashInsert();                                    // following segments go to us
         }
       }
       break;
     }
     case SYN_SENT :
     {
-      if (memcmp(&RemoteIP, &RecdFrameIP, 4)) break;  // drop segment if its IP doesn't belong
+      if (memcmp(&RemoteIP, RecdFrameIP, 4)) break;  // drop segment if its IP doesn't belong
                                                       // to current session
 
       if (TCPSegSourcePort != TCPRemotePort) break;   // drop segment if port doesn't match
@@ -581,10 +1154,13 @@ void ProcessTCPFrame(void)
       {
         TCPAckNr = TCPSegSeq;                    // get opponents ISN
         TCPAckNr++;                              // inc. by one...
+        TCB[TCPCurrent].SendMSS = TCPParseMSS(TCPHeaderSize);  // what the other TCP accepts
+        TCB[TCPCurrent].SendWindow = ReadWBE(&RecdFrame[TCP_WINDOW_OFS]);
 
         if (TCPCode & TCP_CODE_ACK)
         {
           TCPStopTimer();                        // stop retransmission, other TCP got our SYN
+          TCPAckRTT(TCPSegAck);
           TCPSeqNr = TCPUNASeqNr;                // advance our sequence number
 
           PrepareTCP_FRAME(TCP_CODE_ACK);        // ACK this ISN
@@ -605,7 +1181,7 @@ void ProcessTCPFrame(void)
     }
     default :
     {
-      if (memcmp(&RemoteIP, &RecdFrameIP, 4)) break;  // drop segment if IP doesn't belong
+      if (memcmp(&RemoteIP, RecdFrameIP, 4)) break;  // drop segment if IP doesn't belong
                                                       // to current session
 
       if (TCPSegSourcePort != TCPRemotePort) break;   // drop segment if port doesn't match
@@ -631,9 +1207,25 @@ void ProcessTCPFrame(void)
 
       if (!(TCPCode & TCP_CODE_ACK)) break;      // drop segment if the ACK bit is off
 
+      TCB[TCPCurrent].SendWindow = ReadWBE(&RecdFrame[TCP_WINDOW_OFS]);  // what it takes now
+      if (TCB[TCPCurrent].SegSent < TCB[TCPCurrent].SegCount)
+        TCPFlags |= TCP_SEND_FRAME1;             // a window update may let the rest go out
+      TCPAckRTT(TCPSegAck);                      // round trip complete?
+
+      if (((int32_t)(TCPSegAck - TCPSeqNr) > 0) && ((int32_t)(TCPUNASeqNr - TCPSegAck) > 0))
+      {                                          // some of our segments ACKed?
+        TCPFreeSegments(TCPSegAck);              // (cumulative ACK)
+        TCPSeqNr = TCPSegAck;                    // advance our sequence number
+        TCPStartRetryTimer();                    // time the rest from now on
+
+        if (TCPStateMachine == ESTABLISHED)      // user may fill the freed segments
+          SocketStatus |= SOCK_TX_BUF_RELEASED;
+      }
+
       if (TCPSegAck == TCPUNASeqNr)              // is our last data sent ACKed?
       {
         TCPStopTimer();                          // stop retransmission
+        TCPFreeSegments(TCPSegAck);              // whole window ACKed
         TCPSeqNr = TCPUNASeqNr;                  // advance our sequence number
 
         switch (TCPStateMachine)                 // change state if necessary
@@ -669,11 +1261,11 @@ void ProcessTCPFrame(void)
         if (NrOfDataBytes)                                 // data available?
           if (!(SocketStatus & SOCK_DATA_AVAILABLE))       // rx data-buffer empty?
           {
-            DummyReadFrame_EthMAC(6);                         // ignore window, checksum, urgent pointer
 // CodeRed - removed unrequired &     
 //           CopyFromFrame_EthMAC(&RxTCPBuffer, NrOfDataBytes);// fetch data and
-            CopyFromFrame_EthMAC(RxTCPBuffer, NrOfDataBytes);// fetch data and
-    
+            RxTCPBuffer = &RecdFrame[TCP_SRCPORT_OFS + TCPHeaderSize]; // point the user at the
+            RxFrameOwner = TCPCurrent;                     // data in the EMAC buffer, keep the
+                                                           // frame until it's released
             TCPRxDataCount = NrOfDataBytes;                // ...tell the user...
             SocketStatus |= SOCK_DATA_AVAILABLE;           // indicate the new data to user
             TCPAckNr += NrOfDataBytes;
@@ -717,10 +1309,42 @@ void ProcessTCPFrame(void)
 }
 
 // easyWEB internal function
-// prepares the TxFrame2-buffer to send an ARP-request
+// we've just rec'd an UDP-frame (User Datagram Protocol). it's handed
+// to the handler bound to its port, or dropped. the checksum isn't
+// checked (as for TCP, the EMAC already checked the frame's CRC)
 
-void PrepareARP_REQUEST(void)
+void ProcessUDPFrame(void)
 {
+  unsigned short Length, Port;
+  unsigned char i;
+
+  if (RecdIPFrameLength < IP_HEADER_SIZE + UDP_HEADER_SIZE) return;   // no room for a header
+
+  Length = ReadWBE(&RecdFrame[UDP_LENGTH_OFS]);                      // header and data
+  if (Length < UDP_HEADER_SIZE) return;
+  if (Length > RecdIPFrameLength - IP_HEADER_SIZE) return;          // truncated
+
+  Port = ReadWBE(&RecdFrame[UDP_DESTPORT_OFS]);
+
+  for (i = 0; i < UDP_MAX_SOCKETS; i++)
+    if (UDPSockets[i].Handler && (UDPSockets[i].LocalPort == Port))
+    {
+      if (IPNextHop(RecdFrameIP) == RecdFrameIP)   // sender is next to us, keep its MAC
+        ARPLearn(RecdFrameIP, (unsigned char *)RecdFrameMAC, 1);   // for the answer
+
+      UDPSockets[i].Handler(RecdFrameIP, ReadWBE(&RecdFrame[UDP_SRCPORT_OFS]),
+                            &RecdFrame[UDP_DATA_OFS], Length - UDP_HEADER_SIZE);
+      break;
+    }
+}
+
+// easyWEB internal function
+// builds TxFrame2 in place to send an ARP-request
+
+void PrepareARP_REQUEST(const unsigned short *IP)
+{
+  if (!TCPAllocFrame2()) return;                 // no EMAC buffer free, drop it
+
   // Ethernet
 	
 // CodeRed - added char cast	
@@ -748,22 +1372,21 @@ void PrepareARP_REQUEST(void)
   memcpy(&TxFrame2[ARP_SENDER_IP_OFS], &MyIP, 4);
   memset(&TxFrame2[ARP_TARGET_HA_OFS], 0x00, 6);           // we don't know opposites MAC!
 
-  if (((RemoteIP[0] ^ MyIP[0]) & SubnetMask[0]) || ((RemoteIP[1] ^ MyIP[1]) & SubnetMask[1]))
-    memcpy(&TxFrame2[ARP_TARGET_IP_OFS], &GatewayIP, 4);   // IP not in subnet, use gateway
-  else
-    memcpy(&TxFrame2[ARP_TARGET_IP_OFS], &RemoteIP, 4);    // other IP is next to us...
+  memcpy(&TxFrame2[ARP_TARGET_IP_OFS], IP, 4);
 
   TxFrame2Size = ETH_HEADER_SIZE + ARP_FRAME_SIZE;
   TransmitControl |= SEND_FRAME2;
 }
 
 // easyWEB internal function
-// prepares the TxFrame2-buffer to send an ARP-answer (reply)
+// builds TxFrame2 in place to send an ARP-answer (reply)
 
 void PrepareARP_ANSWER(void)
 {
+  if (!TCPAllocFrame2()) return;                 // no EMAC buffer free, drop it
+
   // Ethernet
-  memcpy(&TxFrame2[ETH_DA_OFS], &RecdFrameMAC, 6);
+  memcpy(&TxFrame2[ETH_DA_OFS], RecdFrameMAC, 6);
   memcpy(&TxFrame2[ETH_SA_OFS], &MyMAC, 6);
 // CodeRed - int-> short  
 //  *(unsigned int *)&TxFrame2[ETH_TYPE_OFS] = SWAPB(FRAME_ARP);
@@ -783,15 +1406,15 @@ void PrepareARP_ANSWER(void)
   *(unsigned short *)&TxFrame2[ARP_OPCODE_OFS] = SWAPB(OP_ARP_ANSWER);
   memcpy(&TxFrame2[ARP_SENDER_HA_OFS], &MyMAC, 6);
   memcpy(&TxFrame2[ARP_SENDER_IP_OFS], &MyIP, 4);
-  memcpy(&TxFrame2[ARP_TARGET_HA_OFS], &RecdFrameMAC, 6);
-  memcpy(&TxFrame2[ARP_TARGET_IP_OFS], &RecdFrameIP, 4);
+  memcpy(&TxFrame2[ARP_TARGET_HA_OFS], RecdFrameMAC, 6);
+  memcpy(&TxFrame2[ARP_TARGET_IP_OFS], RecdFrameIP, 4);
 
   TxFrame2Size = ETH_HEADER_SIZE + ARP_FRAME_SIZE;
   TransmitControl |= SEND_FRAME2;
 }
 
 // easyWEB internal function
-// prepares the TxFrame2-buffer to send an ICMP-echo-reply
+// builds TxFrame2 in place to send an ICMP-echo-reply
 
 void PrepareICMP_ECHO_REPLY(void)
 {
@@ -799,13 +1422,15 @@ void PrepareICMP_ECHO_REPLY(void)
 //  unsigned int ICMPDataCount;
   unsigned short ICMPDataCount;
   
+  if (!TCPAllocFrame2()) return;                 // no EMAC buffer free, drop it
+
   if (RecdIPFrameLength > MAX_ETH_TX_DATA_SIZE)                      // don't overload TX-buffer
     ICMPDataCount = MAX_ETH_TX_DATA_SIZE - IP_HEADER_SIZE - ICMP_HEADER_SIZE;
   else
     ICMPDataCount = RecdIPFrameLength - IP_HEADER_SIZE - ICMP_HEADER_SIZE;
 
   // Ethernet
-  memcpy(&TxFrame2[ETH_DA_OFS], &RecdFrameMAC, 6);
+  memcpy(&TxFrame2[ETH_DA_OFS], RecdFrameMAC, 6);
   memcpy(&TxFrame2[ETH_SA_OFS], &MyMAC, 6);
 
 // CodeRed - int-> short   
@@ -822,7 +1447,7 @@ void PrepareICMP_ECHO_REPLY(void)
   *(unsigned int *)&TxFrame2[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_ICMP);
   *(unsigned int *)&TxFrame2[IP_HEAD_CHKSUM_OFS] = 0;
   memcpy(&TxFrame2[IP_SOURCE_OFS], &MyIP, 4);
-  memcpy(&TxFrame2[IP_DESTINATION_OFS], &RecdFrameIP, 4);
+  memcpy(&TxFrame2[IP_DESTINATION_OFS], RecdFrameIP, 4);
   *(unsigned int *)&TxFrame2[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&TxFrame2[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
 */
   *(unsigned short *)&TxFrame2[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL);
@@ -832,7 +1457,7 @@ void PrepareICMP_ECHO_REPLY(void)
   *(unsigned short *)&TxFrame2[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_ICMP);
   *(unsigned short *)&TxFrame2[IP_HEAD_CHKSUM_OFS] = 0;
   memcpy(&TxFrame2[IP_SOURCE_OFS], &MyIP, 4);
-  memcpy(&TxFrame2[IP_DESTINATION_OFS], &RecdFrameIP, 4);
+  memcpy(&TxFrame2[IP_DESTINATION_OFS], RecdFrameIP, 4);
   *(unsigned short *)&TxFrame2[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&TxFrame2[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
   
   // ICMP
@@ -847,7 +1472,7 @@ void PrepareICMP_ECHO_REPLY(void)
   *(unsigned short *)&TxFrame2[ICMP_TYPE_CODE_OFS] = SWAPB(ICMP_ECHO_REPLY << 8);
   *(unsigned short *)&TxFrame2[ICMP_CHKSUM_OFS] = 0;                   // initialize checksum field
 
-  CopyFromFrame_EthMAC(&TxFrame2[ICMP_DATA_OFS], ICMPDataCount);        // get data to echo...
+  memcpy(&TxFrame2[ICMP_DATA_OFS], &RecdFrame[ICMP_DATA_OFS], ICMPDataCount); // get data to echo...
   *(unsigned short *)&TxFrame2[ICMP_CHKSUM_OFS] = CalcChecksum(&TxFrame2[IP_DATA_OFS], ICMPDataCount + ICMP_HEADER_SIZE, 0);
   
   
@@ -856,13 +1481,15 @@ void PrepareICMP_ECHO_REPLY(void)
 }
 
 // easyWEB internal function
-// prepares the TxFrame2-buffer to send a general TCP frame
+// builds TxFrame2 in place to send a general TCP frame
 // the TCPCode-field is passed as an argument
 
 // CodeRed - int-> short
 //void PrepareTCP_FRAME(unsigned int TCPCode)
 void PrepareTCP_FRAME(unsigned short TCPCode)
 {
+  if (!TCPAllocFrame2()) return;                 // no EMAC buffer free, the retry
+                                                 // timer or the other TCP resends
   // Ethernet
   memcpy(&TxFrame2[ETH_DA_OFS], &RemoteMAC, 6);
   memcpy(&TxFrame2[ETH_SA_OFS], &MyMAC, 6);
@@ -908,7 +1535,7 @@ void PrepareTCP_FRAME(unsigned short TCPCode)
   WriteWBE(&TxFrame2[TCP_SRCPORT_OFS], TCPLocalPort);
   WriteWBE(&TxFrame2[TCP_DESTPORT_OFS], TCPRemotePort);
 
-  WriteDWBE(&TxFrame2[TCP_SEQNR_OFS], TCPSeqNr);
+  WriteDWBE(&TxFrame2[TCP_SEQNR_OFS], TCPSendNext());   // behind the segments in flight
   WriteDWBE(&TxFrame2[TCP_ACKNR_OFS], TCPAckNr);
 
 // CodeRed - int-> short   
@@ -953,60 +1580,89 @@ void PrepareTCP_FRAME(unsigned short TCPCode)
 }
 
 // easyWEB internal function
-// prepares the TxFrame1-buffer to send a payload-packet
+// prepares the TxFrame1-buffer of a segment to send a payload-packet
+// the headers are only built for new data. a retransmission just
+// updates the ACK field and the checksum (RFC 1624), the payload is
+// never summed up again (its sum is kept in the segment).
 
-void PrepareTCP_DATA_FRAME(void)
+void PrepareTCP_DATA_FRAME(TTCPSegment *Seg)
 {
+  unsigned char *Frame = Seg->Buffer;
+  unsigned long Sum;
+
+  if (Seg->Built)                                // SEQ never changes, the segment
+  {                                              // keeps its place in the window
+    TCPUpdateDWBE(&Frame[TCP_ACKNR_OFS], TCPAckNr, &Frame[TCP_CHKSUM_OFS]);
+    return;
+  }
+
   // Ethernet
-  memcpy(&TxFrame1[ETH_DA_OFS], &RemoteMAC, 6);
-  memcpy(&TxFrame1[ETH_SA_OFS], &MyMAC, 6);
+  memcpy(&Frame[ETH_DA_OFS], &RemoteMAC, 6);
+  memcpy(&Frame[ETH_SA_OFS], &MyMAC, 6);
 // Code Red - int-> short    
-//  *(unsigned int *)&TxFrame1[ETH_TYPE_OFS] = SWAPB(FRAME_IP);
-  *(unsigned short *)&TxFrame1[ETH_TYPE_OFS] = SWAPB(FRAME_IP);
+//  *(unsigned int *)&Frame[ETH_TYPE_OFS] = SWAPB(FRAME_IP);
+  *(unsigned short *)&Frame[ETH_TYPE_OFS] = SWAPB(FRAME_IP);
   
   // IP
   
 // CodeRed - int-> short   
-/*  *(unsigned int *)&TxFrame1[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL | IP_TOS_D);
-  WriteWBE(&TxFrame1[IP_TOTAL_LENGTH_OFS], IP_HEADER_SIZE + TCP_HEADER_SIZE + TCPTxDataCount);
-  *(unsigned int *)&TxFrame1[IP_IDENT_OFS] = 0;
-  *(unsigned int *)&TxFrame1[IP_FLAGS_FRAG_OFS] = 0;
-  *(unsigned int *)&TxFrame1[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_TCP);
-  *(unsigned int *)&TxFrame1[IP_HEAD_CHKSUM_OFS] = 0; 
-  memcpy(&TxFrame1[IP_SOURCE_OFS], &MyIP, 4);
-  memcpy(&TxFrame1[IP_DESTINATION_OFS], &RemoteIP, 4);
-  *(unsigned int *)&TxFrame1[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&TxFrame1[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
+/*  *(unsigned int *)&Frame[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL | IP_TOS_D);
+  WriteWBE(&Frame[IP_TOTAL_LENGTH_OFS], IP_HEADER_SIZE + TCP_HEADER_SIZE + Seg->DataCount);
+  *(unsigned int *)&Frame[IP_IDENT_OFS] = 0;
+  *(unsigned int *)&Frame[IP_FLAGS_FRAG_OFS] = 0;
+  *(unsigned int *)&Frame[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_TCP);
+  *(unsigned int *)&Frame[IP_HEAD_CHKSUM_OFS] = 0; 
+  memcpy(&Frame[IP_SOURCE_OFS], &MyIP, 4);
+  memcpy(&Frame[IP_DESTINATION_OFS], &RemoteIP, 4);
+  *(unsigned int *)&Frame[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&Frame[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
 */
-  *(unsigned short *)&TxFrame1[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL | IP_TOS_D);
-  WriteWBE(&TxFrame1[IP_TOTAL_LENGTH_OFS], IP_HEADER_SIZE + TCP_HEADER_SIZE + TCPTxDataCount);
-  *(unsigned short *)&TxFrame1[IP_IDENT_OFS] = 0;
-  *(unsigned short *)&TxFrame1[IP_FLAGS_FRAG_OFS] = 0;
-  *(unsigned short *)&TxFrame1[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_TCP);
-  *(unsigned short *)&TxFrame1[IP_HEAD_CHKSUM_OFS] = 0; 
-  memcpy(&TxFrame1[IP_SOURCE_OFS], &MyIP, 4);
-  memcpy(&TxFrame1[IP_DESTINATION_OFS], &RemoteIP, 4);
-  *(unsigned short *)&TxFrame1[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&TxFrame1[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
+  *(unsigned short *)&Frame[IP_VER_IHL_TOS_OFS] = SWAPB(IP_VER_IHL | IP_TOS_D);
+  WriteWBE(&Frame[IP_TOTAL_LENGTH_OFS], IP_HEADER_SIZE + TCP_HEADER_SIZE + Seg->DataCount);
+  *(unsigned short *)&Frame[IP_IDENT_OFS] = 0;
+  *(unsigned short *)&Frame[IP_FLAGS_FRAG_OFS] = 0;
+  *(unsigned short *)&Frame[IP_TTL_PROT_OFS] = SWAPB((DEFAULT_TTL << 8) | PROT_TCP);
+  *(unsigned short *)&Frame[IP_HEAD_CHKSUM_OFS] = 0; 
+  memcpy(&Frame[IP_SOURCE_OFS], &MyIP, 4);
+  memcpy(&Frame[IP_DESTINATION_OFS], &RemoteIP, 4);
+  *(unsigned short *)&Frame[IP_HEAD_CHKSUM_OFS] = CalcChecksum(&Frame[IP_VER_IHL_TOS_OFS], IP_HEADER_SIZE, 0);
   
   
   // TCP
-  WriteWBE(&TxFrame1[TCP_SRCPORT_OFS], TCPLocalPort);
-  WriteWBE(&TxFrame1[TCP_DESTPORT_OFS], TCPRemotePort);
+  WriteWBE(&Frame[TCP_SRCPORT_OFS], TCPLocalPort);
+  WriteWBE(&Frame[TCP_DESTPORT_OFS], TCPRemotePort);
 
-  WriteDWBE(&TxFrame1[TCP_SEQNR_OFS], TCPSeqNr);
-  WriteDWBE(&TxFrame1[TCP_ACKNR_OFS], TCPAckNr);
+  WriteDWBE(&Frame[TCP_SEQNR_OFS], Seg->SeqNr);
+  WriteDWBE(&Frame[TCP_ACKNR_OFS], TCPAckNr);
 // CodeRed - int-> short  
-/*  *(unsigned int *)&TxFrame1[TCP_DATA_CODE_OFS] = SWAPB(0x5000 | TCP_CODE_ACK);   // TCP header length = 20
-  *(unsigned int *)&TxFrame1[TCP_WINDOW_OFS] = SWAPB(MAX_TCP_RX_DATA_SIZE);       // data bytes to accept
-  *(unsigned int *)&TxFrame1[TCP_CHKSUM_OFS] = 0; 
-  *(unsigned int *)&TxFrame1[TCP_URGENT_OFS] = 0;
-  *(unsigned int *)&TxFrame1[TCP_CHKSUM_OFS] = CalcChecksum(&TxFrame1[TCP_SRCPORT_OFS], TCP_HEADER_SIZE + TCPTxDataCount, 1);
+/*  *(unsigned int *)&Frame[TCP_DATA_CODE_OFS] = SWAPB(0x5000 | TCP_CODE_ACK);   // TCP header length = 20
+  *(unsigned int *)&Frame[TCP_WINDOW_OFS] = SWAPB(MAX_TCP_RX_DATA_SIZE);       // data bytes to accept
+  *(unsigned int *)&Frame[TCP_CHKSUM_OFS] = 0; 
+  *(unsigned int *)&Frame[TCP_URGENT_OFS] = 0;
+  *(unsigned int *)&Frame[TCP_CHKSUM_OFS] = CalcChecksum(&Frame[TCP_SRCPORT_OFS], TCP_HEADER_SIZE + Seg->DataCount, 1);
 */
-  *(unsigned short *)&TxFrame1[TCP_DATA_CODE_OFS] = SWAPB(0x5000 | TCP_CODE_ACK);   // TCP header length = 20
-  *(unsigned short *)&TxFrame1[TCP_WINDOW_OFS] = SWAPB(MAX_TCP_RX_DATA_SIZE);       // data bytes to accept
-  *(unsigned short *)&TxFrame1[TCP_CHKSUM_OFS] = 0; 
-  *(unsigned short *)&TxFrame1[TCP_URGENT_OFS] = 0;
-  *(unsigned short *)&TxFrame1[TCP_CHKSUM_OFS] = CalcChecksum(&TxFrame1[TCP_SRCPORT_OFS], TCP_HEADER_SIZE + TCPTxDataCount, 1);
+  *(unsigned short *)&Frame[TCP_DATA_CODE_OFS] = SWAPB(0x5000 | TCP_CODE_ACK);   // TCP header length = 20
+  *(unsigned short *)&Frame[TCP_WINDOW_OFS] = SWAPB(MAX_TCP_RX_DATA_SIZE);       // data bytes to accept
+  *(unsigned short *)&Frame[TCP_CHKSUM_OFS] = 0; 
+  *(unsigned short *)&Frame[TCP_URGENT_OFS] = 0;
 
+  Sum = ChecksumPartial(&Frame[TCP_SRCPORT_OFS], TCP_HEADER_SIZE, Seg->DataSum);
+  *(unsigned short *)&Frame[TCP_CHKSUM_OFS] = TCPPseudoChecksum(Sum, TCP_HEADER_SIZE + Seg->DataCount);
+
+  Seg->Built = 1;
+}
+
+// easyWEB internal function
+// writes a DWORD field of an already checksummed frame in big-endian
+// byte-order and updates the checksum 'Check' for it (RFC 1624)
+
+void TCPUpdateDWBE(unsigned char *Add, unsigned long Data, unsigned char *Check)
+{
+  unsigned short Old[2];
+
+  memcpy(Old, Add, 4);
+  WriteDWBE(Add, Data);
+  *(unsigned short *)Check = ChecksumUpdate(*(unsigned short *)Check, Old[0], *(unsigned short *)Add);
+  *(unsigned short *)Check = ChecksumUpdate(*(unsigned short *)Check, Old[1], *(unsigned short *)(Add + 2));
 }
 
 // easyWEB internal function
@@ -1017,43 +1673,183 @@ void PrepareTCP_DATA_FRAME(void)
 //unsigned int CalcChecksum(void *Start, unsigned int Count, unsigned char IsTCP)
 unsigned short CalcChecksum(void *Start, unsigned short Count, unsigned char IsTCP)
 {
-// Code Red - added pStart
-	unsigned short *pStart;
-	unsigned long Sum = 0;
-
-  if (IsTCP) {                                   // if we've a TCP frame...
-    Sum += MyIP[0];                              // ...include TCP pseudo-header
-    Sum += MyIP[1];
-    Sum += RemoteIP[0];
-    Sum += RemoteIP[1];
-    Sum += SwapBytes(Count);                     // TCP header length plus data length
-    Sum += SWAPB(PROT_TCP);
+  unsigned long Sum;
+
+  Sum = ChecksumPartial(Start, Count, 0);        // word-wise, see checksum.c
+
+  if (IsTCP)                                     // if we've a TCP frame...
+    return TCPPseudoChecksum(Sum, Count);        // ...include TCP pseudo-header
+
+  return ~ChecksumFold(Sum);
+}
+
+// easyWEB internal function
+// adds the TCP pseudo-header of the current connection to the partial
+// sum of a TCP segment of 'Count' bytes and returns the checksum
+
+unsigned short TCPPseudoChecksum(unsigned long Sum, unsigned short Count)
+{
+  return IPPseudoChecksum(Sum, RemoteIP, PROT_TCP, Count);
+}
+
+// easyWEB internal function
+// adds the pseudo-header of a TCP segment or UDP datagram of 'Count'
+// bytes sent to 'IP' to its partial sum and returns the checksum
+
+unsigned short IPPseudoChecksum(unsigned long Sum, const unsigned short *IP, unsigned char Protocol, unsigned short Count)
+{
+  Sum = ChecksumFold(Sum);                       // leave room for the carries
+  Sum += MyIP[0];
+  Sum += MyIP[1];
+  Sum += IP[0];
+  Sum += IP[1];
+  Sum += SwapBytes(Count);                       // header length plus data length
+  Sum += SwapBytes(Protocol);
+
+  return ~ChecksumFold(Sum);
+}
+
+// easyWEB internal function
+// returns the IP the current connection's frames are sent to: the
+// opponent itself or, if it isn't in our subnet, the gateway
+
+const unsigned short *TCPNextHop(void)
+{
+  return IPNextHop(RemoteIP);
+}
+
+// easyWEB internal function
+// returns the IP frames to 'IP' are sent to (see TCPNextHop())
+
+const unsigned short *IPNextHop(const unsigned short *IP)
+{
+  if (((IP[0] ^ MyIP[0]) & SubnetMask[0]) || ((IP[1] ^ MyIP[1]) & SubnetMask[1]))
+    return GatewayIP;                            // IP not in subnet, use gateway
+  else
+    return IP;                                   // other IP is next to us...
+}
+
+// easyWEB internal function
+// hashes an opponent's IP and port to one of the demux buckets
+
+unsigned char TCPHash(unsigned short *IP, unsigned short Port)
+{
+  unsigned short Hash;
+
+  Hash = IP[0] ^ IP[1] ^ Port;
+  Hash ^= Hash >> 8;
+  return Hash & (TCP_HASH_SIZE - 1);
+}
+
+// easyWEB internal function
+// (re)links the current TCB into the bucket of its opponent's IP and port
+// NOTE: TCBs aren't unlinked when they close, TCPDemux() skips them
+
+void TCPHashInsert(void)
+{
+  unsigned char *Link;
+
+  if (TCB[TCPCurrent].HashBucket != TCP_HASH_NONE)         // unlink from the old bucket
+  {
+    Link = &TCBHash[TCB[TCPCurrent].HashBucket];
+    while (*Link != TCPCurrent) Link = &TCB[*Link].HashNext;
+    *Link = TCB[TCPCurrent].HashNext;
   }
 
-// Code Red - modified to correct expression  
-/*  while (Count > 1) {                            // sum words
-    Sum += *((unsigned int *)Start)++;
-    Count -= 2;
+  TCB[TCPCurrent].HashBucket = TCPHash(RemoteIP, TCPRemotePort);
+  TCB[TCPCurrent].HashNext = TCBHash[TCB[TCPCurrent].HashBucket];
+  TCBHash[TCB[TCPCurrent].HashBucket] = TCPCurrent;
+}
+
+// easyWEB internal function
+// finds the TCB an incoming segment belongs to: an open connection
+// to 'RecdFrameIP:RemotePort', else a TCB listening on 'LocalPort',
+// else the scratch TCB (which will answer with a RST)
+
+unsigned char TCPDemux(unsigned short LocalPort, unsigned short RemotePort)
+{
+  unsigned char i;
+
+  i = TCBHash[TCPHash(RecdFrameIP, RemotePort)];
+  while (i != TCP_HASH_NONE)                     // walk the bucket's chain
+  {
+    if ((TCB[i].StateMachine != CLOSED) && (TCB[i].StateMachine != LISTENING))
+      if ((TCB[i].LocalPort == LocalPort) && (TCB[i].RemotePort == RemotePort))
+        if (!memcmp(&TCB[i].PeerIP, RecdFrameIP, 4))
+          return i;
+    i = TCB[i].HashNext;
   }
 
-  if (Count)                                     // add left-over byte, if any
-    Sum += *(unsigned char *)Start;
-*/
-  
-  pStart = Start;
-  while (Count > 1) {                            // sum words
-    Sum += *pStart++;
-    Count -= 2;
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)      // new connection, anybody listening?
+    if ((TCB[i].StateMachine == LISTENING) && (TCB[i].LocalPort == LocalPort))
+      return i;
+
+  return TCP_RESET_TCB;
+}
+
+// easyWEB internal function
+// a SYN found nobody listening on 'LocalPort': takes over the TCB of the
+// oldest connection in TIME_WAIT on that port (like lwIP does when it runs
+// out of PCBs) and selects it. returns TCP_BUSY_TCB if the port's TCBs are
+// all in use, TCP_RESET_TCB if nobody serves the port
+
+unsigned char TCPReclaim(unsigned short LocalPort)
+{
+  unsigned char i, Oldest = TCP_RESET_TCB;
+
+  for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+  {
+    if ((TCB[i].LocalPort != LocalPort) || (TCB[i].Flags & TCP_ACTIVE_OPEN))
+      continue;                                  // not a server of that port
+    if (Oldest == TCP_RESET_TCB)
+      Oldest = TCP_BUSY_TCB;
+    if ((TCB[i].StateMachine == TIME_WAIT) && !(TCB[i].Flags & TCP_SEND_FRAME1))
+      if (!(TCB[i].Status & SOCK_DATA_AVAILABLE))  // nothing left to send or to read
+        if ((Oldest == TCP_BUSY_TCB) || ((long)(TCB[i].Timeout - TCB[Oldest].Timeout) < 0))
+          Oldest = i;
   }
 
-  if (Count)                                     // add left-over byte, if any
-    Sum += *(unsigned char *)pStart;
+  if (Oldest < TCP_MAX_CONNECTIONS)
+  {
+    TCPSelect(Oldest);
+    TCPStateMachine = CLOSED;                    // as if TIME_WAIT had expired
+    TCPFlags = 0;
+    SocketStatus = 0;
+    TCPPassiveOpen();                            // and the user listened again
+  }
+  return Oldest;
+}
 
-  
-  while (Sum >> 16)                              // fold 32-bit sum to 16 bits
-    Sum = (Sum & 0xFFFF) + (Sum >> 16);
-  
-  return ~Sum;
+// easyWEB internal function
+// checks if 'RxCopyBuffer' is free (its data released by the user)
+
+unsigned char TCPRxCopyFree(void)
+{
+  if (RxCopyOwner != RX_FRAME_FREE)
+    if (!(TCB[RxCopyOwner].Status & SOCK_DATA_AVAILABLE))
+      RxCopyOwner = RX_FRAME_FREE;               // released (or connection closed)
+
+  return RxCopyOwner == RX_FRAME_FREE;
+}
+
+// easyWEB internal function
+// frames wait behind the one held for 'RxFrameOwner': moves its data
+// to 'RxCopyBuffer' and gives the frame back to the EMAC. returns 0 if
+// it has to stay (nothing waits behind it, or the copy is in use)
+
+unsigned char TCPCopyRxData(void)
+{
+  TTCB *Owner = &TCB[RxFrameOwner];
+
+  if ((RxFrameCount_EthMAC() <= 1) || !TCPRxCopyFree())
+    return 0;
+
+  memcpy(RxCopyBuffer, Owner->RxBuffer, Owner->RxDataCount);
+  Owner->RxBuffer = (unsigned char *)RxCopyBuffer;
+  RxCopyOwner = RxFrameOwner;
+  StopReadingFrame();
+  RxFrameOwner = RX_FRAME_FREE;
+  return 1;
 }
 
 // easyWEB internal function
@@ -1061,7 +1857,7 @@ unsigned short CalcChecksum(void *Start, unsigned short Count, unsigned char IsT
 
 void TCPStartRetryTimer(void)
 {
-  TCPTimer = 0;
+  TCPTimeout = TCPTime + TCB[TCPCurrent].RTO;
   RetryCounter = MAX_RETRYS;
   TCPFlags |= TCP_TIMER_RUNNING;
   TCPFlags |= TIMER_TYPE_RETRY;
@@ -1072,17 +1868,21 @@ void TCPStartRetryTimer(void)
 
 void TCPStartTimeWaitTimer(void)
 {
-  TCPTimer = 0;
+  TCPTimeout = TCPTime + FIN_TIMEOUT;
   TCPFlags |= TCP_TIMER_RUNNING;
   TCPFlags &= ~TIMER_TYPE_RETRY;  
 }
 
 // easyWEB internal function
-// restarts the timer
+// restarts the timer (a retry-timer with the actual, maybe backed off
+// retransmission timeout)
 
 void TCPRestartTimer(void)
 {
-  TCPTimer = 0;
+  if (TCPFlags & TIMER_TYPE_RETRY)
+    TCPTimeout = TCPTime + TCB[TCPCurrent].RTO;
+  else
+    TCPTimeout = TCPTime + FIN_TIMEOUT;
 }
 
 // easyWEB internal function
@@ -1093,19 +1893,95 @@ void TCPStopTimer(void)
   TCPFlags &= ~TCP_TIMER_RUNNING;
 }
 
+// easyWEB internal function
+// checks if the timer of a connection has expired (wraps after 49 days)
+
+unsigned char TCPTimerExpired(unsigned char Connection)
+{
+  return (long)(TCPTime - TCB[Connection].Timeout) >= 0;
+}
+
+// easyWEB internal function
+// forgets the round trip time of the last connection
+
+void TCPInitRTO(void)
+{
+  TCB[TCPCurrent].SRTT = 0;
+  TCB[TCPCurrent].RTTVar = 0;
+  TCB[TCPCurrent].RTO = TCP_RTO_INITIAL;
+  TCPFlags &= ~TCP_RTT_RUNNING;
+}
+
+// easyWEB internal function
+// starts to measure the round trip time of the frame just sent, it
+// ends with the first ACK of 'SeqNr'. only one frame is timed at once,
+// and never a retransmitted one (Karn's algorithm)
+
+void TCPStartRTT(uint32_t SeqNr)
+{
+  TCB[TCPCurrent].RTTSeqNr = SeqNr;
+  TCB[TCPCurrent].RTTStart = TCPTime;
+  TCPFlags |= TCP_RTT_RUNNING;
+}
+
+// easyWEB internal function
+// if 'Ack' ends the round trip measured, updates the smoothed round trip
+// time, its deviation and the retransmission timeout (Jacobson/Karels,
+// RFC 6298). the values are scaled to calculate with integers only.
+
+void TCPAckRTT(uint32_t Ack)
+{
+  TTCB *Conn = &TCB[TCPCurrent];
+  unsigned long RTT, RTO;
+  long Delta;
+
+  if (!(TCPFlags & TCP_RTT_RUNNING)) return;
+  if ((int32_t)(Ack - Conn->RTTSeqNr) < 0) return;  // not ACKed yet
+
+  TCPFlags &= ~TCP_RTT_RUNNING;
+  RTT = TCPTime - Conn->RTTStart;
+  if (RTT > TCP_RTO_MAX) RTT = TCP_RTO_MAX;
+
+  if (!Conn->RTTVar)                             // 1st measurement
+  {
+    Conn->SRTT = RTT << 3;                       // SRTT = RTT
+    Conn->RTTVar = (RTT << 1) + 1;               // RTTVAR = RTT / 2 (never 0)
+  }
+  else
+  {
+    Delta = RTT - (Conn->SRTT >> 3);
+    Conn->SRTT += Delta;                         // SRTT += (RTT - SRTT) / 8
+    if (Delta < 0) Delta = -Delta;
+    Conn->RTTVar += Delta - (Conn->RTTVar >> 2); // RTTVAR += (|RTT - SRTT| - RTTVAR) / 4
+    if (!Conn->RTTVar) Conn->RTTVar = 1;
+  }
+
+  RTO = (Conn->SRTT >> 3) + Conn->RTTVar;        // RTO = SRTT + 4 * RTTVAR
+  if (RTO < TCP_RTO_MIN) RTO = TCP_RTO_MIN;
+  if (RTO > TCP_RTO_MAX) RTO = TCP_RTO_MAX;
+  Conn->RTO = RTO;
+}
+
 // easyWEB internal function
 // if a retransmission-timeout occured, check which packet
 // to resend.
 
 void TCPHandleRetransmission(void)
 {
+  TCPFlags &= ~TCP_RTT_RUNNING;                  // an ACK can't tell which one it's for
+
   switch (LastFrameSent)
   {
-    case ARP_REQUEST :       { PrepareARP_REQUEST(); break; }
+    case ARP_REQUEST :       { TCPResolve(); break; }
     case TCP_SYN_FRAME :     { PrepareTCP_FRAME(TCP_CODE_SYN); break; }
     case TCP_SYN_ACK_FRAME : { PrepareTCP_FRAME(TCP_CODE_SYN | TCP_CODE_ACK); break; }
     case TCP_FIN_FRAME :     { PrepareTCP_FRAME(TCP_CODE_FIN | TCP_CODE_ACK); break; }
-    case TCP_DATA_FRAME :    { TransmitControl |= SEND_FRAME1; break; }
+    case TCP_DATA_FRAME :                        // go back to the oldest unACKed
+    {                                            // segment and resend the window
+      TCB[TCPCurrent].SegSent = 0;
+      TCPFlags |= TCP_SEND_FRAME1;
+      break;
+    }
   }
 }
 
@@ -1142,34 +2018,47 @@ interrupt [TIMERA1_VECTOR] void TCPClockHandler(void)
 */
 
 // easyWEB internal function
-// function executed every 0.210s by the MCU. used for the
-// inital sequence number generator (ISN) and the TCP-timer
+// function executed every 1ms by the MCU. used for the
+// inital sequence number generator (ISN) and the TCP-timers
 
 void TCPClockHandler(void)
 {
     ISNGenHigh++;                                // upper 16 bits of initial sequence number
-    TCPTimer++;                                  // timer for retransmissions
+    TCPTime++;                                   // timebase of the timers and round trip times
 }
 
 
 // easyWEB internal function
-// transfers the contents of 'TxFrame1'-Buffer to the CS8900A
+// transfers the contents of a segment's 'TxFrame1'-Buffer to the CS8900A
 
-void SendFrame1(void)
+void SendFrame1(TTCPSegment *Seg)
 {
 // CodeRed - updated for LPC1768 port
 // CopyToFrame8900(&TxFrame1, TxFrame1Size);
-  CopyToFrame_EthMAC(TxFrame1, TxFrame1Size);
+  if (Seg->Fragments)                            // headers + payload pieces
+    SendFragments_EthMAC(Seg->Fragment, 1 + Seg->Fragments);
+  else                                           // no copy, EMAC reads it where it is
+    SendFrame_EthMAC(Seg->Buffer, ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE + Seg->DataCount);
 }
 
 // easyWEB internal function
-// transfers the contents of 'TxFrame2'-Buffer to the CS8900A
+// hands the 'TxFrame2'-Buffer (built in place) to the EMAC
 
 void SendFrame2(void)
 {
 // CodeRed - updated for LPC1768 port	
 // CopyToFrame8900(&TxFrame2, TxFrame2Size);
-  CopyToFrame_EthMAC(TxFrame2, TxFrame2Size);
+  SendTxBuffer_EthMAC(TxFrame2Size);
+}
+
+// easyWEB internal function
+// points 'TxFrame2' at the EMAC's next free TX buffer, the frame is
+// built there. returns 0 (frame can't be sent) if the EMAC has none.
+
+unsigned char TCPAllocFrame2(void)
+{
+  TxFrame2 = GetTxBuffer_EthMAC();
+  return TxFrame2 != 0;
 }
 
 // easyWEB internal function
@@ -1198,6 +2087,25 @@ void WriteDWBE(unsigned char *Add, unsigned long Data)
   *Add = Data;
 }
 
+// easyWEB internal function
+// help function to read a WORD in big-endian byte-order
+// from MCU-memory (e.g. a header field of a received frame)
+
+unsigned short ReadWBE(const unsigned char *Add)
+{
+  return (Add[0] << 8) | Add[1];
+}
+
+// easyWEB internal function
+// help function to read a DWORD in big-endian byte-order
+// from MCU-memory
+
+unsigned long ReadDWBE(const unsigned char *Add)
+{
+  return ((unsigned long)Add[0] << 24) | ((unsigned long)Add[1] << 16) |
+         ((unsigned long)Add[2] << 8) | Add[3];
+}
+
 // easyWEB internal function
 // help function to swap the byte order of a WORD
 
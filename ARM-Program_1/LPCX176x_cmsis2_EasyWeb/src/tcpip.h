@@ -16,6 +16,10 @@
 #ifndef __TCPIP_H
 #define __TCPIP_H
 
+#include <stdint.h>                              // uint32_t sequence numbers
+#include "ethmac.h"                              // TTxFragment, USER_TX_BASE
+#include "ew_systick.h"                          // Get_CycleCounter()
+
 // easyWEB-stack definitions
 // Code Red - replaced original address by 192.168.0.200
 #define MYIP_1               192                 // our internet protocol (IP) address
@@ -34,22 +38,46 @@
 #define GWIP_3               2
 #define GWIP_4               154
 
-#define RETRY_TIMEOUT        8                   // wait max. 8 x 262ms for an ACK (about 2 sec.)
-#define FIN_TIMEOUT          2                   // max. time to wait for an ACK of a FIN
-                                                 // before closing TCP state-machine (about 0.5 s)
-#define MAX_RETRYS           4                   // nr. of resendings before reset conn.
+#define TCP_RTO_INITIAL      1000                // ms to wait for an ACK until the round
+                                                 // trip time is measured (RFC 6298)
+#define TCP_RTO_MIN          20                  // bounds of the retransmission timeout (ms),
+#define TCP_RTO_MAX          4000                // it's adapted to the measured round trip
+                                                 // time and doubled for each retransmission
+#define FIN_TIMEOUT          500                 // max. time to wait for an ACK of a FIN
+                                                 // before closing TCP state-machine (ms)
+#define MAX_RETRYS           8                   // nr. of resendings before reset conn.
                                                  // total nr. of transmissions = MAX_RETRYS + 1
 
-#define MAX_TCP_TX_DATA_SIZE 512                 // max. outgoing TCP data size (even!)
-#define MAX_TCP_RX_DATA_SIZE 256                 // max. incoming TCP data size (even!)
+#define MAX_TCP_TX_DATA_SIZE 512                 // size of 'TCP_TX_BUF' (even!), data sent
+                                                 // with TCPTxFragment() may be up to the MSS
+#define TCP_MSS_MAX          1460                // max. TCP data size per segment (Ethernet)
+#define TCP_MSS_DEFAULT      536                 // if the other TCP sends no MSS (RFC 879)
+#define TCP_MSS_MIN          64                  // smaller MSS options are ignored
+#define MAX_TCP_RX_DATA_SIZE TCP_MSS_MAX         // max. incoming TCP data size (even!)
                                                  // (increasing the buffer-size dramatically
                                                  // increases the transfer-speed!)
                                         
 #define MAX_ETH_TX_DATA_SIZE 60                  // 2nd buffer, used for ARP, ICMP, TCP (even!)
                                                  // enough to echo 32 byte via ICMP
 
+#define TCP_MAX_CONNECTIONS  4                   // simultaneous connections, each one costs
+                                                 // TCP_TX_SEGMENTS TxFrame1s (~570 bytes
+                                                 // AHB SRAM each)
+#define TCP_TX_SEGMENTS      4                   // segments sent before waiting for an ACK
+                                                 // (send window of each connection)
+#define TCP_HASH_SIZE        8                   // demux buckets (power of 2!)
+#define TCP_MAX_TX_FRAGS     7                   // payload pieces per segment, see
+                                                 // TCPTxFragment() (< NUM_TX_FRAG - 1!)
+
 #define DEFAULT_TTL          64                  // Time To Live sent with packets
 
+#define ARP_CACHE_SIZE       16                  // hosts whose MAC is kept (power of 2, <= 256!)
+#define ARP_CACHE_TIMEOUT    300000              // ms a learned MAC is used (5 min.)
+#define ARP_REQUEST_INTERVAL 1000                // ms between requests for a MAC that
+                                                 // UDPSend() waits for
+
+#define UDP_MAX_SOCKETS      4                   // ports with a receive handler (UDPBind())
+
 // Ethernet network layer definitions
 #define ETH_DA_OFS           0                   // Destination MAC address (48 Bit)
 #define ETH_SA_OFS           6                   // Source MAC address (48 Bit)
@@ -134,6 +162,16 @@
 #define TCP_OPT_MSS          0x0204              // Type 2, Option Length 4 (Max. Segment Size)
 #define TCP_OPT_MSS_SIZE     4
 
+// UDP layer definitions
+#define UDP_SRCPORT_OFS      IP_DATA_OFS + 0     // Source Port (16 bit)
+#define UDP_DESTPORT_OFS     IP_DATA_OFS + 2     // Destination Port (16 bit)
+#define UDP_LENGTH_OFS       IP_DATA_OFS + 4     // Length of Header and Data (16 bit)
+#define UDP_CHKSUM_OFS       IP_DATA_OFS + 6     // Checksum Field (16 bit)
+#define UDP_DATA_OFS         IP_DATA_OFS + 8     // Datagram Data
+#define UDP_HEADER_SIZE      8
+
+#define UDP_MAX_DATA_SIZE    (1500 - IP_HEADER_SIZE - UDP_HEADER_SIZE) // fits into one frame
+
 // define some TCP standard-ports, useful for testing...
 #define TCP_PORT_ECHO        7                   // echo
 #define TCP_PORT_DISCARD     9                   // discard
@@ -202,46 +240,182 @@ extern const unsigned char MyMAC[6];             // "M1-M2-M3-M4-M5-M6"
 #endif
 
 // easyWEB's internal variables
-extern TTCPStateMachine TCPStateMachine;         // perhaps the most important var at all ;-)
-extern TLastFrameSent LastFrameSent;             // retransmission type
-
 extern unsigned short ISNGenHigh;                // upper word of our Initial Sequence Number
-extern unsigned long TCPSeqNr;                   // next sequence number to send
-extern unsigned long TCPUNASeqNr;                // last unaknowledged sequence number
-                                                 // incremented AFTER sending data
-extern unsigned long TCPAckNr;                   // next seq to receive and ack to send
-                                                 // incremented AFTER receiving data
-extern unsigned char TCPTimer;                   // inc'd each 262ms
-extern unsigned char RetryCounter;               // nr. of retransmissions
+extern volatile unsigned long TCPTime;           // ms, inc'd by TCPClockHandler()
 
-// properties of the just received frame
+// properties of the just received frame. it's parsed in place in the
+// EMAC's RX buffer, the pointers point into it
+extern unsigned char *RecdFrame;                 // the frame itself
 extern unsigned short RecdFrameLength;           // EMAC reported frame length
-extern unsigned short RecdFrameMAC[3];           // 48 bit MAC
-extern unsigned short RecdFrameIP[2];            // 32 bit IP
+extern unsigned short *RecdFrameMAC;             // 48 bit MAC
+extern unsigned short *RecdFrameIP;              // 32 bit IP
 extern unsigned short RecdIPFrameLength;         // 16 bit IP packet length
 
-// the next 3 buffers must be word-aligned!
-// (here the 'RecdIPFrameLength' above does that)
-extern unsigned short _TxFrame1[(ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE + MAX_TCP_TX_DATA_SIZE)/2];
-extern unsigned short _TxFrame2[(ETH_HEADER_SIZE + MAX_ETH_TX_DATA_SIZE)/2];
-extern unsigned short _RxTCPBuffer[MAX_TCP_RX_DATA_SIZE/2]; // space for incoming TCP-data
-#define TxFrame1      ((unsigned char *)_TxFrame1)
-#define TxFrame2      ((unsigned char *)_TxFrame2)
-#define RxTCPBuffer   ((unsigned char *)_RxTCPBuffer)
+extern unsigned char RxFrameOwner;               // connection whose TCP_RX_BUF points
+#define RX_FRAME_FREE        0xFF                // into the frame (it's kept until released)
+
+// while a frame is held for RxFrameOwner, the frames behind it wait in
+// the EMAC. when some do, the held data is copied to 'RxCopyBuffer' and
+// the frame given back (see TCPCopyRxData()). so RX only stalls while
+// two connections hold unread data at the same time: one in the copy,
+// one in the EMAC.
+extern unsigned char RxCopyOwner;                // connection whose TCP_RX_BUF is the copy
+extern unsigned long RxCopyBuffer[(MAX_TCP_RX_DATA_SIZE + 3) / 4];
+
+// every connection owns a TxFrame1 per segment of its send window.
+// the TxFrame1s are kept in AHB SRAM behind the EMAC buffers
+// (USER_TX_BASE), the EMAC sends them from there. TxFrame2 is built in
+// place in the EMAC's next free TX buffer. received data isn't copied,
+// see TCP_RX_BUF.
+#define TCP_TX_FRAME_SIZE    ((ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE + MAX_TCP_TX_DATA_SIZE + 3) & ~3)
+#define TCP_TX_FRAMES_OFS    (USER_TX_OFS + TCP_MAX_CONNECTIONS * TCP_TX_SEGMENTS * TCP_TX_FRAME_SIZE)
+#define TCP_TX_FRAMES_END    (ETH_RAM_BASE + TCP_TX_FRAMES_OFS)
+                                                 // AHB SRAM from here on is free for the
+                                                 // application (see TCPTxFragment())
+
+extern unsigned char *TxFrame2;                  // EMAC TX buffer, see TCPAllocFrame2()
 
-extern unsigned short TxFrame1Size;              // bytes to send in TxFrame1
 extern unsigned char TxFrame2Size;               // bytes to send in TxFrame2
 
 extern unsigned char TransmitControl;
-#define SEND_FRAME1                    0x01
-#define SEND_FRAME2                    0x02
+#define SEND_FRAME2                    0x02      // (TxFrame1 is flagged per connection
+                                                 // by TCP_SEND_FRAME1 in 'TCPFlags')
 
-extern unsigned char TCPFlags;
 #define TCP_ACTIVE_OPEN                0x01      // easyWEB shall initiate a connection
 #define IP_ADDR_RESOLVED               0x02      // IP sucessfully resolved to MAC
 #define TCP_TIMER_RUNNING              0x04
 #define TIMER_TYPE_RETRY               0x08
 #define TCP_CLOSE_REQUESTED            0x10
+#define TCP_SEND_FRAME1                0x20      // segments of the window wait for the EMAC
+#define TCP_RTT_RUNNING                0x40      // a frame's round trip time is measured
+
+// a segment in the send window. it's sent again until it's ACKed
+typedef struct {
+  uint32_t SeqNr;                                // sequence number of its 1st byte
+  unsigned short DataCount;                      // nr. of bytes
+  unsigned long DataSum;                         // checksum partial sum of these bytes
+  unsigned char Built;                           // headers are valid, only ACK needs
+                                                 // to be updated for a retransmission
+  unsigned char Fragments;                       // payload pieces (0: payload is in
+                                                 // the TxFrame1, TCP_TX_BUF)
+  unsigned char *Buffer;                         // the segment's TxFrame1
+  TTxFragment Fragment[TCP_MAX_TX_FRAGS + 1];    // TxFrame1's headers, then the payload
+} TTCPSegment;
+
+// transmission control block, one per TCP connection
+typedef struct {
+  TTCPStateMachine StateMachine;                 // perhaps the most important var at all ;-)
+  TLastFrameSent LastFrameSent;                  // retransmission type
+  uint32_t SeqNr;                                // oldest unacknowledged sequence number
+  uint32_t UNASeqNr;                             // sequence number behind the queued data
+                                                 // incremented AFTER queueing data
+  uint32_t AckNr;                                // next seq to receive and ack to send
+                                                 // incremented AFTER receiving data
+  unsigned long Timeout;                         // 'TCPTime' when the timer expires
+  uint32_t RTTSeqNr;                             // ACK that ends the round trip measured
+  unsigned long RTTStart;                        // 'TCPTime' when it was sent
+  unsigned long SRTT;                            // smoothed round trip time (ms * 8)
+  unsigned long RTTVar;                          // its mean deviation (ms * 4), 0: no RTT yet
+  unsigned short RTO;                            // retransmission timeout (ms)
+  unsigned char RetryCounter;                    // nr. of retransmissions
+  unsigned char Flags;                           // TCP_xxx flags above
+  unsigned char Status;                          // SOCK_xxx flags below
+  unsigned short LocalPort;                      // TCP ports
+  unsigned short RemotePort;
+  unsigned short PeerMAC[3];                     // MAC and IP of the opponent
+  unsigned short PeerIP[2];
+  unsigned short RxDataCount;                    // nr. of bytes rec'd
+  unsigned short TxDataCount;                    // nr. of bytes to send
+  unsigned short SendMSS;                        // max. segment size the other TCP takes
+  unsigned short SendWindow;                     // bytes it takes behind 'SeqNr'
+  unsigned char *RxBuffer;                       // rec'd data, in the EMAC's RX buffer
+                                                 // or in RxCopyBuffer
+  unsigned char HashBucket;                      // demux bucket we're linked into
+  unsigned char HashNext;                        // next TCB in that bucket
+  unsigned char TxFragments;                     // payload pieces added by TCPTxFragment()
+  unsigned char SegHead;                         // oldest segment of the send window
+  unsigned char SegCount;                        // segments queued (not ACKed yet)
+  unsigned char SegSent;                         // ...of these already sent
+  TTCPSegment Segment[TCP_TX_SEGMENTS];          // send window, a ring
+} TTCB;
+
+#define TCP_HASH_NONE        0xFF                // end of a bucket's chain / not linked
+#define TCP_RESET_TCB        TCP_MAX_CONNECTIONS // scratch TCB to answer segments nobody
+                                                 // wants with a RST (has no buffers)
+#define TCP_BUSY_TCB         (TCP_MAX_CONNECTIONS + 1) // the port is served, but no TCB is free
+
+extern TTCB TCB[TCP_MAX_CONNECTIONS + 1];        // connection table (+ scratch TCB)
+extern unsigned char TCBHash[TCP_HASH_SIZE];     // first TCB of each bucket
+
+// ARP cache, direct-mapped: an IP has just one place it can be kept
+typedef struct {
+  unsigned short IP[2];
+  unsigned short MAC[3];
+  unsigned long Time;                            // 'TCPTime' when the MAC was learned
+  unsigned char State;                           // ARP_xxx below
+  unsigned char Waiting;                         // bit n set: connection n waits for the
+} TARPEntry;                                     // MAC (its SYN is held back)
+
+#define ARP_FREE                       0
+#define ARP_PENDING                    1         // request sent, no answer yet
+#define ARP_RESOLVED                   2
+
+extern TARPEntry ARPCache[ARP_CACHE_SIZE];
+
+// UDP receive handler, called for each datagram sent to its port.
+// 'Data' points into the EMAC's RX buffer, it's valid until the handler
+// returns (so is 'SenderIP')
+typedef void (*TUDPHandler)(const unsigned short *SenderIP, unsigned short SenderPort,
+                            const unsigned char *Data, unsigned short Count);
+
+typedef struct {
+  unsigned short LocalPort;
+  TUDPHandler Handler;                           // 0: socket unused
+} TUDPSocket;
+
+extern TUDPSocket UDPSockets[UDP_MAX_SOCKETS];
+
+// benchmark counters, kept if EASYWEB_BENCHMARK is defined (reported by
+// NetBenchReport() in easyweb.c). cycles are counted by Get_CycleCounter(),
+// on the board the DWT, a 32 bit counter at the CPU clock, so clear them
+// at least every 40 s (the host build counts ns)
+#ifdef EASYWEB_BENCHMARK
+typedef struct {
+  unsigned long Since;                           // TCPTime the counters were cleared
+  unsigned long RxFrames;                        // frames handled by DoNetworkStuff()
+  unsigned long RxCycles;                        // spent on them, incl. sending answers
+  unsigned long Retransmissions;
+  unsigned long Timeouts;                        // connections given up
+  unsigned long Pages;                           // pages served by HTTPServer()
+  unsigned long PageCycles;                      // spent on them (segments and checksums)
+} TNetStats;
+
+extern TNetStats NetStats;
+
+#define BENCH_START()        unsigned long BenchStart = Get_CycleCounter()
+#define BENCH_STOP(Counter)  (NetStats.Counter += Get_CycleCounter() - BenchStart)
+#define BENCH_COUNT(Counter) (NetStats.Counter++)
+#else
+#define BENCH_START()
+#define BENCH_STOP(Counter)
+#define BENCH_COUNT(Counter)
+#endif
+extern unsigned char TCPCurrent;                 // TCB the API and the stack work on
+
+// the former single-connection globals now refer to the current TCB,
+// use TCPSelect() to switch between connections
+#define TCPStateMachine (TCB[TCPCurrent].StateMachine)
+#define LastFrameSent   (TCB[TCPCurrent].LastFrameSent)
+#define TCPSeqNr        (TCB[TCPCurrent].SeqNr)
+#define TCPUNASeqNr     (TCB[TCPCurrent].UNASeqNr)
+#define TCPAckNr        (TCB[TCPCurrent].AckNr)
+#define TCPTimeout      (TCB[TCPCurrent].Timeout)
+#define RetryCounter    (TCB[TCPCurrent].RetryCounter)
+#define TCPFlags        (TCB[TCPCurrent].Flags)
+#define TCPNextSegment  (&TCB[TCPCurrent].Segment[(TCB[TCPCurrent].SegHead + TCB[TCPCurrent].SegCount) % TCP_TX_SEGMENTS])
+                                                 // free segment the user fills next
+#define TxFrame1        (TCPNextSegment->Buffer)
+#define RxTCPBuffer     (TCB[TCPCurrent].RxBuffer)
 
 // prototypes
 void DoNetworkStuff(void);
@@ -249,57 +423,100 @@ void DoNetworkStuff(void);
 // Handlers for incoming frames
 void ProcessEthBroadcastFrame(void);
 void ProcessEthIAFrame(void);
+void ProcessARPFrame(void);
 void ProcessICMPFrame(void);
 void ProcessTCPFrame(void);
+void ProcessUDPFrame(void);
 
 // fill TX-buffers
-void PrepareARP_REQUEST(void);
+void PrepareARP_REQUEST(const unsigned short *IP);
 void PrepareARP_ANSWER(void);
 void PrepareICMP_ECHO_REPLY(void);
 void PrepareTCP_FRAME(unsigned short TCPCode);
-void PrepareTCP_DATA_FRAME(void);
+void PrepareTCP_DATA_FRAME(TTCPSegment *Seg);
 
 // general help functions
-void SendFrame1(void);
+void SendFrame1(TTCPSegment *Seg);
 void SendFrame2(void);
 void TCPStartRetryTimer(void);
 void TCPStartTimeWaitTimer(void);
 void TCPRestartTimer(void);
 void TCPStopTimer(void);
+unsigned char TCPTimerExpired(unsigned char Connection);
+void TCPInitRTO(void);
+void TCPStartRTT(uint32_t SeqNr);
+void TCPAckRTT(uint32_t Ack);
 void TCPHandleRetransmission(void);
 void TCPHandleTimeout(void);
 unsigned short CalcChecksum(void *Start, unsigned short Count, unsigned char IsTCP);
+unsigned short TCPPseudoChecksum(unsigned long Sum, unsigned short Count);
+unsigned short IPPseudoChecksum(unsigned long Sum, const unsigned short *IP, unsigned char Protocol, unsigned short Count);
+void TCPUpdateDWBE(unsigned char *Add, unsigned long Data, unsigned char *Check);
+const unsigned short *TCPNextHop(void);
+const unsigned short *IPNextHop(const unsigned short *IP);
+unsigned char TCPAllocFrame2(void);
+unsigned char TCPHash(unsigned short *IP, unsigned short Port);
+void TCPHashInsert(void);
+unsigned char TCPDemux(unsigned short LocalPort, unsigned short RemotePort);
+unsigned char TCPReclaim(unsigned short LocalPort);
+unsigned char TCPRxCopyFree(void);
+unsigned char TCPCopyRxData(void);
+void TCPSendFrames(void);
+unsigned long TCPFragmentsSum(void);
+void TCPClearSegments(void);
+void TCPFreeSegments(uint32_t Ack);
+uint32_t TCPSendNext(void);
+unsigned short TCPParseMSS(unsigned char TCPHeaderSize);
+void TCPResolve(void);
+
+// ARP cache
+unsigned char ARPHash(const unsigned short *IP);
+unsigned char ARPLookup(const unsigned short *IP, unsigned short *MAC);
+TARPEntry *ARPPending(const unsigned short *IP);
+void ARPLearn(const unsigned short *IP, const unsigned char *MAC, unsigned char Add);
 
 // functions to work with big-endian numbers
 unsigned short SwapBytes(unsigned short Data);
 void WriteWBE(unsigned char *Add, unsigned short Data);
+unsigned short ReadWBE(const unsigned char *Add);
+unsigned long ReadDWBE(const unsigned char *Add);
 void WriteDWBE(unsigned char *Add, unsigned long Data);
 
 // easyWEB-API functions
 void TCPLowLevelInit(void);                      // setup timer, LAN-controller, flags...
+void TCPSelect(unsigned char Connection);        // make a TCB the current connection
 void TCPPassiveOpen(void);                       // listen for a connection
 void TCPActiveOpen(void);                        // open connection
 void TCPClose(void);                             // close connection
 void TCPReleaseRxBuffer(void);                   // indicate to discard rec'd packet
+unsigned char TCPWorkPending(void);              // 0: nothing to do until an interrupt
 void TCPTransmitTxBuffer(void);                  // initiate transfer after TxBuffer is filled
+void TCPTransmitTxBufferSum(unsigned long DataSum); // same, checksum of the data already known
+unsigned char TCPTxFragment(const void *Data, unsigned short Size); // send data from where it is
+unsigned char UDPBind(unsigned short LocalPort, TUDPHandler Handler); // receive datagrams
+void UDPUnbind(unsigned short LocalPort);
+unsigned char UDPSend(const unsigned short *IP, unsigned short RemotePort, unsigned short LocalPort,
+                      const void *Data, unsigned short Count);  // send a datagram from where it is
 // Code Red - added declaration for Timer0 ISR
 void TCPClockHandler(void);                      
 
-// easyWEB-API global vars and flags
-extern unsigned short TCPRxDataCount;            // nr. of bytes rec'd
-extern unsigned short TCPTxDataCount;            // nr. of bytes to send
+// easyWEB-API global vars and flags (of the current connection)
+#define TCPRxDataCount  (TCB[TCPCurrent].RxDataCount)  // nr. of bytes rec'd
+#define TCPTxDataCount  (TCB[TCPCurrent].TxDataCount)  // nr. of bytes to send
+#define TCPTxMSS        (TCB[TCPCurrent].SendMSS)      // max. nr. of bytes per segment
 
-extern unsigned short TCPLocalPort;              // TCP ports
-extern unsigned short TCPRemotePort;
+#define TCPLocalPort    (TCB[TCPCurrent].LocalPort)    // TCP ports
+#define TCPRemotePort   (TCB[TCPCurrent].RemotePort)
 
-extern unsigned short RemoteMAC[3];              // MAC and IP of current TCP-session
-extern unsigned short RemoteIP[2];
+#define RemoteMAC       (TCB[TCPCurrent].PeerMAC)    // MAC and IP of current TCP-session
+#define RemoteIP        (TCB[TCPCurrent].PeerIP)
 
-extern unsigned char SocketStatus;
+#define SocketStatus    (TCB[TCPCurrent].Status)
 #define SOCK_ACTIVE                    0x01      // state machine NOT closed
 #define SOCK_CONNECTED                 0x02      // user may send & receive data
 #define SOCK_DATA_AVAILABLE            0x04      // new data available
-#define SOCK_TX_BUF_RELEASED           0x08      // user may fill buffer
+#define SOCK_TX_BUF_RELEASED           0x08      // user may fill buffer (a free
+                                                 // segment of the send window)
 
 #define SOCK_ERROR_MASK                0xF0      // bit-mask to check for errors
 #define SOCK_ERR_OK                    0x00      // no error
@@ -311,7 +528,7 @@ extern unsigned char SocketStatus;
 
 // easyWEB-API buffer-pointers
 #define TCP_TX_BUF      ((unsigned char *)TxFrame1 + ETH_HEADER_SIZE + IP_HEADER_SIZE + TCP_HEADER_SIZE)
-#define TCP_RX_BUF      ((unsigned char *)RxTCPBuffer)
+#define TCP_RX_BUF      ((unsigned char *)RxTCPBuffer) // valid until TCPReleaseRxBuffer()
 
 #endif
 
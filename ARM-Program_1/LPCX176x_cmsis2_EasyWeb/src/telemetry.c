@@ -0,0 +1,100 @@
+//*****************************************************************************
+// telemetry.c - sensor telemetry publisher on top of the easyWEB UDP layer
+//
+// Samples are taken from TelemetryPoll() in the main loop, on the 1 ms
+// timebase of the stack (TCPTime). A late call catches up on the samples
+// it missed, so the timestamps stay exact. The batches are written in
+// place into two buffers in AHB SRAM, by turns: the EMAC sends one while
+// the other is filled.
+//*****************************************************************************
+
+#include "telemetry.h"
+
+static unsigned char *Buffers;                   // TELEMETRY_BUFFERS_SIZE bytes in AHB SRAM
+static unsigned char *Batch;                     // the one being filled
+static TTelemetrySource Source;
+
+static unsigned short SubscriberIP[2];
+static unsigned short SubscriberPort;
+static unsigned short Period;                    // ms between samples, 0: not publishing
+static unsigned short BatchSize;                 // samples per datagram
+static unsigned short Fill;                      // samples in 'Batch'
+static unsigned long NextSample;                 // TCPTime of the next sample
+static unsigned long Seq;                        // nr. of the next batch
+
+static void TelemetrySubscribe(const unsigned short *SenderIP, unsigned short SenderPort,
+                               const unsigned char *Data, unsigned short Count);
+static void TelemetrySend(void);
+
+// sets up the publisher. 'Memory' must be TELEMETRY_BUFFERS_SIZE bytes
+// in AHB SRAM (the EMAC sends the batches from there), 'SampleSource' is
+// called for each sample.
+// NOTE: call after TCPLowLevelInit()
+
+void TelemetryInit(unsigned char *Memory, TTelemetrySource SampleSource)
+{
+  Buffers = Memory;
+  Batch = Buffers;
+  Source = SampleSource;
+  Period = 0;
+  Fill = 0;
+  Seq = 0;
+
+  UDPBind(TELEMETRY_PORT, TelemetrySubscribe);
+}
+
+// takes the samples that are due and sends the batch once it's full.
+// call it at least once a ms (the main loop wakes up on each SysTick)
+
+void TelemetryPoll(void)
+{
+  while (Period && ((long)(TCPTime - NextSample) >= 0))
+  {
+    if (!Fill)
+      WriteDWBE(&Batch[TELEMETRY_TIME_OFS], NextSample);
+
+    WriteWBE(&Batch[TELEMETRY_DATA_OFS + 2 * Fill], Source());
+    Fill++;
+    NextSample += Period;
+
+    if (Fill >= BatchSize)
+      TelemetrySend();
+  }
+}
+
+// UDP handler of TELEMETRY_PORT: (re)starts publishing to the sender
+// of the datagram with the rate asked for, or stops it
+
+static void TelemetrySubscribe(const unsigned short *SenderIP, unsigned short SenderPort,
+                               const unsigned char *Data, unsigned short Count)
+{
+  if (Count < 2) return;                         // no period
+
+  Period = ReadWBE(Data);
+  BatchSize = (Count >= 4) ? ReadWBE(Data + 2) : 0;
+  if (!BatchSize || (BatchSize > TELEMETRY_MAX_SAMPLES))
+    BatchSize = TELEMETRY_MAX_SAMPLES;
+
+  SubscriberIP[0] = SenderIP[0];
+  SubscriberIP[1] = SenderIP[1];
+  SubscriberPort = SenderPort;
+
+  Fill = 0;                                      // start a new batch now
+  NextSample = TCPTime;
+}
+
+// sends the batch and switches to the other buffer. a batch which can't
+// be sent (MAC not known yet, EMAC busy) is dropped, its nr. is used
+// anyway so that the host sees the gap
+
+static void TelemetrySend(void)
+{
+  WriteDWBE(&Batch[TELEMETRY_SEQ_OFS], Seq++);
+  WriteWBE(&Batch[TELEMETRY_PERIOD_OFS], Period);
+  WriteWBE(&Batch[TELEMETRY_COUNT_OFS], Fill);
+
+  UDPSend(SubscriberIP, SubscriberPort, TELEMETRY_PORT, Batch, TELEMETRY_HEADER_SIZE + 2 * Fill);
+
+  Batch = (Batch == Buffers) ? Buffers + TELEMETRY_BUFFER_SIZE : Buffers;
+  Fill = 0;
+}
@@ -0,0 +1,43 @@
+//*****************************************************************************
+// telemetry.h - sensor telemetry publisher on top of the easyWEB UDP layer
+//
+// A host subscribes by sending a datagram to TELEMETRY_PORT. From then on
+// the board samples a value each 'Period' ms and sends the samples in
+// batches to the host's IP and port. All fields are big endian.
+//
+// subscribe (host -> board):
+//   Period   16 bit   ms between samples, 0 stops publishing
+//   Count    16 bit   samples per datagram, 0 = as many as fit (optional)
+//
+// batch (board -> host):
+//   Seq      32 bit   nr. of the batch, gaps show lost datagrams
+//   Time     32 bit   ms timestamp (TCPTime) of the first sample
+//   Period   16 bit   ms between samples
+//   Count    16 bit   nr. of samples that follow
+//   Sample   16 bit   'Count' times
+//*****************************************************************************
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include "tcpip.h"                               // UDP_MAX_DATA_SIZE
+
+#define TELEMETRY_PORT               5005        // UDP port subscribes are sent to
+
+#define TELEMETRY_SEQ_OFS            0           // batch header
+#define TELEMETRY_TIME_OFS           4
+#define TELEMETRY_PERIOD_OFS         8
+#define TELEMETRY_COUNT_OFS          10
+#define TELEMETRY_DATA_OFS           12
+#define TELEMETRY_HEADER_SIZE        12
+
+#define TELEMETRY_MAX_SAMPLES        ((UDP_MAX_DATA_SIZE - TELEMETRY_HEADER_SIZE) / 2)
+#define TELEMETRY_BUFFER_SIZE        (TELEMETRY_HEADER_SIZE + 2 * TELEMETRY_MAX_SAMPLES)
+#define TELEMETRY_BUFFERS_SIZE       (2 * TELEMETRY_BUFFER_SIZE)   // one filled, one sent
+
+typedef unsigned short (*TTelemetrySource)(void);   // returns the next sample
+
+void TelemetryInit(unsigned char *Memory, TTelemetrySource SampleSource);
+void TelemetryPoll(void);
+
+#endif
@@ -0,0 +1,38 @@
+//*****************************************************************************
+// board_host.c - host timebase of the easyWEB stack (src/ew_systick.h)
+//
+// Takes the place of src/ew_systick.c in the host build. There's no
+// SysTick: the program calls TCPClockHandler() itself, so the stack runs
+// on a virtual ms clock and a run is the same every time (that's what
+// lets a recorded capture be replayed, see easyweb_bench.c). The ISNs
+// follow a fixed sequence for the same reason. The benchmark figures are
+// counted in ns of the host.
+//*****************************************************************************
+
+#include <time.h>
+
+#include "ew_systick.h"
+
+static unsigned short ISNClock;
+
+void Start_SysTick1ms(void)
+{
+}
+
+unsigned short Get_ISNClock(void)
+{
+  ISNClock += 40503;                             // (2^16 / golden ratio, spreads them)
+  return ISNClock;
+}
+
+void Start_CycleCounter(void)
+{
+}
+
+unsigned long Get_CycleCounter(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
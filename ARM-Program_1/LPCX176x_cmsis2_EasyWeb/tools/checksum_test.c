@@ -0,0 +1,190 @@
+//*****************************************************************************
+// checksum_test.c - host test of the easyWEB checksum module (src/checksum.c)
+//
+// Checks the word-wise kernel and the incremental helpers against the
+// halfword loop CalcChecksum() used before them (copied below), on random
+// data. Runs on Linux, it's not part of the firmware build:
+//
+//   gcc -O2 -Wall -I ../src -o checksum_test checksum_test.c ../src/checksum.c
+//
+//   checksum_test [rounds]
+//
+// - ChecksumPartial() at each of the 4 alignments of the start address,
+//   for every length from 0 to 2 * 1514 (odd lengths too)
+// - partial sums of pieces added up, swapped for pieces at odd offsets
+// - ChecksumUpdate() for a changed halfword and for a DWORD field the way
+//   TCPUpdateDWBE() rewrites the ACK of a retransmitted segment
+// - ChecksumReplace() at even and odd offsets, as the page cache does for
+//   the patched dynamic values
+// Every result must match the old loop run on an aligned copy of the bytes.
+// Returns 0 when all of them do.
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "checksum.h"
+
+#define MAX_LENGTH           (2 * 1514)
+
+static unsigned short Aligned[MAX_LENGTH / 2 + 1];
+static unsigned char Buffer[MAX_LENGTH + 8];
+static unsigned long Failures;
+
+// the checksum loop of the original easyWEB (tcpip.c before the checksum
+// module), without the pseudo header
+
+static unsigned short OldCalcChecksum(void *Start, unsigned short Count)
+{
+  unsigned short *pStart;
+  unsigned long Sum = 0;
+
+  pStart = Start;
+  while (Count > 1) {                            // sum words
+    Sum += *pStart++;
+    Count -= 2;
+  }
+
+  if (Count)                                     // add left-over byte, if any
+    Sum += *(unsigned char *)pStart;
+
+  while (Sum >> 16)                              // fold 32-bit sum to 16 bits
+    Sum = (Sum & 0xFFFF) + (Sum >> 16);
+
+  return ~Sum;
+}
+
+// old checksum of 'Count' bytes at any address, on an aligned copy
+
+static unsigned short Reference(const unsigned char *Start, unsigned short Count)
+{
+  memset(Aligned, 0, sizeof(Aligned));
+  memcpy(Aligned, Start, Count);
+  return OldCalcChecksum(Aligned, Count);
+}
+
+static void Fill(unsigned char *Data, unsigned short Count)
+{
+  while (Count--)
+    *Data++ = rand();
+}
+
+static void Check(const char *Test, unsigned Detail, unsigned short Got, unsigned short Expected)
+{
+  if (Got == Expected) return;
+  if (Failures++ < 10)
+    printf("%s (%u): %04X, expected %04X\n", Test, Detail, Got, Expected);
+}
+
+static void TestPartial(void)
+{
+  unsigned Align, Count;
+
+  for (Align = 0; Align < 4; Align++)
+    for (Count = 0; Count <= MAX_LENGTH; Count++)
+    {
+      Fill(Buffer + Align, Count);
+      Check("partial", Align << 16 | Count,
+            ~ChecksumFold(ChecksumPartial(Buffer + Align, Count, 0)), Reference(Buffer + Align, Count));
+    }
+
+  memset(Buffer, 0xFF, sizeof(Buffer));          // worst case for the carries
+  Check("partial 0xFF", MAX_LENGTH, ~ChecksumFold(ChecksumPartial(Buffer + 1, MAX_LENGTH, 0)),
+        Reference(Buffer + 1, MAX_LENGTH));
+}
+
+// a frame summed in pieces: pieces at even offsets are added as they are,
+// pieces at odd offsets swapped
+
+static void TestPieces(void)
+{
+  unsigned short Count, Ofs, Size, Part;
+  uint32_t Sum;
+
+  Count = 1 + rand() % MAX_LENGTH;
+  Fill(Buffer, Count);
+
+  Sum = 0;
+  for (Ofs = 0; Ofs < Count; Ofs += Size)
+  {
+    Size = 1 + rand() % 97;
+    if (Size > Count - Ofs) Size = Count - Ofs;
+    Part = ChecksumFold(ChecksumPartial(Buffer + Ofs, Size, 0));
+    Sum += (Ofs & 1) ? ChecksumSwap(Part) : Part;
+  }
+  Check("pieces", Count, ~ChecksumFold(Sum), Reference(Buffer, Count));
+}
+
+// the checksum field at an even offset is updated for a changed halfword
+// and for a DWORD field (two halfwords, like TCPUpdateDWBE())
+
+static void TestUpdate(void)
+{
+  unsigned short Count, Ofs, Old[2], New[2], Field;
+
+  Count = 8 + 2 * (rand() % (MAX_LENGTH / 2 - 4));
+  Fill(Buffer, Count);
+  memset(Buffer, 0, 2);                          // checksum field at offset 0
+  Field = Reference(Buffer, Count);
+  memcpy(Buffer, &Field, 2);
+  Check("update: frame", Count, Reference(Buffer, Count), 0);
+
+  Ofs = 2 + 2 * (rand() % (Count / 2 - 1));      // a halfword after the field
+  memcpy(Old, Buffer + Ofs, 2);
+  Fill((unsigned char *)New, 2);
+  memcpy(Buffer + Ofs, New, 2);
+  Field = ChecksumUpdate(Field, Old[0], New[0]);
+  memcpy(Buffer, &Field, 2);
+  Check("update: halfword", Ofs, Reference(Buffer, Count), 0);
+
+  Ofs = 2 + 2 * (rand() % (Count / 2 - 2));      // a DWORD, e.g. the ACK nr.
+  memcpy(Old, Buffer + Ofs, 4);
+  Fill((unsigned char *)New, 4);
+  memcpy(Buffer + Ofs, New, 4);
+  Field = ChecksumUpdate(Field, Old[0], New[0]);
+  Field = ChecksumUpdate(Field, Old[1], New[1]);
+  memcpy(Buffer, &Field, 2);
+  Check("update: dword", Ofs, Reference(Buffer, Count), 0);
+}
+
+// bytes at even and odd offsets are replaced in the cached partial sum
+
+static void TestReplace(void)
+{
+  unsigned char New[32];
+  unsigned short Count, Ofs, Size;
+  uint32_t Sum;
+
+  Count = 64 + rand() % (MAX_LENGTH - 64);
+  Fill(Buffer, Count);
+  Sum = ChecksumPartial(Buffer, Count, 0);
+
+  Size = 1 + rand() % sizeof(New);
+  Ofs = rand() % (Count - Size);
+  Fill(New, Size);
+  Sum = ChecksumReplace(Sum, Buffer + Ofs, New, Size, Ofs & 1);
+  memcpy(Buffer + Ofs, New, Size);
+
+  Check("replace", Ofs << 16 | Size, ~ChecksumFold(Sum), Reference(Buffer, Count));
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long Rounds = (argc > 1) ? strtoul(argv[1], 0, 0) : 10000;
+  unsigned long i;
+
+  srand(1);
+  TestPartial();
+  for (i = 0; i < Rounds; i++)
+  {
+    TestPieces();
+    TestUpdate();
+    TestReplace();
+  }
+
+  printf("%s: 4 alignments x %d lengths, %lu rounds of pieces, update and replace\n",
+         Failures ? "FAILED" : "ok", MAX_LENGTH + 1, Rounds);
+  return Failures != 0;
+}
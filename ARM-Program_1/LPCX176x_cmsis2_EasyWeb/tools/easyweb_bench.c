@@ -0,0 +1,761 @@
+//*****************************************************************************
+// easyweb_bench.c - host benchmark of the easyWEB stack and HTTP server
+//
+// Runs the unchanged src/tcpip.c and src/easyweb.c on Linux against HTTP
+// clients on the other end of the in-memory link of eth_host.c. Built by
+// the Makefile (it's not part of the firmware build):
+//
+//   make easyweb_bench
+//
+//   easyweb_bench
+//       the suite: 1000 pages to 4 clients at a time, without loss and
+//       with every 100th, 20th and 10th frame lost (both directions)
+//   easyweb_bench [-n pages] [-c clients] [-l lose-every] [-w file.pcap]
+//       one run, '-w' records the frames crossing the link
+//   easyweb_bench -p frames
+//       the cost per frame received, for each kind of frame: 'frames'
+//       ARP requests, pings, TCP segments of a connection and without
+//       one, UDP datagrams to no socket, frames of another protocol
+//   easyweb_bench -r file.pcap [-l lose-every]
+//       replays the client frames of a capture and checks that the stack
+//       answers with the very frames recorded ('-l' as in the run
+//       recorded, the stack loses the same frames again)
+//
+// The stack runs on a virtual ms clock (TCPClockHandler() is called here,
+// see board_host.c), so a run is the same every time. The client frames
+// go in at once, the link has no delay.
+// Each run reports what NetBenchReport() prints on the board, counted in
+// ns of the host: frames/s and the cost per frame handled, the cost per
+// page served, the retransmissions and the frames lost. Every page is
+// compared with webside.h (except the dynamic values), the IP and TCP
+// checksums of every frame the stack sends are checked.
+// Returns 0 if all pages arrived intact (the ones of the runs without
+// loss must all arrive) and a replay matched the capture.
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "tcpip.h"
+#include "checksum.h"
+#include "eth_host.h"
+
+#define WebSide ExpectedWebSide                  // the page the clients expect
+#include "webside.h"
+#undef WebSide
+
+#define MAX_CLIENTS          16
+#define CLIENT_RTO           200                 // ms until a client resends a frame
+#define CLIENT_GIVE_UP       30000               // ms until a client gives a page up
+#define CLIENT_WINDOW        8192
+#define FIRST_PORT           1024
+
+void EasyWebInit(void);                          // easyweb.c (easyweb.h defines the
+void EasyWebPoll(void);                          // server's variables, it's included there)
+
+static const unsigned char GetResponse[] =       // header the server sends (easyweb.h)
+  "HTTP/1.0 200 OK\r\n"
+  "Content-Type: text/html\r\n"
+  "\r\n";
+
+static const unsigned char Request[] = "GET / HTTP/1.0\r\n\r\n";
+
+#define PAGE_SIZE            (sizeof(GetResponse) - 1 + sizeof(ExpectedWebSide) - 1)
+
+static const unsigned char PeerMAC[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const unsigned char PeerIP[4] = { MYIP_1, MYIP_2, MYIP_3, 1 };
+static const unsigned char StackIP[4] = { MYIP_1, MYIP_2, MYIP_3, MYIP_4 };
+
+enum { CLIENT_IDLE, CLIENT_SYN_SENT, CLIENT_ESTABLISHED, CLIENT_FIN_SENT };
+
+typedef struct {                                 // a client fetching a page
+  unsigned char State;
+  unsigned char GetAcked;                        // the server ACKed the request
+  unsigned char Linger;                          // keep it open after the page (-p)
+  unsigned short Port;
+  uint32_t SndNxt;                               // our next sequence nr.
+  uint32_t RcvNxt;                               // server's next sequence nr.
+  uint32_t GetSeq;                               // sequence nr. of the request
+  unsigned long Opened;                          // TCPTime of the SYN
+  unsigned long Timer;                           // TCPTime to resend at
+  unsigned int Received;                         // bytes of the page
+  unsigned char Page[PAGE_SIZE];
+} TClient;
+
+typedef struct {                                 // results of a run
+  unsigned long Pages, Corrupt, Failed;
+  unsigned long Refused;                         // SYNs answered with a RST
+  unsigned long Resent;                          // frames the clients sent again
+  unsigned long BadChecksums;
+} TResults;
+
+static TClient Clients[MAX_CLIENTS];
+static TResults Results;
+static unsigned char Expected[PAGE_SIZE];
+static unsigned char Dynamic[PAGE_SIZE];         // 1: a byte of a dynamic value
+static unsigned char Frame[ETH_MAX_FLEN];
+static unsigned short IPId;
+static unsigned long Connections;                // opened so far
+
+static uint16_t Get16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+static uint32_t Get32(const unsigned char *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+static void Put16(unsigned char *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void Put32(unsigned char *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+// ---------------------------------------------------------------------------
+// the stack
+
+// what the board's main loop does until it would sleep
+
+static void RunStack(void)
+{
+  unsigned int i = 0;
+
+  do
+    EasyWebPoll();
+  while (TCPWorkPending() && (++i < 100));
+}
+
+static void Deliver(const unsigned char *Data, unsigned short Size)
+{
+  if (LinkSend(Data, Size))
+    RunStack();
+}
+
+static void Tick(void)
+{
+  TCPClockHandler();
+  RunStack();
+}
+
+// ---------------------------------------------------------------------------
+// frames of the clients
+
+// checksum over the TCP pseudo header and the segment, 0xFFFF if it's right
+// (the field included)
+
+static unsigned short TCPSum(const unsigned char *IP, const unsigned char *Seg, unsigned short Size)
+{
+  unsigned char Pseudo[12];
+
+  memcpy(Pseudo, IP + 12, 8);                    // source and destination IP
+  Pseudo[8] = 0;
+  Pseudo[9] = 6;
+  Put16(Pseudo + 10, Size);
+  return ChecksumFold(ChecksumPartial(Seg, Size, ChecksumPartial(Pseudo, 12, 0)));
+}
+
+// Ethernet and IP header of a datagram of 'Size' bytes from the peer to
+// the stack
+
+static void PutIPHeader(unsigned char *Data, unsigned char Protocol, unsigned short Size)
+{
+  unsigned char *IP = Data + 14;
+  unsigned short Sum;
+
+  memcpy(Data, MyMAC, 6);
+  memcpy(Data + 6, PeerMAC, 6);
+  Put16(Data + 12, 0x0800);
+
+  memset(IP, 0, 20);
+  IP[0] = 0x45;
+  Put16(IP + 2, 20 + Size);
+  Put16(IP + 4, IPId++);
+  Put16(IP + 6, 0x4000);                         // don't fragment
+  IP[8] = 64;
+  IP[9] = Protocol;
+  memcpy(IP + 12, PeerIP, 4);
+  memcpy(IP + 16, StackIP, 4);
+  Sum = ~ChecksumFold(ChecksumPartial(IP, 20, 0));
+  memcpy(IP + 10, &Sum, 2);
+}
+
+static void SendSegment(TClient *c, unsigned char Flags, uint32_t Seq, const unsigned char *Data, unsigned short Size)
+{
+  unsigned char *IP = Frame + 14, *Seg = IP + 20;
+  unsigned short HeaderSize = (Flags & TCP_CODE_SYN) ? 24 : 20;
+  unsigned short Sum;
+
+  PutIPHeader(Frame, 6, HeaderSize + Size);
+
+  memset(Seg, 0, HeaderSize);
+  Put16(Seg, c->Port);
+  Put16(Seg + 2, TCP_PORT_HTTP);
+  Put32(Seg + 4, Seq);
+  Put32(Seg + 8, (Flags & TCP_CODE_ACK) ? c->RcvNxt : 0);
+  Seg[12] = HeaderSize << 2;
+  Seg[13] = Flags;
+  Put16(Seg + 14, CLIENT_WINDOW);
+  if (HeaderSize > 20)                           // MSS option
+  {
+    Seg[20] = 2;
+    Seg[21] = 4;
+    Put16(Seg + 22, TCP_MSS_MAX);
+  }
+  if (Size)
+    memcpy(Seg + HeaderSize, Data, Size);
+  Sum = ~TCPSum(IP, Seg, HeaderSize + Size);
+  memcpy(Seg + 16, &Sum, 2);
+
+  Deliver(Frame, 14 + 20 + HeaderSize + Size);
+}
+
+static void SendSYN(TClient *c)
+{
+  SendSegment(c, TCP_CODE_SYN, c->SndNxt - 1, 0, 0);
+}
+
+static void SendRequest(TClient *c)
+{
+  SendSegment(c, TCP_CODE_ACK | TCP_CODE_PSH, c->GetSeq, Request, sizeof(Request) - 1);
+}
+
+static void SendFIN(TClient *c)
+{
+  SendSegment(c, TCP_CODE_FIN | TCP_CODE_ACK, c->SndNxt, 0, 0);
+}
+
+static void Open(TClient *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->Port = FIRST_PORT + Connections++ % 60000;
+  c->SndNxt = (uint32_t)c->Port * 0x10001 + 1;   // the ISS follows the port
+  c->GetSeq = c->SndNxt;
+  c->State = CLIENT_SYN_SENT;
+  c->Opened = TCPTime;
+  c->Timer = TCPTime + CLIENT_RTO;
+  SendSYN(c);
+}
+
+static void Finish(TClient *c)
+{
+  unsigned int i;
+
+  c->State = CLIENT_IDLE;
+  if (c->Received != PAGE_SIZE)
+  {
+    Results.Corrupt++;
+    return;
+  }
+  for (i = 0; i < PAGE_SIZE; i++)
+    if ((c->Page[i] != Expected[i]) && !Dynamic[i])
+    {
+      Results.Corrupt++;
+      return;
+    }
+  Results.Pages++;
+}
+
+static void Fail(TClient *c)
+{
+  c->State = CLIENT_IDLE;
+  Results.Failed++;
+}
+
+// a segment of the server to client 'c'
+
+static void ClientReceive(TClient *c, unsigned char Flags, uint32_t Seq, uint32_t Ack,
+                          const unsigned char *Data, unsigned short Size)
+{
+  if (Flags & TCP_CODE_RST)
+  {
+    if (c->State == CLIENT_SYN_SENT)             // all connections busy, try again
+    {
+      Results.Refused++;
+      c->Timer = TCPTime + CLIENT_RTO;
+    }
+    else if (c->State == CLIENT_FIN_SENT)        // server has closed already
+      Finish(c);
+    else
+      Fail(c);
+    return;
+  }
+  if (!(Flags & TCP_CODE_ACK)) return;
+
+  if (c->State == CLIENT_SYN_SENT)
+  {
+    if (!(Flags & TCP_CODE_SYN) || (Ack != c->SndNxt)) return;
+    c->RcvNxt = Seq + 1;
+    c->State = CLIENT_ESTABLISHED;
+    c->Timer = TCPTime + CLIENT_RTO;
+    SendRequest(c);                              // ACKs the SYN as well
+    return;
+  }
+  if (Flags & TCP_CODE_SYN)                      // our ACK of it got lost
+  {
+    SendRequest(c);
+    return;
+  }
+
+  if ((int32_t)(Ack - (c->GetSeq + sizeof(Request) - 1)) >= 0)
+    c->GetAcked = 1;
+
+  if (c->State == CLIENT_FIN_SENT)
+  {
+    if (Ack == c->SndNxt + 1)                    // our FIN ACKed
+      Finish(c);
+    else if (Flags & TCP_CODE_FIN)               // server sent its FIN again
+      SendFIN(c);
+    return;
+  }
+
+  if (Seq == c->RcvNxt)
+  {
+    if (Size)
+    {
+      if (c->Received + Size <= PAGE_SIZE)
+        memcpy(c->Page + c->Received, Data, Size);
+      c->Received += Size;
+      c->RcvNxt += Size;
+    }
+    if ((Flags & TCP_CODE_FIN) && c->Linger)     // ACK it, but don't close
+      c->RcvNxt++;
+    else if (Flags & TCP_CODE_FIN)
+    {
+      c->RcvNxt++;
+      c->SndNxt = c->GetSeq + sizeof(Request) - 1;
+      c->State = CLIENT_FIN_SENT;
+      c->Timer = TCPTime + CLIENT_RTO;
+      SendFIN(c);
+      return;
+    }
+  }
+  if (Size || (Flags & TCP_CODE_FIN))            // ACK in order data, repeat the
+    SendSegment(c, TCP_CODE_ACK, c->GetSeq + sizeof(Request) - 1, 0, 0);   // ACK otherwise
+}
+
+static void AnswerARP(const unsigned char *ARP)
+{
+  unsigned char *Answer = Frame + 14;
+
+  memcpy(Frame, ARP + 8, 6);
+  memcpy(Frame + 6, PeerMAC, 6);
+  Put16(Frame + 12, 0x0806);
+  memcpy(Answer, ARP, 6);                        // hardware and protocol type, sizes
+  Put16(Answer + 6, 2);                          // reply
+  memcpy(Answer + 8, PeerMAC, 6);
+  memcpy(Answer + 14, PeerIP, 4);
+  memcpy(Answer + 18, ARP + 8, 10);              // the sender's MAC and IP
+  Deliver(Frame, 60);
+}
+
+// a frame the stack sent
+
+static void PeerReceive(const unsigned char *Data, unsigned short Size)
+{
+  const unsigned char *IP = Data + 14, *Seg;
+  unsigned short IPSize, HeaderSize, SegSize, Port;
+  unsigned int i;
+
+  if (Size < 14 + 28) return;
+  if (Get16(Data + 12) == 0x0806)
+  {
+    if ((Get16(IP + 6) == 1) && !memcmp(IP + 24, PeerIP, 4))
+      AnswerARP(IP);
+    return;
+  }
+  if (Get16(Data + 12) != 0x0800) return;
+
+  IPSize = Get16(IP + 2);
+  HeaderSize = (IP[0] & 15) * 4;
+  if ((IPSize > Size - 14) || (HeaderSize < 20) || (IPSize < HeaderSize)) return;
+  if (ChecksumFold(ChecksumPartial(IP, HeaderSize, 0)) != 0xFFFF)
+  {
+    Results.BadChecksums++;
+    return;
+  }
+  if (IP[9] != 6) return;
+
+  Seg = IP + HeaderSize;
+  SegSize = IPSize - HeaderSize;
+  if ((SegSize < 20) || (TCPSum(IP, Seg, SegSize) != 0xFFFF))
+  {
+    Results.BadChecksums++;
+    return;
+  }
+
+  Port = Get16(Seg + 2);
+  HeaderSize = (Seg[12] >> 4) * 4;
+  for (i = 0; i < MAX_CLIENTS; i++)
+    if ((Clients[i].State != CLIENT_IDLE) && (Clients[i].Port == Port))
+    {
+      ClientReceive(&Clients[i], Seg[13], Get32(Seg + 4), Get32(Seg + 8),
+                    Seg + HeaderSize, SegSize - HeaderSize);
+      break;
+    }
+}
+
+// resends what wasn't answered in time, gives a page up after a while
+
+static void ClientTimers(void)
+{
+  TClient *c;
+
+  for (c = Clients; c < Clients + MAX_CLIENTS; c++)
+  {
+    if ((c->State == CLIENT_IDLE) || (TCPTime < c->Timer)) continue;
+
+    if (TCPTime - c->Opened > CLIENT_GIVE_UP)
+    {
+      Fail(c);
+      continue;
+    }
+    c->Timer = TCPTime + CLIENT_RTO;
+    Results.Resent++;
+    if (c->State == CLIENT_SYN_SENT)
+      SendSYN(c);
+    else
+    {
+      if (!c->GetAcked)
+        SendRequest(c);
+      if (c->State == CLIENT_FIN_SENT)
+        SendFIN(c);
+    }
+  }
+}
+
+static void DrainLink(void)
+{
+  unsigned char Data[ETH_MAX_FLEN];
+  unsigned short Size;
+
+  while ((Size = LinkReceive(Data)))
+    PeerReceive(Data, Size);
+}
+
+// ---------------------------------------------------------------------------
+// runs
+
+// the page the clients expect, and the places of the dynamic values
+// ("ADx%", see InitDynamicValues())
+
+static void InitExpected(void)
+{
+  unsigned int i;
+
+  memcpy(Expected, GetResponse, sizeof(GetResponse) - 1);
+  memcpy(Expected + sizeof(GetResponse) - 1, ExpectedWebSide, sizeof(ExpectedWebSide) - 1);
+  for (i = 0; i + 3 < PAGE_SIZE; i++)
+    if ((Expected[i] == 'A') && (Expected[i + 1] == 'D') && (Expected[i + 3] == '%') &&
+        strchr("871", Expected[i + 2]))
+      memset(Dynamic + i, 1, 4);
+}
+
+static unsigned long PerUnit(unsigned long Value, unsigned long Units)
+{
+  return Units ? Value / Units : 0;
+}
+
+// 'Pages' pages fetched by 'Concurrent' clients at a time, every
+// 'LoseEvery'th frame lost. returns 0 if it passed
+
+static int Run(unsigned long Pages, unsigned int Concurrent, unsigned int LoseEvery)
+{
+  TLinkStats Link = *LinkGetStats();
+  unsigned long Dropped = GetErrors_EthMAC()->TxDropped;
+  unsigned long Start = TCPTime, Wall, Ms, Frames;
+  unsigned int i, Busy;
+  TClient *c;
+
+  memset(&Results, 0, sizeof(Results));
+  memset(&NetStats, 0, sizeof(NetStats));
+  LinkSetLoss(LoseEvery, LoseEvery);
+  Wall = Get_CycleCounter();
+
+  for (;;)
+  {
+    for (Busy = 0, i = 0; i < Concurrent; i++)   // clients fetching a page
+      Busy += (Clients[i].State != CLIENT_IDLE);
+
+    for (c = Clients; c < Clients + Concurrent; c++)
+      if ((c->State == CLIENT_IDLE) && (Results.Pages + Results.Corrupt + Results.Failed + Busy < Pages))
+      {
+        Busy++;
+        Open(c);
+        DrainLink();
+      }
+    if (!Busy) break;
+    Tick();
+    DrainLink();
+    ClientTimers();
+    DrainLink();
+  }
+
+  Wall = Get_CycleCounter() - Wall;
+  Ms = TCPTime - Start;
+  Frames = LinkGetStats()->ToStack - Link.ToStack + LinkGetStats()->ToPeer - Link.ToPeer;
+  LinkSetLoss(0, 0);
+
+  if (LoseEvery)
+    printf("%lu pages to %u clients, every %u. frame lost: ", Pages, Concurrent, LoseEvery);
+  else
+    printf("%lu pages to %u clients, no loss: ", Pages, Concurrent);
+  printf("%lu ok, %lu corrupt, %lu failed, %lu ms (%lu ms/page)\n",
+         Results.Pages, Results.Corrupt, Results.Failed, Ms, PerUnit(Ms, Pages));
+  printf("  stack: %lu frames, %lu ns/frame (max. %lu frames/s), %lu ns/page, %lu ns/page incl. frames\n",
+         NetStats.RxFrames, PerUnit(NetStats.RxCycles, NetStats.RxFrames),
+         NetStats.RxCycles ? (unsigned long)(1000000000ULL * NetStats.RxFrames / NetStats.RxCycles) : 0,
+         PerUnit(NetStats.PageCycles, NetStats.Pages),
+         PerUnit(NetStats.RxCycles + NetStats.PageCycles, NetStats.Pages));
+  printf("  link: %lu frames/s (wall clock), %lu retransmissions, %lu timeouts, %lu sent / %lu received frames lost\n",
+         Wall ? (unsigned long)(1000000000ULL * Frames / Wall) : 0,
+         NetStats.Retransmissions, NetStats.Timeouts,
+         GetErrors_EthMAC()->TxDropped - Dropped, LinkGetStats()->Lost - Link.Lost);
+  printf("  clients: %lu frames resent, %lu SYNs refused, %lu bad checksums\n",
+         Results.Resent, Results.Refused, Results.BadChecksums);
+
+  return Results.Corrupt || Results.BadChecksums || (!LoseEvery && Results.Failed);
+}
+
+// throws the frames the stack sent away, returns how many
+
+static unsigned long DrainAnswers(void)
+{
+  unsigned char Answer[ETH_MAX_FLEN];
+  unsigned long Answers = 0;
+
+  while (LinkReceive(Answer))
+    Answers++;
+  return Answers;
+}
+
+// delivers 'Count' copies of a frame, returns the frames the stack sent
+// back
+
+static unsigned long Flood(const unsigned char *Data, unsigned short Size, unsigned long Count)
+{
+  unsigned long Answers = 0;
+
+  while (Count--)
+  {
+    Deliver(Data, Size);
+    Answers += DrainAnswers();
+  }
+  return Answers;
+}
+
+static void ParseResult(const char *Kind, unsigned long Answers)
+{
+  printf("  %-28s %5lu ns/frame, %lu answers\n", Kind, PerUnit(NetStats.RxCycles, NetStats.RxFrames), Answers);
+  memset(&NetStats, 0, sizeof(NetStats));
+}
+
+// the time DoNetworkStuff() takes for a frame (parsing it in place, and
+// its answer if any), for each kind of frame. returns 0 if the stack
+// answered the ones it should
+
+static int Parse(unsigned long Count)
+{
+  static const unsigned char Data[64] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+  unsigned char ARP[60], Ping[14 + 20 + 8 + 32], UDP[14 + 20 + 8 + 18], Other[60];
+  unsigned char *p;
+  unsigned short Sum;
+  unsigned long i, Answers, Failed = 0;
+  uint32_t Seq;
+  TClient *c = &Clients[0], Stray;
+
+  memset(ARP, 0, sizeof(ARP));                   // who has the stack's IP?
+  memset(ARP, 0xFF, 6);
+  memcpy(ARP + 6, PeerMAC, 6);
+  Put16(ARP + 12, 0x0806);
+  p = ARP + 14;
+  Put16(p, 1);                                   // Ethernet
+  Put16(p + 2, 0x0800);                          // IP
+  p[4] = 6;
+  p[5] = 4;
+  Put16(p + 6, 1);                               // request
+  memcpy(p + 8, PeerMAC, 6);
+  memcpy(p + 14, PeerIP, 4);
+  memcpy(p + 24, StackIP, 4);
+
+  PutIPHeader(Ping, 1, sizeof(Ping) - 34);       // echo request, 32 bytes
+  p = Ping + 34;
+  memset(p, 0, 8);
+  p[0] = 8;
+  Put16(p + 4, 1);
+  memcpy(p + 8, Data, 32);
+  Sum = ~ChecksumFold(ChecksumPartial(p, sizeof(Ping) - 34, 0));
+  memcpy(p + 2, &Sum, 2);
+
+  PutIPHeader(UDP, 17, sizeof(UDP) - 34);        // to the discard port, no checksum
+  p = UDP + 34;
+  Put16(p, 1024);
+  Put16(p + 2, 9);
+  Put16(p + 4, sizeof(UDP) - 34);
+  Put16(p + 6, 0);
+  memcpy(p + 8, Data, sizeof(UDP) - 42);
+
+  memcpy(Other, MyMAC, 6);                       // IPv6
+  memcpy(Other + 6, PeerMAC, 6);
+  Put16(Other + 12, 0x86DD);
+  memset(Other + 14, 0, sizeof(Other) - 14);
+
+  Open(c);                                       // a connection the page was
+  c->Linger = 1;                                 // sent on, still open
+  DrainLink();
+  if ((c->State != CLIENT_ESTABLISHED) || (c->Received != PAGE_SIZE))
+  {
+    printf("FAILED: no connection to send segments on\n");
+    return 1;
+  }
+
+  memset(&Stray, 0, sizeof(Stray));              // a client the stack doesn't know
+  Stray.Port = FIRST_PORT - 1;
+
+  printf("parse: %lu frames of each kind, DoNetworkStuff() incl. the answers\n", Count);
+  memset(&NetStats, 0, sizeof(NetStats));
+
+  Answers = Flood(ARP, sizeof(ARP), Count);
+  Failed |= Answers != Count;
+  ParseResult("ARP request", Answers);
+
+  Answers = Flood(Ping, sizeof(Ping), Count);
+  Failed |= Answers != Count;
+  ParseResult("ICMP echo request", Answers);
+
+  Seq = c->GetSeq + sizeof(Request) - 1;
+  for (Answers = 0, i = 0; i < Count; i++, Seq += sizeof(Data))
+  {
+    SendSegment(c, TCP_CODE_ACK | TCP_CODE_PSH, Seq, Data, sizeof(Data));
+    Answers += DrainAnswers();
+  }
+  Failed |= Answers != Count;
+  ParseResult("TCP data, connection", Answers);
+
+  for (Answers = 0, i = 0; i < Count; i++)
+  {
+    SendSegment(&Stray, TCP_CODE_ACK, i, 0, 0);
+    Answers += DrainAnswers();
+  }
+  Failed |= Answers != Count;
+  ParseResult("TCP ACK, no connection (RST)", Answers);
+
+  Answers = Flood(UDP, sizeof(UDP), Count);
+  Failed |= Answers != 0;
+  ParseResult("UDP, no socket", Answers);
+
+  Answers = Flood(Other, sizeof(Other), Count);
+  Failed |= Answers != 0;
+  ParseResult("IPv6 (other protocol)", Answers);
+
+  for (i = 0; i < Count; i++)                    // what BENCH_START() / BENCH_STOP()
+  {                                              // add to each frame
+    BENCH_START();
+    BENCH_STOP(RxCycles);
+  }
+  printf("  (reading the clock takes %lu ns of each)\n", PerUnit(NetStats.RxCycles, Count));
+
+  printf("%s\n", Failed ? "FAILED: answers missing" : "ok");
+  return Failed;
+}
+
+// feeds the client frames of a capture to the stack at the times recorded
+// and compares what it sends with the stack's frames recorded. the frames
+// the stack lost in the run recorded aren't in the capture, 'LoseEvery'
+// drops them again
+
+static int Replay(const char *File, unsigned int LoseEvery)
+{
+  FILE *f = PcapOpen(File);
+  unsigned char Data[ETH_FRAG_SIZE], Sent[ETH_MAX_FLEN];
+  unsigned long Ms, In = 0, Out = 0, Differ = 0, Missing = 0, Extra = 0, First = 0;
+  unsigned short Size, SentSize;
+
+  if (!f) return 1;
+  memset(&NetStats, 0, sizeof(NetStats));
+  LinkSetLoss(LoseEvery, 0);
+
+  while ((Size = PcapRead(f, Data, &Ms)))
+  {
+    while (TCPTime < Ms)
+      Tick();
+
+    if (memcmp(Data + 6, MyMAC, 6))              // a client's frame
+    {
+      In++;
+      Deliver(Data, Size);
+      continue;
+    }
+
+    Out++;
+    if (!(SentSize = LinkReceive(Sent)))
+      Missing++;
+    else if ((SentSize != Size) || memcmp(Sent, Data, Size))
+      Differ++;
+    else
+      continue;
+    if (!First) First = In + Out;
+  }
+  fclose(f);
+  while (LinkReceive(Sent))
+    Extra++;
+
+  printf("replay %s: %lu frames in, %lu out, %lu ms\n", File, In, Out, TCPTime);
+  printf("  stack: %lu ns/frame, %lu pages, %lu ns/page, %lu retransmissions\n",
+         PerUnit(NetStats.RxCycles, NetStats.RxFrames), NetStats.Pages,
+         PerUnit(NetStats.PageCycles, NetStats.Pages), NetStats.Retransmissions);
+  printf("%s: %lu differ, %lu missing, %lu extra", (Differ || Missing || Extra) ? "FAILED" : "ok",
+         Differ, Missing, Extra);
+  if (First)
+    printf(" (first at frame %lu)", First);
+  printf("\n");
+
+  return Differ || Missing || Extra;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long Pages = 1000;
+  unsigned int Concurrent = 4, LoseEvery = 0;
+  const char *Record = 0, *Capture = 0;
+  unsigned long ParseFrames = 0;
+  int i, Single = 0, Failed = 0;
+
+  for (i = 1; i + 1 < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n")) Pages = strtoul(argv[++i], 0, 0);
+    else if (!strcmp(argv[i], "-c")) Concurrent = strtoul(argv[++i], 0, 0);
+    else if (!strcmp(argv[i], "-l")) LoseEvery = strtoul(argv[++i], 0, 0);
+    else if (!strcmp(argv[i], "-w")) Record = argv[++i];
+    else if (!strcmp(argv[i], "-r")) Capture = argv[++i];
+    else if (!strcmp(argv[i], "-p")) ParseFrames = strtoul(argv[++i], 0, 0);
+    else break;
+    Single = 1;
+  }
+  if ((i < argc) || !Concurrent || (Concurrent > MAX_CLIENTS))
+  {
+    fprintf(stderr, "usage: easyweb_bench [-n pages] [-c clients (1..%d)] [-l lose-every] [-w file.pcap]\n"
+                    "       easyweb_bench -p frames\n"
+                    "       easyweb_bench -r file.pcap [-l lose-every]\n", MAX_CLIENTS);
+    return 2;
+  }
+
+  InitExpected();
+  EasyWebInit();
+  if (Capture)
+    return Replay(Capture, LoseEvery);
+  if (ParseFrames)
+    return Parse(ParseFrames);
+
+  if (Record && !LinkRecord(Record))
+  {
+    perror(Record);
+    return 2;
+  }
+
+  if (Single)
+    Failed = Run(Pages, Concurrent, LoseEvery);
+  else
+  {
+    Failed |= Run(Pages, Concurrent, 0);
+    Failed |= Run(Pages, Concurrent, 100);
+    Failed |= Run(Pages, Concurrent, 20);
+    Failed |= Run(Pages, Concurrent, 10);
+  }
+  LinkStopRecording();
+
+  printf("%s\n", Failed ? "FAILED" : "ok");
+  return Failed;
+}
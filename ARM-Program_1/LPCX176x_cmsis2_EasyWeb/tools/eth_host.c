@@ -0,0 +1,361 @@
+//*****************************************************************************
+// eth_host.c - host backend of the easyWEB ethernet driver (src/ethmac.h)
+//
+// Takes the place of src/ethmac.c in the host build (see Makefile): the
+// stack runs unchanged on Linux, its frames go over an in-memory link to a
+// peer instead of the EMAC. The AHB SRAM is the array 'EthRAM', laid out
+// like on the board (easyweb.c defines it, see src/ethmac.h), so the RX
+// frames are parsed in place in RX_BUF(i) and the TxFrame1s and the page
+// copy live behind the EMAC buffers.
+//
+// RX: the peer's frames go into the RX ring (NUM_RX_FRAG buffers, one
+//     stays unused like with the EMAC). a frame that finds the ring full
+//     is dropped, as the EMAC does when it runs out of descriptors.
+// TX: a frame is gathered from its fragments and queued for the peer at
+//     once, so the TX descriptors are free again right away. The queue
+//     (LINK_QUEUE_SIZE frames) plays the busy EMAC: Rdy4Tx() fails while
+//     it's full.
+// Loss: LinkSetLoss() drops every n'th frame of a direction, the stack's
+//     ones counted as TxDropped (like ETH_TX_DROP_EVERY).
+// Timestamps of the recorded frames are the stack's TCPTime (ms).
+//*****************************************************************************
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ethmac.h"
+#include "tcpip.h"                               // TCPTime
+#include "eth_host.h"
+
+static unsigned short RxSize[NUM_RX_FRAG];       // length of the frame in RX_BUF(i)
+static unsigned int RxProduce, RxConsume;
+static unsigned int TxIndex;                     // TX_BUF() of the next frame
+
+typedef struct {
+  unsigned short Size;
+  unsigned char Data[ETH_MAX_FLEN];
+} TLinkFrame;
+
+static TLinkFrame ToPeer[LINK_QUEUE_SIZE];
+static unsigned int ToPeerHead, ToPeerTail;
+
+static unsigned char Events;                     // bit n: ETH_EVENT n pending
+static TEthErrors Errors;
+static unsigned int StackDropEvery, PeerDropEvery;
+static unsigned int StackCount, PeerCount;       // frames since the last one dropped
+static TLinkStats Stats;
+static FILE *Record;
+static int PcapSwap, PcapNano;                   // format of the file PcapRead() reads
+
+static void PutEvent(unsigned char Event)
+{
+  Events |= 1 << Event;
+}
+
+static void Put32(FILE *f, uint32_t v)
+{
+  fwrite(&v, 4, 1, f);                           // in the host's byte order, the
+}                                                // magic nr. tells readers which
+
+static void RecordFrame(const unsigned char *Frame, unsigned short Size)
+{
+  if (!Record) return;
+  Put32(Record, TCPTime / 1000);
+  Put32(Record, TCPTime % 1000 * 1000);
+  Put32(Record, Size);
+  Put32(Record, Size);
+  fwrite(Frame, 1, Size, Record);
+}
+
+// returns 1 if the frame is to be dropped
+
+static unsigned int Drop(unsigned int *Count, unsigned int Every)
+{
+  if (!Every || (++*Count < Every))
+    return 0;
+  *Count = 0;
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+// driver interface (src/ethmac.h), the stack's end of the link
+
+void Init_EthMAC(void)
+{
+  RxProduce = RxConsume = 0;
+  TxIndex = 0;
+  ToPeerHead = ToPeerTail = 0;
+  Events = 0;
+  StackCount = PeerCount = 0;
+  memset(&Errors, 0, sizeof(Errors));
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+unsigned char *GetTxBuffer_EthMAC(void)
+{
+  if (!Rdy4Tx())
+    return 0;
+
+  return (unsigned char *)TX_BUF(TxIndex);
+}
+
+void SendTxBuffer_EthMAC(unsigned short FrameSize)
+{
+  SendFrame_EthMAC((void *)TX_BUF(TxIndex), FrameSize);
+}
+
+void SendFrame_EthMAC(void *Frame, unsigned short FrameSize)
+{
+  TTxFragment Fragment;
+
+  Fragment.Data = Frame;
+  Fragment.Size = FrameSize;
+  SendFragments_EthMAC(&Fragment, 1);
+}
+
+void SendFragments_EthMAC(const TTxFragment *Fragment, unsigned int Count)
+{
+  TLinkFrame *Out = &ToPeer[ToPeerHead];
+
+  if (Drop(&StackCount, StackDropEvery))
+  {
+    Errors.TxDropped++;
+    return;
+  }
+
+  Out->Size = 0;
+  while (Count--)
+  {
+    if (Out->Size + Fragment->Size <= ETH_MAX_FLEN)
+      memcpy(Out->Data + Out->Size, Fragment->Data, Fragment->Size);
+    Out->Size += Fragment->Size;
+    Fragment++;
+    TxIndex = (TxIndex + 1) % NUM_TX_FRAG;       // a descriptor per fragment
+  }
+  if (Out->Size > ETH_MAX_FLEN)                  // too long, the EMAC would
+  {                                              // report an error
+    Errors.TxError++;
+    PutEvent(ETH_EVENT_ERROR);
+    return;
+  }
+
+  RecordFrame(Out->Data, Out->Size);
+  ToPeerHead = (ToPeerHead + 1) % LINK_QUEUE_SIZE;
+  PutEvent(ETH_EVENT_TX);
+}
+
+unsigned int Rdy4Tx(void)
+{
+  return Rdy4TxFragments(1);
+}
+
+unsigned int Rdy4TxFragments(unsigned int Count)
+{
+  if (Count >= NUM_TX_FRAG)
+    return 0;
+  return (ToPeerHead + 1) % LINK_QUEUE_SIZE != ToPeerTail;
+}
+
+unsigned short StartReadingFrame(void)
+{
+  return RxSize[RxConsume];
+}
+
+unsigned char *GetRxFrame_EthMAC(void)
+{
+  return (unsigned char *)RX_BUF(RxConsume);
+}
+
+void StopReadingFrame(void)
+{
+  RxConsume = (RxConsume + 1) % NUM_RX_FRAG;
+}
+
+unsigned int CheckIfFrameReceived(void)
+{
+  return RxProduce != RxConsume;
+}
+
+unsigned int RxFrameCount_EthMAC(void)
+{
+  return (RxProduce + NUM_RX_FRAG - RxConsume) % NUM_RX_FRAG;
+}
+
+unsigned int RxOverrun_EthMAC(void)
+{
+  return 0;                                      // a full ring just drops frames here
+}
+
+void ResetRx_EthMAC(void)
+{
+  RxProduce = RxConsume = 0;
+}
+
+unsigned char GetEvent_EthMAC(void)
+{
+  unsigned char Event;
+
+  for (Event = ETH_EVENT_RX; Event <= ETH_EVENT_ERROR; Event++)
+    if (Events & (1 << Event))
+    {
+      Events &= ~(1 << Event);
+      return Event;
+    }
+  return ETH_EVENT_NONE;
+}
+
+unsigned int EventPending_EthMAC(void)
+{
+  return Events != 0;
+}
+
+const volatile TEthErrors *GetErrors_EthMAC(void)
+{
+  return &Errors;
+}
+
+// ---------------------------------------------------------------------------
+// peer's end of the link
+
+// hands a frame to the stack. returns 0 if it's lost on the way
+// (LinkSetLoss()) or finds the RX ring full
+
+unsigned int LinkSend(const unsigned char *Frame, unsigned short Size)
+{
+  if (Drop(&PeerCount, PeerDropEvery))
+  {
+    Stats.Lost++;
+    return 0;
+  }
+  if ((RxProduce + 1) % NUM_RX_FRAG == RxConsume)
+  {
+    Stats.Overruns++;
+    return 0;
+  }
+  if (Size > ETH_FRAG_SIZE) Size = ETH_FRAG_SIZE;
+
+  RecordFrame(Frame, Size);
+  memcpy((unsigned char *)RX_BUF(RxProduce), Frame, Size);
+  RxSize[RxProduce] = Size;
+  RxProduce = (RxProduce + 1) % NUM_RX_FRAG;
+  Stats.ToStack++;
+  PutEvent(ETH_EVENT_RX);
+  return 1;
+}
+
+// takes the oldest frame the stack sent, returns its size (0: none)
+
+unsigned short LinkReceive(unsigned char *Frame)
+{
+  unsigned short Size;
+
+  if (ToPeerTail == ToPeerHead)
+    return 0;
+  Size = ToPeer[ToPeerTail].Size;
+  memcpy(Frame, ToPeer[ToPeerTail].Data, Size);
+  ToPeerTail = (ToPeerTail + 1) % LINK_QUEUE_SIZE;
+  Stats.ToPeer++;
+  return Size;
+}
+
+// drops every 'StackEvery'th frame the stack sends and every 'PeerEvery'th
+// one the peer sends, 0 none
+
+void LinkSetLoss(unsigned int StackEvery, unsigned int PeerEvery)
+{
+  StackDropEvery = StackEvery;
+  PeerDropEvery = PeerEvery;
+  StackCount = PeerCount = 0;
+}
+
+const TLinkStats *LinkGetStats(void)
+{
+  return &Stats;
+}
+
+// writes the frames crossing the link from now on into a pcap file
+// (the frames dropped aren't in it). returns 0 if it can't be created
+
+int LinkRecord(const char *File)
+{
+  LinkStopRecording();
+  Record = fopen(File, "wb");
+  if (!Record) return 0;
+
+  Put32(Record, 0xA1B2C3D4);                     // magic, us timestamps
+  Put32(Record, 2 | 4 << 16);                    // version 2.4
+  Put32(Record, 0);                              // GMT
+  Put32(Record, 0);                              // accuracy
+  Put32(Record, 65535);                          // snap length
+  Put32(Record, 1);                              // Ethernet
+  return 1;
+}
+
+void LinkStopRecording(void)
+{
+  if (Record) fclose(Record);
+  Record = 0;
+}
+
+// ---------------------------------------------------------------------------
+// pcap files
+
+static uint32_t Get32(const unsigned char *p)
+{
+  return PcapSwap ? (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0]
+                  : (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// opens a capture for PcapRead(), 0 if it isn't one of Ethernet frames
+
+FILE *PcapOpen(const char *File)
+{
+  FILE *f = fopen(File, "rb");
+  unsigned char Head[24];
+  uint32_t Magic;
+
+  if (!f) { perror(File); return 0; }
+  if (fread(Head, 1, 24, f) != 24) { fprintf(stderr, "%s: no pcap header\n", File); fclose(f); return 0; }
+
+  PcapSwap = 0;
+  Magic = Get32(Head);
+  PcapSwap = (Magic == 0xD4C3B2A1) || (Magic == 0x4D3CB2A1);   // little endian file
+  PcapNano = (Magic == 0xA1B23C4D) || (Magic == 0x4D3CB2A1);
+  if (!PcapSwap && (Magic != 0xA1B2C3D4) && !PcapNano)
+  {
+    fprintf(stderr, "%s: not a pcap file\n", File);
+    fclose(f);
+    return 0;
+  }
+  if (Get32(Head + 20) != 1)
+  {
+    fprintf(stderr, "%s: not an Ethernet capture\n", File);
+    fclose(f);
+    return 0;
+  }
+  return f;
+}
+
+// reads the next frame (up to ETH_FRAG_SIZE bytes) and its time in ms,
+// returns its size, 0 at the end of the file
+
+unsigned short PcapRead(FILE *f, unsigned char *Frame, unsigned long *Ms)
+{
+  unsigned char Rec[16], Skip[256];
+  uint32_t Caplen, Size, n;
+
+  while (fread(Rec, 1, 16, f) == 16)
+  {
+    Caplen = Get32(Rec + 8);
+    Size = (Caplen > ETH_FRAG_SIZE) ? ETH_FRAG_SIZE : Caplen;
+    if (fread(Frame, 1, Size, f) != Size) break;
+    for (Caplen -= Size; Caplen; Caplen -= n)    // rest of a jumbo frame
+      if (!(n = fread(Skip, 1, (Caplen > sizeof(Skip)) ? sizeof(Skip) : Caplen, f))) return 0;
+    if (Size < ETH_HEADER_SIZE) continue;
+
+    *Ms = Get32(Rec) * 1000UL + Get32(Rec + 4) / (PcapNano ? 1000000 : 1000);
+    return Size;
+  }
+  return 0;
+}
@@ -0,0 +1,37 @@
+//*****************************************************************************
+// eth_host.h - host backend of the easyWEB ethernet driver
+//
+// eth_host.c implements the driver interface of src/ethmac.h on Linux, as
+// one end of an in-memory link. The other end (the peer, e.g. the clients
+// of easyweb_bench.c) sends and receives frames with the functions below.
+// Frames crossing the link can be recorded into a pcap file, and a pcap
+// file read back to replay it.
+//*****************************************************************************
+
+#ifndef __ETH_HOST_H
+#define __ETH_HOST_H
+
+#include <stdio.h>
+
+#define LINK_QUEUE_SIZE      64                  // frames in flight to the peer
+
+typedef struct {
+  unsigned long ToStack;                         // frames the stack got from the peer
+  unsigned long ToPeer;                          // frames the peer got from the stack
+  unsigned long Lost;                            // peer's frames dropped (LinkSetLoss())
+  unsigned long Overruns;                        // peer's frames dropped, RX ring full
+} TLinkStats;
+
+// peer's end of the link
+unsigned int LinkSend(const unsigned char *Frame, unsigned short Size);
+unsigned short LinkReceive(unsigned char *Frame);
+void LinkSetLoss(unsigned int StackEvery, unsigned int PeerEvery);
+const TLinkStats *LinkGetStats(void);
+int LinkRecord(const char *File);
+void LinkStopRecording(void);
+
+// pcap files (Ethernet, timestamps in ms)
+FILE *PcapOpen(const char *File);
+unsigned short PcapRead(FILE *f, unsigned char *Frame, unsigned long *Ms);
+
+#endif
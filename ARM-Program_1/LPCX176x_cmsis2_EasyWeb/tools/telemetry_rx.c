@@ -0,0 +1,278 @@
+//*****************************************************************************
+// telemetry_rx.c - host receiver for the easyWEB telemetry publisher
+//
+// Counts the batches the board sends (see src/telemetry.h), and reports
+// the datagrams lost (gaps in the sequence nr.), the samples and the
+// throughput. Runs on Linux, it's not part of the firmware build:
+//
+//   gcc -O2 -Wall -o telemetry_rx telemetry_rx.c
+//
+//   telemetry_rx <board-ip> [period-ms] [count] [seconds]
+//       subscribes, receives for 'seconds' (default 10), unsubscribes
+//   telemetry_rx -r <file.pcap>
+//       evaluates a capture (e.g. "tcpdump -w file.pcap udp port 5005")
+//   telemetry_rx -e [drop-every]
+//       emulates the board on UDP port 5005, for testing the receiver
+//       without hardware ("telemetry_rx 127.0.0.1" in a second shell).
+//       each 'drop-every'th batch isn't sent, to check the loss count
+//*****************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TELEMETRY_PORT        5005
+#define TELEMETRY_HEADER_SIZE 12
+#define TELEMETRY_MAX_SAMPLES 730                // (1472 - 12) / 2
+
+typedef struct {
+  uint32_t Expected;                             // next sequence nr.
+  uint64_t Batches, Lost, Late, Samples, Bytes;
+  double First, Last;                            // s, arrival of the first / last batch
+  int Started;
+} TStats;
+
+static uint32_t Get32(const uint8_t *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+static uint16_t Get16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+static void Put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+static void Put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+
+static double Now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// counts one batch of 'Size' bytes (UDP payload) that arrived at 'Time'
+
+static void Count(TStats *s, const uint8_t *Data, size_t Size, double Time)
+{
+  uint32_t Seq;
+  uint16_t Samples;
+
+  if (Size < TELEMETRY_HEADER_SIZE) return;
+  Seq = Get32(Data);
+  Samples = Get16(Data + 10);
+  if (TELEMETRY_HEADER_SIZE + 2u * Samples > Size) return;   // truncated
+
+  if (!s->Started)
+  {
+    s->Started = 1;
+    s->First = Time;
+    s->Expected = Seq;
+  }
+
+  if ((int32_t)(Seq - s->Expected) >= 0)
+  {
+    s->Lost += Seq - s->Expected;                // gap: the batches in between are lost
+    s->Expected = Seq + 1;
+  }
+  else
+  {
+    s->Late++;                                   // counted as lost before
+    if (s->Lost) s->Lost--;
+  }
+
+  s->Batches++;
+  s->Samples += Samples;
+  s->Bytes += Size;
+  s->Last = Time;
+}
+
+static void Report(const TStats *s)
+{
+  double Secs = s->Last - s->First;
+  uint64_t Sent = s->Batches + s->Lost;
+
+  printf("batches %llu  lost %llu (%.3f %%)  late %llu  samples %llu",
+         (unsigned long long)s->Batches, (unsigned long long)s->Lost,
+         Sent ? 100.0 * s->Lost / Sent : 0.0, (unsigned long long)s->Late,
+         (unsigned long long)s->Samples);
+  if (Secs > 0)
+    printf("  %.1f samples/s  %.1f kbit/s", s->Samples / Secs, s->Bytes * 8 / Secs / 1000);
+  printf("\n");
+}
+
+// subscribes at the board, counts the batches for 'Seconds' and
+// unsubscribes (period 0)
+
+static int Receive(const char *Board, int Period, int Samples, int Seconds)
+{
+  struct sockaddr_in Addr;
+  struct timeval Timeout = { 0, 200000 };
+  uint8_t Buf[1500], Req[4];
+  TStats s = { 0 };
+  double End, NextReport;
+  ssize_t n;
+  int Sock;
+
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(TELEMETRY_PORT);
+  if (!inet_aton(Board, &Addr.sin_addr)) { fprintf(stderr, "bad IP %s\n", Board); return 1; }
+
+  Sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (Sock < 0) { perror("socket"); return 1; }
+  setsockopt(Sock, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+  n = 4 * 1024 * 1024;                           // bursts must not overflow the socket
+  setsockopt(Sock, SOL_SOCKET, SO_RCVBUF, &n, sizeof(int));
+
+  Put16(Req, Period);
+  Put16(Req + 2, Samples);
+  if (sendto(Sock, Req, 4, 0, (struct sockaddr *)&Addr, sizeof(Addr)) < 0) { perror("sendto"); return 1; }
+
+  End = Now() + Seconds;
+  NextReport = Now() + 1;
+  while (Now() < End)
+  {
+    n = recv(Sock, Buf, sizeof(Buf), 0);
+    if (n > 0)
+      Count(&s, Buf, n, Now());
+    if (Now() >= NextReport)
+    {
+      Report(&s);
+      NextReport += 1;
+    }
+  }
+
+  Put16(Req, 0);                                 // stop publishing
+  sendto(Sock, Req, 4, 0, (struct sockaddr *)&Addr, sizeof(Addr));
+  close(Sock);
+
+  Report(&s);
+  return 0;
+}
+
+// evaluates the batches from port TELEMETRY_PORT in a pcap capture
+// (Ethernet, IPv4, no fragments), using the capture's timestamps
+
+static int ReadPcap(const char *File)
+{
+  FILE *f = fopen(File, "rb");
+  uint8_t Head[24], Rec[16], Frame[65536];
+  uint32_t Len, Caplen, Magic;
+  int Swap, Nano, Ihl;
+  TStats s = { 0 };
+  const uint8_t *Ip, *Udp;
+
+  if (!f) { perror(File); return 1; }
+  if (fread(Head, 1, 24, f) != 24) { fprintf(stderr, "%s: no pcap header\n", File); return 1; }
+
+  Magic = Get32(Head);
+  Swap = (Magic == 0xD4C3B2A1) || (Magic == 0x4D3CB2A1);   // little endian file
+  Nano = (Magic == 0xA1B23C4D) || (Magic == 0x4D3CB2A1);
+  if (!Swap && (Magic != 0xA1B2C3D4) && !Nano) { fprintf(stderr, "%s: not a pcap file\n", File); return 1; }
+
+#define FILE32(p) (Swap ? (uint32_t)(p)[3] << 24 | (p)[2] << 16 | (p)[1] << 8 | (p)[0] : Get32(p))
+
+  if (FILE32(Head + 20) != 1) { fprintf(stderr, "%s: not an Ethernet capture\n", File); return 1; }
+
+  while (fread(Rec, 1, 16, f) == 16)
+  {
+    Caplen = FILE32(Rec + 8);
+    Len = FILE32(Rec + 12);
+    if ((Caplen > sizeof(Frame)) || (fread(Frame, 1, Caplen, f) != Caplen)) break;
+    if ((Caplen < Len) || (Caplen < 14 + 20 + 8)) continue;   // truncated
+
+    if (Get16(Frame + 12) != 0x0800) continue;   // IPv4
+    Ip = Frame + 14;
+    Ihl = (Ip[0] & 0x0F) * 4;
+    if ((Ip[9] != 17) || (Caplen < 14u + Ihl + 8)) continue;  // UDP
+    Udp = Ip + Ihl;
+    if (Get16(Udp) != TELEMETRY_PORT) continue;  // from the board
+    if (Get16(Udp + 4) < 8 || 14u + Ihl + Get16(Udp + 4) > Caplen) continue;
+
+    Count(&s, Udp + 8, Get16(Udp + 4) - 8,
+          FILE32(Rec) + FILE32(Rec + 4) / (Nano ? 1e9 : 1e6));
+  }
+  fclose(f);
+
+  Report(&s);
+  return 0;
+}
+
+// answers subscribes like the board does, with a saw tooth as samples
+
+static int Emulate(int DropEvery)
+{
+  struct sockaddr_in Addr, Sub;
+  socklen_t SubLen = sizeof(Sub);
+  struct timeval Timeout = { 0, 1000 };
+  uint8_t Buf[TELEMETRY_HEADER_SIZE + 2 * TELEMETRY_MAX_SAMPLES], Req[16];
+  uint32_t Seq = 0, Ms, Next = 0;
+  int Period = 0, Samples = 0, Fill = 0, Subscribed = 0;
+  double Start = Now();
+  ssize_t n;
+  int Sock;
+
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons(TELEMETRY_PORT);
+  Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  Sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if ((Sock < 0) || bind(Sock, (struct sockaddr *)&Addr, sizeof(Addr))) { perror("bind"); return 1; }
+  setsockopt(Sock, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+  printf("emulating the board on 127.0.0.1:%d\n", TELEMETRY_PORT);
+
+  while (1)
+  {
+    n = recvfrom(Sock, Req, sizeof(Req), 0, (struct sockaddr *)&Addr, &(socklen_t){ sizeof(Addr) });
+    Ms = (uint32_t)((Now() - Start) * 1000);
+    if (n >= 2)
+    {
+      Sub = Addr;
+      Period = Get16(Req);
+      Samples = (n >= 4) ? Get16(Req + 2) : 0;
+      if (!Samples || (Samples > TELEMETRY_MAX_SAMPLES)) Samples = TELEMETRY_MAX_SAMPLES;
+      Subscribed = Period != 0;
+      Fill = 0;
+      Next = Ms;
+      printf(Subscribed ? "subscribed: %d ms, %d samples\n" : "stopped\n", Period, Samples);
+    }
+
+    while (Subscribed && ((int32_t)(Ms - Next) >= 0))
+    {
+      if (!Fill) Put32(Buf + 4, Next);
+      Put16(Buf + TELEMETRY_HEADER_SIZE + 2 * Fill, Next % 1024);
+      Fill++;
+      Next += Period;
+
+      if (Fill == Samples)
+      {
+        Put32(Buf, Seq);
+        Put16(Buf + 8, Period);
+        Put16(Buf + 10, Fill);
+        if (!DropEvery || ((Seq + 1) % DropEvery))
+          sendto(Sock, Buf, TELEMETRY_HEADER_SIZE + 2 * Fill, 0, (struct sockaddr *)&Sub, SubLen);
+        Seq++;
+        Fill = 0;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if ((argc == 3) && !strcmp(argv[1], "-r"))
+    return ReadPcap(argv[2]);
+  if ((argc >= 2) && !strcmp(argv[1], "-e"))
+    return Emulate((argc > 2) ? atoi(argv[2]) : 0);
+  if ((argc >= 2) && (argv[1][0] != '-'))
+    return Receive(argv[1], (argc > 2) ? atoi(argv[2]) : 1, (argc > 3) ? atoi(argv[3]) : 0,
+                   (argc > 4) ? atoi(argv[4]) : 10);
+
+  fprintf(stderr, "usage: %s <board-ip> [period-ms] [count] [seconds]\n"
+                  "       %s -r <file.pcap>\n"
+                  "       %s -e [drop-every]\n", argv[0], argv[0], argv[0]);
+  return 1;
+}
@@ -16,19 +16,56 @@
 
 #include <cr_section_macros.h>
 
+#include "log_codec.h"
+
 #define TIME_IN_US 100 // 0.1ms
-#define DATA_BASE ((uint32_t*)0x2007C000)
-#define DATA_LIMIT ((uint32_t*)0x2007000F)
+#define DATA_SIZE 0x4000 // 16KB of AHB SRAM bank 0
+#define DATA_BASE ((uint8_t*)0x2007C000)
+#define DATA_LIMIT ((uint8_t*)(0x2007C000 + DATA_SIZE))
 #define READ_PERIOD_CYCLES 2000 // 200ms
 #define WRITE_PERIOD_CYCLES 4000 // 400ms
-#define READ_BIT_CYCLES 4
+#define READ_BIT_CYCLES 8
+
+#define LOG_BLOCKS (DATA_SIZE / LOG_BLOCK_SIZE)
+
+#define IAP_LOCATION 0x1FFF1FF1 // IAP entry point in boot ROM (Thumb)
+#define IAP_PREPARE_SECTORS 50
+#define IAP_COPY_RAM_TO_FLASH 51
+#define IAP_ERASE_SECTORS 52
+#define FLASH_FIRST_SECTOR 26 // Sectors 26..29 (0x60000-0x7FFFF) are reserved for the log, the flash region in .cproject ends below them
+#define FLASH_SECTORS 4
+#define FLASH_SECTOR_SIZE 0x8000 // 32KB sectors
+#define FLASH_BASE (0x00010000 + (FLASH_FIRST_SECTOR - 16) * FLASH_SECTOR_SIZE)
+#define FLASH_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / LOG_BLOCK_SIZE)
+#define FLASH_PAGES (FLASH_SECTORS * FLASH_PAGES_PER_SECTOR)
+#define PERSIST_QUEUE_SIZE 8 // Closed blocks waiting for flash (power of two)
+
+#define EXPORT_BIT_RATE 1000000 // SSP0 export rate in bit/s (0 keeps the visible bit-bang on P2.0/P2.1)
+#define EXPORT_SYNC_0 0xA5 // First two frames of every dump, followed by the block count (MSB first)
+#define EXPORT_SYNC_1 0x5A
+#define EXPORT_CHUNK_BYTES 2048 // Bytes moved by each GPDMA linked list item (max 4095)
+#define EXPORT_CHUNKS (DATA_SIZE / EXPORT_CHUNK_BYTES)
+#define EXPORT_LLI_BASE ((ExportLLI*)0x20080000) // AHB SRAM bank 1, reachable by the GPDMA
+#define EXPORT_HEADER_BASE ((uint8_t*)(0x20080000 + (EXPORT_CHUNKS + 1) * sizeof(ExportLLI)))
+
+typedef struct {
+	uint32_t SrcAddr;
+	uint32_t DstAddr;
+	uint32_t NextLLI;
+	uint32_t Control;
+} ExportLLI;
 
 uint32_t static debounce_0 = 0;
 uint32_t static debounce_1 = 0;
 uint32_t static debounce_2 = 0;
 uint32_t static debounce_3 = 0;
-uint32_t static *read_data_pointer = DATA_BASE;
-uint32_t static *write_data_pointer = DATA_BASE;
+uint8_t static *read_data_pointer = DATA_BASE;
+uint8_t static *persist_queue[PERSIST_QUEUE_SIZE]; // Closed blocks, written by persistUpdate()
+uint32_t static persist_head = 0;
+uint32_t static persist_tail = 0;
+uint32_t static persist_page = 0; // Next flash page of the sector ring to program
+uint32_t static persist_erased = 0; // The sector holding persist_page is already blank
+uint32_t static ram_vectors[64] __attribute__ ((aligned(256))); // Vector table used while IAP owns the flash
 uint32_t static update_write = 0;
 uint32_t static update_read = 0;
 uint32_t static read_period_counter = 0;
@@ -36,27 +73,57 @@ uint32_t static write_period_counter = 0;
 uint32_t static value = 0;
 uint32_t static bit_read_counter = 0;
 uint32_t static clock_led_status = 0;
+uint32_t static volatile export_busy = 0;
 
 void configPorts();
 void configEINT();
 void configNVIC();
 void configSysTick();
+void configSSP();
+void configGPDMA();
+void setExportRate(uint32_t bit_rate);
 void updateWrite();
 void updateRead();
+void configVectors();
+void persistScan();
+void persistQueue(uint8_t *block);
+void persistUpdate();
+uint32_t persistSequence(uint32_t page);
+uint32_t callIAP(uint32_t command, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3);
+void startExport();
 void toggleLED1();
 
+Log static sample_log = { // Log ring in DATA_BASE, see log_codec.h
+	.base = DATA_BASE,
+	.limit = DATA_LIMIT,
+	.closed = persistQueue,
+	.block = DATA_BASE,
+};
+
 int main(void) {
 	SystemInit();
+	configVectors();
+	persistScan();
 	configPorts();
 	configEINT();
 	configNVIC();
 	configSysTick();
+	logStartBlock(&sample_log);
+	if (EXPORT_BIT_RATE) {
+		configSSP();
+		configGPDMA();
+	}
 	while (1) {
 		if (update_write) {
 			updateWrite();
 		}
+		persistUpdate();
 		if (update_read) {
-			updateRead();
+			if (EXPORT_BIT_RATE) {
+				startExport();
+			} else {
+				updateRead();
+			}
 		}
 	}
     return 0 ;
@@ -66,6 +133,19 @@ int main(void) {
  * CONFIGURATION METHODS
  */
 
+/*
+ * IAP stalls every flash access while it erases or programs, so the
+ * vector table and the interrupt handlers live in RAM to keep the
+ * sampling running in the meantime.
+ */
+void configVectors() {
+	uint32_t *flash_vectors = (uint32_t*)0;
+	for (int i = 0; i < 64; i++) {
+		ram_vectors[i] = flash_vectors[i];
+	}
+	SCB->VTOR = (uint32_t)ram_vectors;
+}
+
 void configPorts() {
 	LPC_PINCON->PINSEL4 &= ~(3<<20); // Clear P2.10
 	LPC_PINCON->PINSEL4 |=  (1<<20); // Set P2.10 as EINT0
@@ -127,11 +207,77 @@ void configSysTick() {
 	SysTick->CTRL = (1<<0) | (1<<1) | (1<<2); // Enable SysTick counter, enable SysTick interruptions and select internal clock
 }
 
+void configSSP() {
+	LPC_PINCON->PINSEL0 &= ~(3<<30); // Clear P0.15
+	LPC_PINCON->PINSEL0 |=  (2<<30); // Set P0.15 as SCK0 (bit clock)
+	LPC_PINCON->PINSEL1 &= ~(3<<0); // Clear P0.16
+	LPC_PINCON->PINSEL1 |=  (2<<0); // Set P0.16 as SSEL0 (pulses between frames)
+	LPC_PINCON->PINSEL1 &= ~(3<<4); // Clear P0.18
+	LPC_PINCON->PINSEL1 |=  (2<<4); // Set P0.18 as MOSI0 (data)
+
+	LPC_SC->PCONP |= (1<<21); // Power up SSP0
+	LPC_SC->PCLKSEL1 &= ~(3<<10); // Set PCLK_SSP0 to CCLK/4
+
+	LPC_SSP0->CR1 = 0; // Disable SSP0 and select master mode
+	LPC_SSP0->CR0 = (7<<0); // 8-bit frames, SPI format, CPOL=0, CPHA=0
+	setExportRate(EXPORT_BIT_RATE);
+	LPC_SSP0->DMACR = (1<<1); // Enable TX FIFO DMA requests
+	LPC_SSP0->CR1 = (1<<1); // Enable SSP0
+}
+
+void configGPDMA() {
+	ExportLLI *lli = EXPORT_LLI_BASE;
+	uint8_t *header = EXPORT_HEADER_BASE;
+	uint32_t control = (1<<12) | (1<<15) | (1<<26); // Bursts of 4, byte source and destination, increment source
+
+	LPC_SC->PCONP |= (1<<29); // Power up GPDMA
+	LPC_GPDMA->DMACConfig = (1<<0); // Enable GPDMA in little-endian mode
+	LPC_GPDMA->DMACIntTCClear = (1<<0);
+	LPC_GPDMA->DMACIntErrClr = (1<<0);
+
+	header[0] = EXPORT_SYNC_0;
+	header[1] = EXPORT_SYNC_1;
+	header[2] = LOG_BLOCKS >> 8;
+	header[3] = LOG_BLOCKS & 0xFF;
+
+	lli[0].SrcAddr = (uint32_t)header;
+	lli[0].DstAddr = (uint32_t)&LPC_SSP0->DR;
+	lli[0].NextLLI = (uint32_t)&lli[1];
+	lli[0].Control = control | 4;
+	for (int i = 1; i <= EXPORT_CHUNKS; i++) {
+		lli[i].SrcAddr = (uint32_t)DATA_BASE + (i - 1) * EXPORT_CHUNK_BYTES;
+		lli[i].DstAddr = (uint32_t)&LPC_SSP0->DR;
+		lli[i].NextLLI = (uint32_t)&lli[i + 1];
+		lli[i].Control = control | EXPORT_CHUNK_BYTES;
+	}
+	lli[EXPORT_CHUNKS].NextLLI = 0;
+	lli[EXPORT_CHUNKS].Control |= (1<<31); // Terminal count interrupt after the last chunk
+
+	NVIC_EnableIRQ(DMA_IRQn);
+}
+
+void setExportRate(uint32_t bit_rate) {
+	uint32_t divider = (SystemCoreClock / 4) / bit_rate;
+	uint32_t prescaler = 2;
+	while (prescaler < 254 && divider > prescaler * 256) {
+		prescaler += 2;
+	}
+	uint32_t scr = divider / prescaler;
+	if (scr > 0) {
+		scr--;
+	}
+	if (scr > 255) {
+		scr = 255; // Slowest rate reachable with PCLK_SSP0 = CCLK/4
+	}
+	LPC_SSP0->CPSR = prescaler;
+	LPC_SSP0->CR0 = (LPC_SSP0->CR0 & ~(0xFF<<8)) | (scr<<8);
+}
+
 /*
  * INTERRUPTIONS HANDLERS
  */
 
-void EINT0_IRQHandler() {
+__RAMFUNC(RAM) void EINT0_IRQHandler() {
 	if (debounce_0 == 0) {
 		debounce_0 = 1;
 		value += 1;
@@ -139,7 +285,7 @@ void EINT0_IRQHandler() {
 	LPC_SC->EXTINT |= (1<<0);
 }
 
-void EINT1_IRQHandler() {
+__RAMFUNC(RAM) void EINT1_IRQHandler() {
 	if (debounce_1 == 0) {
 		debounce_1 = 1;
 		value += 2;
@@ -147,7 +293,7 @@ void EINT1_IRQHandler() {
 	LPC_SC->EXTINT |= (1<<1);
 }
 
-void EINT2_IRQHandler() {
+__RAMFUNC(RAM) void EINT2_IRQHandler() {
 	if (debounce_2 == 0) {
 		debounce_2 = 1;
 		value += 4;
@@ -155,7 +301,7 @@ void EINT2_IRQHandler() {
 	LPC_SC->EXTINT |= (1<<2);
 }
 
-void EINT3_IRQHandler() {
+__RAMFUNC(RAM) void EINT3_IRQHandler() {
 	if (debounce_3 == 0) {
 		debounce_3 = 1;
 		value += 8;
@@ -163,7 +309,14 @@ void EINT3_IRQHandler() {
 	LPC_SC->EXTINT |= (1<<3);
 }
 
-void SysTick_Handler() {
+__RAMFUNC(RAM) void DMA_IRQHandler() {
+	LPC_GPDMA->DMACIntTCClear = (1<<0);
+	LPC_GPDMA->DMACIntErrClr = (1<<0);
+	export_busy = 0;
+	toggleLED1(); // One clock LED toggle per completed dump
+}
+
+__RAMFUNC(RAM) void SysTick_Handler() {
 	read_period_counter++;
 	if (read_period_counter >= READ_PERIOD_CYCLES) {
 		read_period_counter = 0;
@@ -185,18 +338,13 @@ void SysTick_Handler() {
  */
 
 void updateWrite() {
-	*write_data_pointer = value;
-	write_data_pointer++;
-	if (write_data_pointer >= DATA_LIMIT) {
-		write_data_pointer = DATA_BASE;
-	}
+	logAppend(&sample_log, value);
 	value = 0;
 	update_write = 0;
 }
 
 void updateRead() {
-	uint32_t value_tmp = *read_data_pointer & 0x01;
-	*read_data_pointer >>= 1;
+	uint32_t value_tmp = (*read_data_pointer >> bit_read_counter) & 0x01;
 	if (value_tmp) {
 		LPC_GPIO2->FIOSET |= (1<<0);
 	} else {
@@ -214,7 +362,112 @@ void updateRead() {
 	update_read = 0;
 }
 
-void toggleLED1() {
+/*
+ * Streams the whole log through SSP0 without CPU involvement:
+ * two SYNC bytes, the block count, then every log block byte by byte,
+ * each byte MSB first on MOSI0 and clocked on SCK0.
+ */
+void startExport() {
+	ExportLLI *lli = EXPORT_LLI_BASE;
+	if (!export_busy) {
+		export_busy = 1;
+		LPC_GPDMACH0->DMACCSrcAddr = lli[0].SrcAddr;
+		LPC_GPDMACH0->DMACCDestAddr = lli[0].DstAddr;
+		LPC_GPDMACH0->DMACCLLI = lli[0].NextLLI;
+		LPC_GPDMACH0->DMACCControl = lli[0].Control;
+		LPC_GPDMACH0->DMACCConfig = (1<<0) | (0<<6) | (1<<11) | (1<<14) | (1<<15); // Enable, SSP0 TX destination, M2P, error and TC interrupts
+	}
+	update_read = 0;
+}
+
+/*
+ * Flash persistence: every closed log block is one 256-byte flash page.
+ * Pages fill the reserved sectors in order and the sectors form a ring,
+ * so each one is erased once per lap. A sector with a blank first page
+ * is blank as a whole, which lets the boot scan find the write head by
+ * reading one header per sector plus a binary search inside the newest.
+ */
+void persistScan() {
+	uint32_t head_sector = FLASH_SECTORS;
+	uint32_t head_sequence = 0;
+	for (uint32_t i = 0; i < FLASH_SECTORS; i++) {
+		uint32_t sequence = persistSequence(i * FLASH_PAGES_PER_SECTOR);
+		if (sequence == LOG_SEQUENCE_ERASED) {
+			continue;
+		}
+		if (head_sector == FLASH_SECTORS || (int16_t)(sequence - head_sequence) > 0) {
+			head_sector = i;
+			head_sequence = sequence;
+		}
+	}
+	if (head_sector == FLASH_SECTORS) {
+		persist_page = 0; // Nothing persisted yet
+		persist_erased = 1;
+		return;
+	}
+	uint32_t low = 1; // First page is known to be written
+	uint32_t high = FLASH_PAGES_PER_SECTOR;
+	while (low < high) { // Find the first blank page of the newest sector
+		uint32_t middle = (low + high) / 2;
+		if (persistSequence(head_sector * FLASH_PAGES_PER_SECTOR + middle) == LOG_SEQUENCE_ERASED) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+	sample_log.sequence = (persistSequence(head_sector * FLASH_PAGES_PER_SECTOR + low - 1) + 1) % LOG_SEQUENCE_ERASED;
+	persist_page = (head_sector * FLASH_PAGES_PER_SECTOR + low) % FLASH_PAGES;
+	persist_erased = low < FLASH_PAGES_PER_SECTOR; // Otherwise the next sector holds the oldest lap
+}
+
+uint32_t persistSequence(uint32_t page) {
+	uint8_t *header = (uint8_t*)(FLASH_BASE + page * LOG_BLOCK_SIZE);
+	return header[0] | (header[1] << 8);
+}
+
+void persistQueue(uint8_t *block) {
+	if (persist_head - persist_tail < PERSIST_QUEUE_SIZE) {
+		persist_queue[persist_head % PERSIST_QUEUE_SIZE] = block;
+		persist_head++;
+	}
+}
+
+/*
+ * Runs one IAP operation per call from the main loop: either the erase
+ * of the sector that is about to be entered or the copy of one page.
+ */
+void persistUpdate() {
+	if (persist_head == persist_tail) {
+		return;
+	}
+	uint32_t sector = FLASH_FIRST_SECTOR + persist_page / FLASH_PAGES_PER_SECTOR;
+	uint32_t cclk_khz = SystemCoreClock / 1000;
+	if (!persist_erased) {
+		callIAP(IAP_PREPARE_SECTORS, sector, sector, 0, 0);
+		callIAP(IAP_ERASE_SECTORS, sector, sector, cclk_khz, 0);
+		persist_erased = 1;
+		return;
+	}
+	callIAP(IAP_PREPARE_SECTORS, sector, sector, 0, 0);
+	callIAP(IAP_COPY_RAM_TO_FLASH, FLASH_BASE + persist_page * LOG_BLOCK_SIZE, (uint32_t)persist_queue[persist_tail % PERSIST_QUEUE_SIZE], LOG_BLOCK_SIZE, cclk_khz);
+	persist_tail++;
+	persist_page = (persist_page + 1) % FLASH_PAGES;
+	if (persist_page % FLASH_PAGES_PER_SECTOR == 0) {
+		persist_erased = 0; // Entering the next sector of the ring
+	}
+}
+
+// IAP uses the top 32 bytes of local SRAM as scratch, the stack starts below them
+// (__user_stack_top = 0x10007FE0 in the linker options of .cproject)
+uint32_t callIAP(uint32_t command, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3) {
+	void (*iap)(uint32_t*, uint32_t*) = (void (*)(uint32_t*, uint32_t*))IAP_LOCATION;
+	uint32_t command_table[5] = {command, p0, p1, p2, p3};
+	uint32_t result_table[5];
+	iap(command_table, result_table);
+	return result_table[0];
+}
+
+__RAMFUNC(RAM) void toggleLED1() {
 	if (clock_led_status) {
 		LPC_GPIO2->FIOCLR = (1<<1);
 	} else {
@@ -0,0 +1,57 @@
+#include "log_codec.h"
+
+// Opens log->block: header with the next sequence number, the rest padded
+void logStartBlock(Log *log) {
+	for (int i = 0; i < LOG_BLOCK_SIZE; i++) {
+		log->block[i] = LOG_PAD;
+	}
+	log->block[0] = log->sequence & 0xFF;
+	log->block[1] = log->sequence >> 8;
+	log->sequence = (log->sequence + 1) % LOG_SEQUENCE_ERASED;
+	log->offset = LOG_HEADER_SIZE;
+	log->previous = 0;
+	log->run = 0;
+	log->run_offset = 0;
+}
+
+void logAppend(Log *log, uint32_t sample) {
+	int32_t delta = (int32_t)(sample - log->previous);
+	if (delta == 0 && log->run_offset != 0 && log->run < LOG_RUN_MAX) {
+		log->run++; // Grow the open run token in place
+		log->block[log->run_offset] = 0x80 | (((log->run << 1) | 1) & 0x7F);
+		log->block[log->run_offset + 1] = (log->run << 1) >> 7;
+		return;
+	}
+	uint32_t token = delta == 0 ? 3 : (uint32_t)((delta << 1) ^ (delta >> 31)) << 1;
+	uint32_t length = delta == 0 ? 2 : 1 + (token >= (1<<7)) + (token >= (1<<14)) + (token >= (1<<21)) + (token >= (1<<28));
+	if (log->offset + length > LOG_BLOCK_SIZE) {
+		if (log->closed) {
+			log->closed(log->block);
+		}
+		log->block += LOG_BLOCK_SIZE;
+		if (log->block >= log->limit) {
+			log->block = log->base; // Overwrite the oldest block
+		}
+		logStartBlock(log);
+		logAppend(log, sample); // Re-encode against the fresh block
+		return;
+	}
+	if (delta == 0) {
+		log->run = 1;
+		log->run_offset = log->offset;
+		log->block[log->offset++] = 0x80 | 3; // Run of 1, padded to 2 bytes
+		log->block[log->offset++] = 0;
+	} else {
+		log->run_offset = 0;
+		logPutVarint(log, token);
+	}
+	log->previous = sample;
+}
+
+void logPutVarint(Log *log, uint32_t token) {
+	while (token >= 0x80) {
+		log->block[log->offset++] = 0x80 | (token & 0x7F);
+		token >>= 7;
+	}
+	log->block[log->offset++] = token;
+}
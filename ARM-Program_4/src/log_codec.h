@@ -0,0 +1,42 @@
+/*
+ * The log is a ring of LOG_BLOCK_SIZE byte blocks. Bytes 0-1 of a block hold
+ * its 16-bit sequence number, the rest is a stream of LEB128 varint tokens:
+ *   token & 1 == 0: literal, (token >> 1) is the zig-zag encoded delta
+ *                   against the previous value (0 at the start of a block)
+ *   token & 1 == 1: run, the previous value repeats (token >> 1) times
+ * Run tokens always take 2 bytes so they can grow in place, which keeps
+ * memory decodable after every append. A run of 0 (LOG_PAD) ends a block.
+ *
+ * The encoder only touches the ring, closed blocks are handed to a hook
+ * (persistQueue() in the firmware), so tools/log_decode.c builds this file
+ * on the host for its round trip test.
+ */
+
+#ifndef LOG_CODEC_H
+#define LOG_CODEC_H
+
+#include <stdint.h>
+
+#define LOG_BLOCK_SIZE 256 // Bytes per log block, every block decodes on its own
+#define LOG_RUN_MAX 8191 // Longest run of repeated values held by one 2-byte run token
+#define LOG_PAD 0x01 // Run token of zero records, fills the unused tail of a block
+#define LOG_HEADER_SIZE 2 // 16-bit block sequence number, little-endian
+#define LOG_SEQUENCE_ERASED 0xFFFF // Never assigned, marks an erased flash page
+
+typedef struct {
+	uint8_t *base; // First block of the ring
+	uint8_t *limit; // End of the ring, a multiple of LOG_BLOCK_SIZE after base
+	void (*closed)(uint8_t *block); // Called with every full block before the ring moves on, 0 = none
+	uint8_t *block; // Block being filled
+	uint32_t offset; // Next free byte inside block
+	uint32_t previous; // Last appended value, base of the next delta
+	uint32_t run; // Length of the run token at run_offset
+	uint32_t run_offset; // Offset of the open run token (0 = none, offset 0 is the block header)
+	uint32_t sequence; // Sequence number stored in the next block header
+} Log;
+
+void logStartBlock(Log *log);
+void logAppend(Log *log, uint32_t sample);
+void logPutVarint(Log *log, uint32_t token);
+
+#endif
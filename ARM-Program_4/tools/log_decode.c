@@ -0,0 +1,340 @@
+/*
+ * Host decoder for the Program_4 log export.
+ *
+ * startExport() clocks the log out of SSP0: two SYNC bytes (0xA5 0x5A),
+ * the block count (MSB first), then every 256-byte log block. Each byte is
+ * sent MSB first on MOSI0 and sampled on the rising edge of SCK0.
+ *
+ * Build and run on Linux (not part of the firmware build):
+ *
+ *   make (or make test for the round trip test)
+ *
+ *   log_decode capture.csv [sck-column] [mosi-column]
+ *       logic-analyzer export, one line per sample, comma separated,
+ *       columns counted from 0 (default 1 and 2 for "Time,SCK,MOSI").
+ *       lines that don't start with a number (headers) are skipped
+ *   log_decode -b dump.bin
+ *       the exported bytes as a raw file (e.g. from an SPI decoder)
+ *   log_decode -t
+ *       round trip test: encodes known sample vectors with the firmware's
+ *       logAppend() (../src/log_codec.c) and checks that they decode unchanged
+ *
+ * The blocks are printed oldest first, one line per block with its
+ * sequence number and the samples it holds. The block format is
+ * described in ../src/log_codec.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "log_codec.h"
+
+#define EXPORT_SYNC_0 0xA5
+#define EXPORT_SYNC_1 0x5A
+#define DATA_SIZE 0x4000
+#define LOG_BLOCKS (DATA_SIZE / LOG_BLOCK_SIZE)
+#define LOG_SAMPLES_MAX (LOG_RUN_MAX * (LOG_BLOCK_SIZE - LOG_HEADER_SIZE) / 2) // Every token a full run
+
+uint8_t static data_base[DATA_SIZE]; // Log RAM of the firmware, for the round trip test
+Log static sample_log = {.base = data_base, .limit = data_base + DATA_SIZE}; // persistQueue() left out
+
+uint8_t *readCapture(const char *file, int sck_column, int mosi_column, size_t *bit_count);
+uint8_t *readBinary(const char *file, size_t *length);
+uint8_t *packBytes(const uint8_t *bits, size_t bit_count, size_t *length);
+int decodeExport(const uint8_t *data, size_t length);
+int decodeBlock(const uint8_t *block, uint32_t *samples);
+int decodeLog(const uint8_t *blocks, uint32_t count, uint32_t *samples, size_t *sample_count, int print);
+int roundTrip();
+
+int main(int argc, char **argv) {
+	uint8_t *data = NULL;
+	size_t length = 0;
+	if (argc == 2 && !strcmp(argv[1], "-t")) {
+		return roundTrip();
+	}
+	if (argc == 3 && !strcmp(argv[1], "-b")) {
+		data = readBinary(argv[2], &length);
+	} else if (argc >= 2 && argv[1][0] != '-') {
+		size_t bit_count;
+		uint8_t *bits = readCapture(argv[1], argc > 2 ? atoi(argv[2]) : 1, argc > 3 ? atoi(argv[3]) : 2, &bit_count);
+		if (bits) {
+			data = packBytes(bits, bit_count, &length);
+			free(bits);
+		}
+	} else {
+		fprintf(stderr, "usage: %s capture.csv [sck-column] [mosi-column]\n"
+		                "       %s -b dump.bin\n"
+		                "       %s -t\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+	if (!data) {
+		return 1;
+	}
+	int result = decodeExport(data, length);
+	free(data);
+	return result;
+}
+
+/*
+ * Returns the MOSI level at every rising SCK edge of the capture.
+ */
+uint8_t *readCapture(const char *file, int sck_column, int mosi_column, size_t *bit_count) {
+	FILE *f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return NULL;
+	}
+	size_t size = 1 << 16;
+	uint8_t *bits = malloc(size);
+	char line[1024];
+	int last_sck = 1; // No edge on the first sample
+	*bit_count = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (!(line[0] >= '0' && line[0] <= '9') && line[0] != '-' && line[0] != '.') {
+			continue; // Header
+		}
+		int sck = -1;
+		int mosi = -1;
+		char *field = line;
+		for (int column = 0; field; column++) {
+			if (column == sck_column) {
+				sck = atoi(field) != 0;
+			}
+			if (column == mosi_column) {
+				mosi = atoi(field) != 0;
+			}
+			field = strchr(field, ',');
+			if (field) {
+				field++;
+			}
+		}
+		if (sck < 0 || mosi < 0) {
+			continue;
+		}
+		if (sck && !last_sck) {
+			if (*bit_count == size) {
+				size *= 2;
+				bits = realloc(bits, size);
+			}
+			bits[(*bit_count)++] = mosi;
+		}
+		last_sck = sck;
+	}
+	fclose(f);
+	return bits;
+}
+
+uint8_t *readBinary(const char *file, size_t *length) {
+	FILE *f = fopen(file, "rb");
+	if (!f) {
+		perror(file);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = malloc(*length ? *length : 1);
+	if (fread(data, 1, *length, f) != *length) {
+		perror(file);
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+/*
+ * Finds the SYNC bytes at any bit offset (the capture may start in the
+ * middle of a byte) and packs the bits from there into bytes, MSB first.
+ */
+uint8_t *packBytes(const uint8_t *bits, size_t bit_count, size_t *length) {
+	uint32_t shift = 0;
+	size_t start;
+	for (start = 0; start < bit_count; start++) {
+		shift = ((shift << 1) | bits[start]) & 0xFFFF;
+		if (start >= 15 && shift == ((EXPORT_SYNC_0 << 8) | EXPORT_SYNC_1)) {
+			break;
+		}
+	}
+	if (start == bit_count) {
+		fprintf(stderr, "no SYNC bytes in the capture\n");
+		return NULL;
+	}
+	start -= 15;
+	*length = (bit_count - start) / 8;
+	uint8_t *data = calloc(*length ? *length : 1, 1);
+	for (size_t i = 0; i < *length * 8; i++) {
+		data[i / 8] |= bits[start + i] << (7 - i % 8);
+	}
+	return data;
+}
+
+/*
+ * Checks the export header and prints the samples of every block.
+ */
+int decodeExport(const uint8_t *data, size_t length) {
+	if (length < 4 || data[0] != EXPORT_SYNC_0 || data[1] != EXPORT_SYNC_1) {
+		fprintf(stderr, "export doesn't start with the SYNC bytes\n");
+		return 1;
+	}
+	uint32_t blocks = (data[2] << 8) | data[3];
+	if (4 + (size_t)blocks * LOG_BLOCK_SIZE > length) {
+		fprintf(stderr, "export truncated: %u blocks announced, %zu bytes captured\n", blocks, length - 4);
+		blocks = (length - 4) / LOG_BLOCK_SIZE;
+	}
+	size_t sample_count;
+	return decodeLog(data + 4, blocks, NULL, &sample_count, 1);
+}
+
+/*
+ * Decodes one block into 'samples' (LOG_SAMPLES_MAX at most) and returns
+ * their number, or -1 if the block isn't a valid token stream (a block
+ * the firmware never wrote).
+ */
+int decodeBlock(const uint8_t *block, uint32_t *samples) {
+	uint32_t previous = 0;
+	int count = 0;
+	int offset = LOG_HEADER_SIZE;
+	while (offset < LOG_BLOCK_SIZE) {
+		uint32_t token = 0;
+		int shift = 0;
+		do {
+			if (offset == LOG_BLOCK_SIZE || shift > 28) {
+				return -1; // Token runs past the block or is too long
+			}
+			token |= (uint32_t)(block[offset] & 0x7F) << shift;
+			shift += 7;
+		} while (block[offset++] & 0x80);
+		if (token & 1) {
+			uint32_t run = token >> 1;
+			if (run == 0) {
+				break; // LOG_PAD, rest of the block is unused
+			}
+			if (run > LOG_RUN_MAX || count + run > LOG_SAMPLES_MAX) {
+				return -1;
+			}
+			while (run--) {
+				samples[count++] = previous;
+			}
+		} else {
+			uint32_t zigzag = token >> 1;
+			previous += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+			samples[count++] = previous;
+		}
+	}
+	return count;
+}
+
+/*
+ * The blocks are written in address order around the ring, so the oldest
+ * one follows the block whose successor doesn't continue its sequence.
+ * Decodes them from there into 'samples' (if not NULL) and prints them.
+ */
+int decodeLog(const uint8_t *blocks, uint32_t count, uint32_t *samples, size_t *sample_count, int print) {
+	uint32_t *block_samples = malloc(LOG_SAMPLES_MAX * sizeof(uint32_t));
+	uint32_t first = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t *block = blocks + i * LOG_BLOCK_SIZE;
+		const uint8_t *next = blocks + ((i + 1) % count) * LOG_BLOCK_SIZE;
+		uint32_t sequence = block[0] | (block[1] << 8);
+		uint32_t next_sequence = next[0] | (next[1] << 8);
+		if (sequence != LOG_SEQUENCE_ERASED && next_sequence != (sequence + 1) % LOG_SEQUENCE_ERASED) {
+			first = (i + 1) % count; // 'block' is the newest one
+			break;
+		}
+	}
+	*sample_count = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t *block = blocks + ((first + i) % count) * LOG_BLOCK_SIZE;
+		uint32_t sequence = block[0] | (block[1] << 8);
+		if (sequence == LOG_SEQUENCE_ERASED) {
+			continue;
+		}
+		int n = decodeBlock(block, block_samples);
+		if (n < 0) {
+			if (print) {
+				fprintf(stderr, "block %u: not a valid token stream, skipped\n", sequence);
+			}
+			continue;
+		}
+		if (print) {
+			printf("block %u:", sequence);
+			for (int j = 0; j < n; j++) {
+				printf(" %u", block_samples[j]);
+			}
+			printf("\n");
+		}
+		if (samples) {
+			memcpy(samples + *sample_count, block_samples, n * sizeof(uint32_t));
+		}
+		*sample_count += n;
+	}
+	free(block_samples);
+	return 0;
+}
+
+/*
+ * Encodes sample vectors the way the firmware does and checks that the
+ * decoder gives them back. A vector that overflows the ring must decode
+ * to its newest samples.
+ */
+int roundTrip() {
+	static uint32_t input[200000];
+	static uint32_t output[LOG_BLOCKS * LOG_SAMPLES_MAX];
+	const char *names[] = {"button sums", "ramp", "long runs", "extremes", "ring overflow"};
+	int failed = 0;
+	for (int vector = 0; vector < 5; vector++) {
+		size_t n = 0;
+		srand(vector + 1);
+		switch (vector) {
+		case 0: // Sums of the four buttons, mostly idle
+			for (int i = 0; i < 5000; i++) {
+				input[n++] = rand() % 8 ? 0 : rand() % 16;
+			}
+			break;
+		case 1: // Every delta from -15 to 15
+			for (int i = 0; i < 3000; i++) {
+				input[n++] = i % 32 < 16 ? i % 16 : 15 - i % 16;
+			}
+			break;
+		case 2: // Runs longer than a run token holds
+			for (int i = 0; i < 6; i++) {
+				for (int j = 0; j < LOG_RUN_MAX + 100 * i; j++) {
+					input[n++] = i;
+				}
+			}
+			break;
+		case 3: // Deltas that need 5-byte varints
+			for (int i = 0; i < 1000; i++) {
+				input[n++] = i & 1 ? 0x0FFFFFFF : 0;
+			}
+			break;
+		case 4: // More history than the RAM holds
+			for (int i = 0; i < 200000; i++) {
+				input[n++] = rand() % 16;
+			}
+			break;
+		}
+
+		memset(data_base, 0xFF, sizeof(data_base)); // Like erased flash, marks unused blocks
+		sample_log.block = data_base;
+		sample_log.sequence = 0;
+		logStartBlock(&sample_log);
+		for (size_t i = 0; i < n; i++) {
+			logAppend(&sample_log, input[i]);
+		}
+
+		size_t decoded;
+		decodeLog(data_base, LOG_BLOCKS, output, &decoded, 0);
+		int ok = decoded <= n && !memcmp(output, input + n - decoded, decoded * sizeof(uint32_t));
+		if (vector != 4) {
+			ok = ok && decoded == n; // Fits into the ring
+		}
+		printf("%-14s %6zu samples, %6zu decoded, %5zu bytes of log: %s\n", names[vector], n, decoded,
+		       vector == 4 ? (size_t)DATA_SIZE : (size_t)(sample_log.block - data_base) + sample_log.offset, ok ? "ok" : "FAILED");
+		failed |= !ok;
+	}
+	return failed;
+}
@@ -18,6 +18,8 @@
 #include "lpc17xx_pinsel.h"
 #include "lpc17xx_adc.h"
 #include "lpc17xx_dac.h"
+#include "lpc17xx_gpdma.h"
+#include "lpc17xx_uart.h"
 
 #include <cr_section_macros.h>
 
@@ -33,16 +35,110 @@
 #define DEBOUNCE_DELAY_CYCLES 2000 // Cycles of TIME_IN_US that the button will be ignored (2000 * 100us = 200ms)
 
 #define ADC_CONVERSION_RATE 200000
+#define ADC_RING_SIZE 32 // ADGDR words kept by the GPDMA ring, shared by every scanned channel
+
+#define DAC_SAMPLE_RATE 10000 // Output samples per second, paced by DACCNTVAL
+#define DAC_BLOCK_SIZE 64 // Samples per output block (64 / 10kHz = 6.4ms)
+#define DAC_MAX_VALUE 0x3FF
+
+#define GPDMA_CHANNEL_0 0 // ADC ring
+#define GPDMA_CHANNEL_1 1 // DAC blocks
+
+#define GRAPHS 5 // Precompiled routings, 0-3 reachable from the buttons, all of them from UART ('0' to '4')
+#define GRAPH_MAX_NODES 8 // Also the number of block buffers, one per node output
+#define SAMPLE_MAX_VALUE 0xFFF // Samples travel through the graph at ADC scale
+
+typedef enum {
+	NODE_SOURCE, // param_0: ADC channel
+	NODE_GAIN, // param_0: gain in Q8 (256 = 1.0)
+	NODE_SUM,
+	NODE_INVERT, // param_0: full scale
+	NODE_CLIP, // param_0: low limit, param_1: high limit
+	NODE_LOWPASS, // param_0: smoothing shift, y += (x - y) >> param_0
+	NODE_SINK_DAC,
+	NODE_SINK_UART
+} NodeType;
+
+typedef struct {
+	NodeType type;
+	int8_t input_0; // Index of the node feeding this one, -1 if unused
+	int8_t input_1;
+	int32_t param_0;
+	int32_t param_1;
+} GraphNode;
+
+typedef struct GraphStep GraphStep;
+typedef void (*BlockOperator)(GraphStep *step);
+
+struct GraphStep {
+	BlockOperator run;
+	int32_t *input_0;
+	int32_t *input_1;
+	int32_t *output;
+	int32_t param_0;
+	int32_t param_1;
+	int32_t state; // Low-pass memory
+};
+
+typedef struct {
+	GraphStep steps[GRAPH_MAX_NODES];
+	uint32_t length;
+} CompiledGraph;
+
+GraphNode static const graph_pot_0[] = {
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_0, 0},
+	{NODE_SINK_DAC, 0, -1, 0, 0},
+};
+
+GraphNode static const graph_pot_1[] = {
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_2, 0},
+	{NODE_SINK_DAC, 0, -1, 0, 0},
+};
+
+GraphNode static const graph_sum[] = {
+	{NODE_SINK_DAC, 3, -1, 0, 0}, // Declaration order does not matter, compileGraph() sorts the nodes
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_0, 0},
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_2, 0},
+	{NODE_CLIP, 4, -1, 0, SAMPLE_MAX_VALUE},
+	{NODE_SUM, 1, 2, 0, 0},
+};
+
+GraphNode static const graph_invert[] = {
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_0, 0},
+	{NODE_INVERT, 0, -1, SAMPLE_MAX_VALUE, 0},
+	{NODE_SINK_DAC, 1, -1, 0, 0},
+};
+
+GraphNode static const graph_smooth_mix[] = {
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_0, 0},
+	{NODE_SOURCE, -1, -1, ADC_CHANNEL_2, 0},
+	{NODE_GAIN, 0, -1, 128, 0}, // Half of each pot, so the sum never clips
+	{NODE_GAIN, 1, -1, 128, 0},
+	{NODE_SUM, 2, 3, 0, 0},
+	{NODE_LOWPASS, 4, -1, 3, 0},
+	{NODE_SINK_DAC, 5, -1, 0, 0},
+	{NODE_SINK_UART, 5, -1, 0, 0},
+};
 
 uint32_t static debounce_0_counter = 0; // Decrement counter of cycles of TIME_IN_US
 uint32_t static debounce_1_counter = 0;
 uint32_t static button_0_state = 0;
 uint32_t static button_1_state = 0;
 
-uint32_t static potentiometer_0_value = 0;
-uint32_t static potentiometer_1_value = 0;
+uint32_t static volatile active_graph = 0; // Index in compiled_graphs, written by the buttons and UART
+CompiledGraph static compiled_graphs[GRAPHS];
+int32_t static graph_buffers[GRAPH_MAX_NODES][DAC_BLOCK_SIZE]; // Node outputs, shared by every graph
+uint32_t static *dac_block_target = 0; // Block written by NODE_SINK_DAC
 
-uint32_t static channel_selection = 0;
+GPDMA_LLI_Type static adc_lli __BSS(RAM2);
+uint32_t static adc_ring[ADC_RING_SIZE] __BSS(RAM2); // Raw ADGDR words, the channel number travels in bits 24-26
+
+GPDMA_LLI_Type static dac_lli_0 __BSS(RAM2);
+GPDMA_LLI_Type static dac_lli_1 __BSS(RAM2);
+uint32_t static dac_block_0[DAC_BLOCK_SIZE] __BSS(RAM2); // DACR words, value in bits 6-15
+uint32_t static dac_block_1[DAC_BLOCK_SIZE] __BSS(RAM2);
+uint32_t static volatile dac_block_playing = 0; // Block the GPDMA is reading
+uint32_t static volatile dac_block_pending = 0; // Set by the DMA interrupt when the other block has to be refilled
 
 void configGPIO();
 void configEINT();
@@ -52,9 +148,26 @@ void configADC();
 void configDAC();
 void configGPDMA();
 void configNVIC();
+void configUART();
+void configGraphs();
+uint32_t readChannelLatest(uint32_t channel);
+uint32_t readChannelAverage(uint32_t channel);
+uint32_t saturateDAC(int32_t value);
+void fillDACBlock(uint32_t *block);
+void compileGraph(const GraphNode *nodes, uint32_t count, CompiledGraph *graph);
+void runGraph(CompiledGraph *graph);
+void runSource(GraphStep *step);
+void runGain(GraphStep *step);
+void runSum(GraphStep *step);
+void runInvert(GraphStep *step);
+void runClip(GraphStep *step);
+void runLowPass(GraphStep *step);
+void runSinkDAC(GraphStep *step);
+void runSinkUART(GraphStep *step);
 
 int main() {
 	SystemInit();
+	configGraphs();
 	configGPIO();
 	configEINT();
 	configSysTick();
@@ -62,20 +175,14 @@ int main() {
 	configADC();
 	configDAC();
 	configGPDMA();
+	configUART();
 	configNVIC();
 	while (1) {
-		if (button_0_state == 0 && button_1_state == 0) {
-			DAC_UpdateValue(LPC_DAC, potentiometer_0_value);
-		}
-		if (button_0_state == 1 && button_1_state == 0) {
-			DAC_UpdateValue(LPC_DAC, potentiometer_1_value);
-		}
-		if (button_0_state == 0 && button_1_state == 1) {
-			DAC_UpdateValue(LPC_DAC, potentiometer_0_value + potentiometer_1_value);
-		}
-		if (button_0_state == 1 && button_1_state == 1) {
-			DAC_UpdateValue(LPC_DAC, 0x3FF - potentiometer_0_value);
+		while (dac_block_pending == 0) {
+			__WFI(); // Sleep until the GPDMA releases a block
 		}
+		dac_block_pending = 0;
+		fillDACBlock(dac_block_playing == 0 ? dac_block_1 : dac_block_0);
 	}
 	return 0;
 }
@@ -148,11 +255,10 @@ void configADC() {
 	//GPIO_SetDir(0, POTENTIOMETER_1_PIN, 0);
 
 	ADC_Init(LPC_ADC, ADC_CONVERSION_RATE);
-	ADC_IntConfig(LPC_ADC, ADC_ADINTEN0, ENABLE);
-	ADC_IntConfig(LPC_ADC, ADC_ADINTEN2, ENABLE);
+	ADC_IntConfig(LPC_ADC, ADC_ADGINTEN, ENABLE); // Global DONE drives the GPDMA request, the NVIC line stays off
 	ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_0, ENABLE);
-	ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_2, DISABLE);
-	ADC_StartCmd(LPC_ADC, ADC_START_NOW);
+	ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_2, ENABLE);
+	ADC_BurstCmd(LPC_ADC, ENABLE); // Scan both channels continuously
 }
 
 void configDAC() {
@@ -163,20 +269,100 @@ void configDAC() {
 	PinCfg.Funcnum = PINSEL_FUNC_2;
 	PinCfg.Pinmode = PINSEL_PINMODE_PULLDOWN;
 	PinCfg.OpenDrain = PINSEL_PINMODE_NORMAL;
-	GPIO_SetDir(2, LED_0_PIN, 1);
 	PINSEL_ConfigPin(&PinCfg);
 
-	DAC_Init(LPC_DAC);
+	DAC_Init(LPC_DAC); // PCLK_DAC = CCLK / 4
+
+	DAC_CONVERTER_CFG_Type dac_cfg;
+	dac_cfg.DBLBUF_ENA = 1; // DACR is latched on every counter timeout, so samples are evenly spaced
+	dac_cfg.CNT_ENA = 1;
+	dac_cfg.DMA_ENA = 1;
+	// UM10360 (DAC chapter, DMA counter): the counter counts DACCNTVAL down to 0 and is reloaded on the next
+	// PCLK, so one period is DACCNTVAL + 1 clocks and the reload value is the period - 1
+	DAC_SetDMATimeOut(LPC_DAC, (SystemCoreClock / 4) / DAC_SAMPLE_RATE - 1);
+	DAC_ConfigDAConverterControl(LPC_DAC, &dac_cfg);
 }
 
 void configGPDMA() {
-
+	GPDMA_Init();
+
+	GPDMA_Channel_CFG_Type gpdma_cfg;
+	gpdma_cfg.ChannelNum = GPDMA_CHANNEL_0;
+	gpdma_cfg.TransferSize = ADC_RING_SIZE;
+	gpdma_cfg.TransferWidth = GPDMA_WIDTH_WORD;
+	gpdma_cfg.SrcMemAddr = 0;
+	gpdma_cfg.DstMemAddr = (uint32_t)&adc_ring[0];
+	gpdma_cfg.TransferType = GPDMA_TRANSFERTYPE_P2M;
+	gpdma_cfg.SrcConn = GPDMA_CONN_ADC; // Reads ADGDR
+	gpdma_cfg.DstConn = 0;
+	gpdma_cfg.DMALLI = (uint32_t)&adc_lli;
+	GPDMA_Setup(&gpdma_cfg);
+
+	// The single LLI points at itself, so the ring refills forever without interrupts
+	adc_lli.SrcAddr = (uint32_t)&LPC_ADC->ADGDR;
+	adc_lli.DstAddr = (uint32_t)&adc_ring[0];
+	adc_lli.NextLLI = (uint32_t)&adc_lli;
+	adc_lli.Control = (ADC_RING_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<27);
+	// GPDMA_Setup() always unmasks the error and terminal count interrupts (IE, ITC); the ring
+	// would raise one after its first pass that DMA_IRQHandler() doesn't serve, so mask them
+	LPC_GPDMACH0->DMACCConfig &= ~((1<<14) | (1<<15));
+
+	GPDMA_ChannelCmd(GPDMA_CHANNEL_0, ENABLE);
+
+	fillDACBlock(dac_block_0);
+	fillDACBlock(dac_block_1);
+
+	gpdma_cfg.ChannelNum = GPDMA_CHANNEL_1;
+	gpdma_cfg.TransferSize = DAC_BLOCK_SIZE;
+	gpdma_cfg.TransferWidth = GPDMA_WIDTH_WORD;
+	gpdma_cfg.SrcMemAddr = (uint32_t)&dac_block_0[0];
+	gpdma_cfg.DstMemAddr = 0;
+	gpdma_cfg.TransferType = GPDMA_TRANSFERTYPE_M2P;
+	gpdma_cfg.SrcConn = 0;
+	gpdma_cfg.DstConn = GPDMA_CONN_DAC; // Writes DACR
+	gpdma_cfg.DMALLI = (uint32_t)&dac_lli_1;
+	GPDMA_Setup(&gpdma_cfg);
+
+	// Two LLIs chained in a loop, each raising a terminal count interrupt when its block has been played
+	dac_lli_0.SrcAddr = (uint32_t)&dac_block_0[0];
+	dac_lli_0.DstAddr = (uint32_t)&LPC_DAC->DACR;
+	dac_lli_0.NextLLI = (uint32_t)&dac_lli_1;
+	dac_lli_0.Control = (DAC_BLOCK_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<26) | (1UL<<31);
+
+	dac_lli_1.SrcAddr = (uint32_t)&dac_block_1[0];
+	dac_lli_1.DstAddr = (uint32_t)&LPC_DAC->DACR;
+	dac_lli_1.NextLLI = (uint32_t)&dac_lli_0;
+	dac_lli_1.Control = (DAC_BLOCK_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<26) | (1UL<<31);
+
+	GPDMA_ChannelCmd(GPDMA_CHANNEL_1, ENABLE);
 }
 
 void configNVIC() {
     NVIC_EnableIRQ(EINT0_IRQn);
     NVIC_EnableIRQ(EINT1_IRQn);
-    NVIC_EnableIRQ(ADC_IRQn);
+    NVIC_EnableIRQ(DMA_IRQn);
+    NVIC_EnableIRQ(UART0_IRQn);
+}
+
+void configUART() {
+	LPC_PINCON->PINSEL0 &= ~(3 << 4); // Clear P0.2 function bits
+	LPC_PINCON->PINSEL0 |= (1 << 4); // Set P0.2 as TXD0
+	LPC_PINCON->PINSEL0 &= ~(3 << 6); // Clear P0.3 function bits
+	LPC_PINCON->PINSEL0 |= (1 << 6); // Set P0.3 as RXD0
+
+	UART_CFG_Type UART;
+	UART_ConfigStructInit(&UART);
+	UART_Init((LPC_UART_TypeDef *)LPC_UART0, &UART); // Initialize UART0
+	UART_IntConfig((LPC_UART_TypeDef *)LPC_UART0, UART_INTCFG_RBR, ENABLE); // Enable RBR interrupt
+	UART_TxCmd((LPC_UART_TypeDef *)LPC_UART0, ENABLE); // Enable UART0 Transmit
+}
+
+void configGraphs() {
+	compileGraph(graph_pot_0, sizeof(graph_pot_0) / sizeof(GraphNode), &compiled_graphs[0]);
+	compileGraph(graph_pot_1, sizeof(graph_pot_1) / sizeof(GraphNode), &compiled_graphs[1]);
+	compileGraph(graph_sum, sizeof(graph_sum) / sizeof(GraphNode), &compiled_graphs[2]);
+	compileGraph(graph_invert, sizeof(graph_invert) / sizeof(GraphNode), &compiled_graphs[3]);
+	compileGraph(graph_smooth_mix, sizeof(graph_smooth_mix) / sizeof(GraphNode), &compiled_graphs[4]);
 }
 
 /*
@@ -187,6 +373,7 @@ void EINT0_IRQHandler() {
     if (debounce_0_counter == 0) {
         debounce_0_counter = DEBOUNCE_DELAY_CYCLES; // Set the debounce counter
         button_0_state =! button_0_state;
+        active_graph = button_0_state | (button_1_state << 1);
     }
     LPC_SC->EXTINT |= (1<<0);
 }
@@ -195,6 +382,7 @@ void EINT1_IRQHandler() {
     if (debounce_1_counter == 0) {
     	debounce_1_counter = DEBOUNCE_DELAY_CYCLES; // Set the debounce counter
     	button_1_state =! button_1_state;
+    	active_graph = button_0_state | (button_1_state << 1);
     }
     LPC_SC->EXTINT |= (1<<1);
 }
@@ -208,24 +396,174 @@ void SysTick_Handler() {
     }
 }
 
-void ADC_IRQHandler() {
-	if (channel_selection == 0) {
-		potentiometer_0_value = ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_0) >> 2;
-		ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_0, DISABLE);
-		ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_2, ENABLE);
-		channel_selection = 1;
-	} else {
-		potentiometer_1_value = ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_2) >> 2;
-		ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_2, DISABLE);
-		ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_0, ENABLE);
-		channel_selection = 0;
+void DMA_IRQHandler() {
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTTC, GPDMA_CHANNEL_1)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, GPDMA_CHANNEL_1);
+		dac_block_playing = !dac_block_playing; // The finished block is free to be refilled
+		dac_block_pending = 1;
+	}
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTERR, GPDMA_CHANNEL_1)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, GPDMA_CHANNEL_1);
+	}
+	// The ADC ring (channel 0) has its interrupts masked, a flag left pending would still
+	// keep this handler running forever
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTTC, GPDMA_CHANNEL_0)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, GPDMA_CHANNEL_0);
 	}
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTERR, GPDMA_CHANNEL_0)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, GPDMA_CHANNEL_0);
+	}
+}
 
-	ADC_StartCmd(LPC_ADC, ADC_START_NOW);
+void UART0_IRQHandler(void) {
+	uint32_t intsrc;
+	uint32_t tmp;
+	intsrc = UART_GetIntId((LPC_UART_TypeDef *)LPC_UART0);
+	tmp = intsrc & UART_IIR_INTID_MASK;
+	if (tmp == UART_IIR_INTID_RDA) { // RDA="Receive Data Available"
+		uint8_t rx_data = UART_ReceiveByte((LPC_UART_TypeDef *)LPC_UART0);
+		if (rx_data >= '0' && rx_data < '0' + GRAPHS) {
+			active_graph = rx_data - '0'; // Takes effect on the next block
+		}
+	}
 }
 
 /*
  * GENERAL METHODS
  */
 
+// Returns the newest 12-bit result of a scanned channel, walking back from the GPDMA write position
+uint32_t readChannelLatest(uint32_t channel) {
+	uint32_t index = (LPC_GPDMACH0->DMACCDestAddr - (uint32_t)&adc_ring[0]) / 4;
+	for (int i = 0; i < ADC_RING_SIZE; i++) {
+		index = (index + ADC_RING_SIZE - 1) % ADC_RING_SIZE;
+		uint32_t word = adc_ring[index];
+		if ((word & (1UL<<31)) && ((word >> 24) & 0x7) == channel) {
+			return (word >> 4) & 0xFFF;
+		}
+	}
+	return 0;
+}
+
+// Returns the mean 12-bit result of a scanned channel over the whole ring
+uint32_t readChannelAverage(uint32_t channel) {
+	uint32_t sum = 0;
+	uint32_t count = 0;
+	for (int i = 0; i < ADC_RING_SIZE; i++) {
+		uint32_t word = adc_ring[i];
+		if ((word & (1UL<<31)) && ((word >> 24) & 0x7) == channel) {
+			sum += (word >> 4) & 0xFFF;
+			count++;
+		}
+	}
+	return count ? sum / count : 0;
+}
+
+uint32_t saturateDAC(int32_t value) {
+	if (value < 0) {
+		return 0;
+	}
+	if (value > DAC_MAX_VALUE) {
+		return DAC_MAX_VALUE;
+	}
+	return value;
+}
+
+void fillDACBlock(uint32_t *block) {
+	dac_block_target = block;
+	runGraph(&compiled_graphs[active_graph]);
+}
+
+// Orders the nodes so every node runs after its inputs and binds each step to its operator and buffers
+void compileGraph(const GraphNode *nodes, uint32_t count, CompiledGraph *graph) {
+	BlockOperator static const operators[] = {
+		runSource, runGain, runSum, runInvert, runClip, runLowPass, runSinkDAC, runSinkUART
+	};
+	uint8_t emitted[GRAPH_MAX_NODES] = {0};
+
+	graph->length = 0;
+	while (graph->length < count) {
+		uint32_t progress = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			const GraphNode *node = &nodes[i];
+			if (emitted[i] || (node->input_0 >= 0 && !emitted[node->input_0]) || (node->input_1 >= 0 && !emitted[node->input_1])) {
+				continue;
+			}
+			GraphStep *step = &graph->steps[graph->length++];
+			step->run = operators[node->type];
+			step->input_0 = node->input_0 >= 0 ? graph_buffers[node->input_0] : 0;
+			step->input_1 = node->input_1 >= 0 ? graph_buffers[node->input_1] : 0;
+			step->output = graph_buffers[i];
+			step->param_0 = node->param_0;
+			step->param_1 = node->param_1;
+			step->state = 0;
+			emitted[i] = 1;
+			progress = 1;
+		}
+		if (progress == 0) {
+			break; // A cycle or a dangling input, the remaining nodes are dropped
+		}
+	}
+}
+
+void runGraph(CompiledGraph *graph) {
+	for (uint32_t i = 0; i < graph->length; i++) {
+		graph->steps[i].run(&graph->steps[i]);
+	}
+}
+
+void runSource(GraphStep *step) {
+	int32_t value = readChannelAverage(step->param_0);
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		step->output[i] = value;
+	}
+}
+
+void runGain(GraphStep *step) {
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		step->output[i] = (step->input_0[i] * step->param_0) >> 8;
+	}
+}
+
+void runSum(GraphStep *step) {
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		step->output[i] = step->input_0[i] + step->input_1[i];
+	}
+}
+
+void runInvert(GraphStep *step) {
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		step->output[i] = step->param_0 - step->input_0[i];
+	}
+}
+
+void runClip(GraphStep *step) {
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		int32_t value = step->input_0[i];
+		value = value < step->param_0 ? step->param_0 : value;
+		step->output[i] = value > step->param_1 ? step->param_1 : value;
+	}
+}
 
+void runLowPass(GraphStep *step) {
+	int32_t value = step->state;
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		value += (step->input_0[i] - value) >> step->param_0;
+		step->output[i] = value;
+	}
+	step->state = value;
+}
+
+void runSinkDAC(GraphStep *step) {
+	for (int i = 0; i < DAC_BLOCK_SIZE; i++) {
+		dac_block_target[i] = saturateDAC(step->input_0[i] >> 2) << 6; // VALUE field of DACR, BIAS = 0
+	}
+}
+
+// Reports the last sample of the block as 3 hex digits, without waiting on the UART
+void runSinkUART(GraphStep *step) {
+	uint8_t static const hex[] = "0123456789ABCDEF";
+	uint32_t value = step->input_0[DAC_BLOCK_SIZE - 1] & SAMPLE_MAX_VALUE;
+	uint8_t message[4] = {hex[(value >> 8) & 0xF], hex[(value >> 4) & 0xF], hex[value & 0xF], '\n'};
+	UART_Send((LPC_UART_TypeDef *)LPC_UART0, message, sizeof(message), NONE_BLOCKING);
+}
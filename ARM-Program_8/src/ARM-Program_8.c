@@ -18,6 +18,7 @@
 #include "lpc17xx_gpio.h"
 #include "lpc17xx_pinsel.h"
 #include "lpc17xx_timer.h"
+#include "lpc17xx_gpdma.h"
 
 #include <cr_section_macros.h>
 
@@ -27,27 +28,109 @@
 #define LED_1_PIN 25 // P3.25 GREEN-LED
 #define LED_2_PIN 26 // P3.26 BLUE-LED
 
-#define TIME_IN_US 100000 // Timer interval in microseconds
+#define CAPTURE_DMA 1 // 1: conversions are moved in blocks by GPDMA, 0: one ADC interrupt per conversion
+#define CAPTURE_BLOCK_SIZE 200 // Conversions per block (200 * 50us = 10ms)
+
+#define TIME_IN_US (CAPTURE_DMA ? 50 : 100000) // Timer interval in microseconds (20kHz with GPDMA, 10Hz without)
+
+#define GPDMA_CHANNEL_0 0
 
 #define ADC_CONVERSION_RATE 200000
 
+#define THRESHOLD_LOW ((4096 * 4) / 10) // 40% of the ADC range (1638)
+#define THRESHOLD_HIGH ((4096 * 6) / 10) // 60% of the ADC range (2457)
+#define HYSTERESIS 64 // ADC codes a level has to go past a threshold before the zone changes
+
+#define WINDOW_SIZE 10 // Samples kept by the sliding window
+#define ALARM_COUNT 10 // High samples inside the window needed to light the red LED
+
+#define ADC_CODES 4096
+
+#define ZONES 3
+#define ZONE_LOW 0 // GREEN-LED
+#define ZONE_MID 1 // BLUE-LED
+#define ZONE_HIGH 2 // RED-LED
+#define ZONE_NONE 0xFF // Nothing driven yet
+#define ZONE_ACTIONS 3 // Output actions run when a zone is shown
+
+// Zone of an ADC code, one term per threshold. Adding a zone is adding a threshold here and a row to the tables below
+#define ZONE_OF(code) (((code) > THRESHOLD_LOW) + ((code) > THRESHOLD_HIGH))
+
+// Expands ZONE_OF for every ADC code, so the compiler builds the whole lookup table
+#define ZONE_LUT_4(code) ZONE_OF(code), ZONE_OF((code) + 1), ZONE_OF((code) + 2), ZONE_OF((code) + 3)
+#define ZONE_LUT_16(code) ZONE_LUT_4(code), ZONE_LUT_4((code) + 4), ZONE_LUT_4((code) + 8), ZONE_LUT_4((code) + 12)
+#define ZONE_LUT_64(code) ZONE_LUT_16(code), ZONE_LUT_16((code) + 16), ZONE_LUT_16((code) + 32), ZONE_LUT_16((code) + 48)
+#define ZONE_LUT_256(code) ZONE_LUT_64(code), ZONE_LUT_64((code) + 64), ZONE_LUT_64((code) + 128), ZONE_LUT_64((code) + 192)
+#define ZONE_LUT_1024(code) ZONE_LUT_256(code), ZONE_LUT_256((code) + 256), ZONE_LUT_256((code) + 512), ZONE_LUT_256((code) + 768)
+#define ZONE_LUT_4096(code) ZONE_LUT_1024(code), ZONE_LUT_1024((code) + 1024), ZONE_LUT_1024((code) + 2048), ZONE_LUT_1024((code) + 3072)
+
+typedef struct {
+	uint8_t port;
+	uint32_t mask;
+	uint8_t level; // 1 sets the pins, 0 clears them
+} OutputAction;
+
+typedef struct {
+	const uint8_t *lut; // ADC code to zone
+	const uint8_t *confirm; // Samples of a zone inside the window needed before it is shown
+	const OutputAction (*actions)[ZONE_ACTIONS]; // Outputs driven by each zone
+	uint32_t zone; // Zone after hysteresis
+	uint32_t shown; // Zone currently driven on the outputs
+	uint8_t window[WINDOW_SIZE]; // Zones of the last WINDOW_SIZE samples
+	uint32_t window_index;
+	uint32_t window_counts[ZONES]; // Samples of each zone inside the window
+} LevelMonitor;
+
+uint8_t static const zone_lut[ADC_CODES] = {ZONE_LUT_4096(0)};
+
+uint8_t static const zone_confirm[ZONES] = {1, 1, ALARM_COUNT};
+
+OutputAction static const zone_actions[ZONES][ZONE_ACTIONS] = {
+	{{0, (1 << LED_0_PIN), 0}, {3, (1 << LED_1_PIN), 1}, {3, (1 << LED_2_PIN), 0}}, // ZONE_LOW
+	{{0, (1 << LED_0_PIN), 0}, {3, (1 << LED_1_PIN), 0}, {3, (1 << LED_2_PIN), 1}}, // ZONE_MID
+	{{0, (1 << LED_0_PIN), 1}, {3, (1 << LED_1_PIN), 0}, {3, (1 << LED_2_PIN), 0}}, // ZONE_HIGH
+};
+
+typedef void (*CaptureCallback)(const uint32_t *block, uint32_t length);
+
+GPDMA_LLI_Type static capture_lli_0 __BSS(RAM2);
+GPDMA_LLI_Type static capture_lli_1 __BSS(RAM2);
+uint32_t static capture_block_0[CAPTURE_BLOCK_SIZE] __BSS(RAM2); // Raw ADGDR words
+uint32_t static capture_block_1[CAPTURE_BLOCK_SIZE] __BSS(RAM2);
+uint32_t static capture_block = 0; // Block the GPDMA is filling
+CaptureCallback static capture_callback = 0; // Called from DMA_IRQHandler with every completed block
+
 uint32_t static sensor_value = 0;
-uint32_t static consecutive_counter = 0;
+
+LevelMonitor static sensor_monitor = {
+	.lut = zone_lut,
+	.confirm = zone_confirm,
+	.actions = zone_actions,
+	.zone = ZONE_LOW,
+	.shown = ZONE_NONE,
+	.window_counts = {WINDOW_SIZE}, // The empty window counts as ZONE_LOW
+};
 
 void configADC();
 void configGPIO();
 void configNVIC();
 void configTimer();
-void updateOutput();
+void configGPDMA(CaptureCallback callback);
+void onCaptureBlock(const uint32_t *block, uint32_t length);
+void monitorSample(LevelMonitor *monitor, uint32_t value);
+void updateOutput(const OutputAction *actions);
 
 int main() {
 	SystemInit();
 	configADC();
 	configGPIO();
+	if (CAPTURE_DMA) {
+		configGPDMA(onCaptureBlock);
+	}
 	configNVIC();
 	configTimer();
 	while (1) {
-		updateOutput();
+		__WFI(); // All the work is done in ADC_IRQHandler or in the block callback
 	}
 	return 0;
 }
@@ -68,7 +151,7 @@ void configADC() {
 	//GPIO_SetDir(0, POTENTIOMETER_0_PIN, 0);
 
 	ADC_Init(LPC_ADC, ADC_CONVERSION_RATE);
-	ADC_IntConfig(LPC_ADC, ADC_ADINTEN0, ENABLE);
+	ADC_IntConfig(LPC_ADC, ADC_ADINTEN0, ENABLE); // Also raises the GPDMA request when capturing in blocks
 	ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_0, ENABLE);
 	ADC_StartCmd(LPC_ADC, ADC_START_ON_MAT01);
 	ADC_EdgeStartConfig(LPC_ADC, ADC_START_ON_RISING);
@@ -96,13 +179,16 @@ void configGPIO() {
 	// set P3.25 & P3.26
 	GPIO_SetDir(3, (1 << LED_1_PIN) | (1 << LED_2_PIN), 1);
 	// Set output in LOW as starting point
-	GPIO_ClearValue(0, LED_0_PIN);
-	GPIO_ClearValue(3, LED_1_PIN);
-	GPIO_ClearValue(3, LED_2_PIN);
+	GPIO_ClearValue(0, (1 << LED_0_PIN));
+	GPIO_ClearValue(3, (1 << LED_1_PIN) | (1 << LED_2_PIN));
 }
 
 void configNVIC() {
-    NVIC_EnableIRQ(ADC_IRQn);
+	if (CAPTURE_DMA) {
+		NVIC_EnableIRQ(DMA_IRQn);
+	} else {
+		NVIC_EnableIRQ(ADC_IRQn);
+	}
 }
 
 void configTimer() {
@@ -118,41 +204,104 @@ void configTimer() {
 	matchCfg.ResetOnMatch = ENABLE;
 	matchCfg.StopOnMatch  = DISABLE;
 	matchCfg.ExtMatchOutputType = TIM_EXTMATCH_TOGGLE;
-	matchCfg.MatchValue   = TIME_IN_US / 2;
+	matchCfg.MatchValue   = TIME_IN_US / 2 - 1; // Counts 0..MatchValue, so MAT0.1 toggles every TIME_IN_US / 2
 	TIM_ConfigMatch(LPC_TIM0, &matchCfg);
 
 	TIM_Cmd(LPC_TIM0, ENABLE);
 }
 
+void configGPDMA(CaptureCallback callback) {
+	capture_callback = callback;
+
+	GPDMA_Init();
+
+	GPDMA_Channel_CFG_Type gpdma_cfg;
+	gpdma_cfg.ChannelNum = GPDMA_CHANNEL_0;
+	gpdma_cfg.TransferSize = CAPTURE_BLOCK_SIZE;
+	gpdma_cfg.TransferWidth = GPDMA_WIDTH_WORD;
+	gpdma_cfg.SrcMemAddr = 0;
+	gpdma_cfg.DstMemAddr = (uint32_t)&capture_block_0[0];
+	gpdma_cfg.TransferType = GPDMA_TRANSFERTYPE_P2M;
+	gpdma_cfg.SrcConn = GPDMA_CONN_ADC; // Reads ADGDR
+	gpdma_cfg.DstConn = 0;
+	gpdma_cfg.DMALLI = (uint32_t)&capture_lli_1;
+	GPDMA_Setup(&gpdma_cfg);
+
+	// Both blocks chained in a loop, each one raising a terminal count interrupt when it is full
+	capture_lli_0.SrcAddr = (uint32_t)&LPC_ADC->ADGDR;
+	capture_lli_0.DstAddr = (uint32_t)&capture_block_0[0];
+	capture_lli_0.NextLLI = (uint32_t)&capture_lli_1;
+	capture_lli_0.Control = (CAPTURE_BLOCK_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<27) | (1UL<<31);
+
+	capture_lli_1.SrcAddr = (uint32_t)&LPC_ADC->ADGDR;
+	capture_lli_1.DstAddr = (uint32_t)&capture_block_1[0];
+	capture_lli_1.NextLLI = (uint32_t)&capture_lli_0;
+	capture_lli_1.Control = (CAPTURE_BLOCK_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<27) | (1UL<<31);
+
+	GPDMA_ChannelCmd(GPDMA_CHANNEL_0, ENABLE);
+}
+
 /*
  * INTERRUPTION HANDLERS
  */
 
 void ADC_IRQHandler() {
 	sensor_value = ADC_ChannelGetData(LPC_ADC, ADC_CHANNEL_0);
+	monitorSample(&sensor_monitor, sensor_value);
+}
+
+void DMA_IRQHandler() {
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTTC, GPDMA_CHANNEL_0)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, GPDMA_CHANNEL_0);
+		const uint32_t *block = capture_block == 0 ? capture_block_0 : capture_block_1;
+		capture_block = !capture_block; // The GPDMA already moved on to the other block
+		capture_callback(block, CAPTURE_BLOCK_SIZE);
+	}
+	if (GPDMA_IntGetStatus(GPDMA_STAT_INTERR, GPDMA_CHANNEL_0)) {
+		GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, GPDMA_CHANNEL_0);
+	}
 }
 
 /*
  * GENERAL METHODS
  */
 
-void updateOutput() {
-	if (sensor_value <= 4096 * 0.4) {
-		GPIO_ClearValue(0, LED_0_PIN);
-		GPIO_SetValue(3, LED_1_PIN);
-		GPIO_ClearValue(3, LED_2_PIN);
-		consecutive_counter = 0;
-	} else if (sensor_value > 4096 * 0.4 && sensor_value <= 4096 * 0.6) {
-		GPIO_ClearValue(0, LED_0_PIN);
-		GPIO_ClearValue(3, LED_1_PIN);
-		GPIO_SetValue(3, LED_2_PIN);
-		consecutive_counter = 0;
-	} else {
-		if (consecutive_counter >= 10) {
-			GPIO_SetValue(0, LED_0_PIN);
-			GPIO_ClearValue(3, LED_1_PIN);
-			GPIO_ClearValue(3, LED_2_PIN);
+// Feeds the monitor with the mean of each block, so its window and confirm counts keep a useful time span at 20kHz
+void onCaptureBlock(const uint32_t *block, uint32_t length) {
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < length; i++) {
+		sum += (block[i] >> 4) & 0xFFF;
+	}
+	sensor_value = sum / length;
+	monitorSample(&sensor_monitor, sensor_value);
+}
+
+// Runs once per conversion, in constant time whatever the number of zones
+void monitorSample(LevelMonitor *monitor, uint32_t value) {
+	// Hysteresis: the zone only changes when the codes HYSTERESIS away on both sides agree it is out of range
+	uint32_t below = value > HYSTERESIS ? value - HYSTERESIS : 0;
+	uint32_t above = value + HYSTERESIS < ADC_CODES ? value + HYSTERESIS : ADC_CODES - 1;
+	if (monitor->zone < monitor->lut[below] || monitor->zone > monitor->lut[above]) {
+		monitor->zone = monitor->lut[value];
+	}
+
+	monitor->window_counts[monitor->window[monitor->window_index]]--; // Drop the oldest sample
+	monitor->window[monitor->window_index] = monitor->zone;
+	monitor->window_counts[monitor->zone]++;
+	monitor->window_index = (monitor->window_index + 1) % WINDOW_SIZE;
+
+	if (monitor->zone != monitor->shown && monitor->window_counts[monitor->zone] >= monitor->confirm[monitor->zone]) {
+		monitor->shown = monitor->zone;
+		updateOutput(monitor->actions[monitor->zone]);
+	}
+}
+
+void updateOutput(const OutputAction *actions) {
+	for (int i = 0; i < ZONE_ACTIONS; i++) {
+		if (actions[i].level) {
+			GPIO_SetValue(actions[i].port, actions[i].mask);
+		} else {
+			GPIO_ClearValue(actions[i].port, actions[i].mask);
 		}
-		consecutive_counter++;
 	}
 }
@@ -19,31 +19,113 @@
 #include "lpc17xx_gpdma.h"
 #include "lpc17xx_gpio.h"
 #include "lpc17xx_pinsel.h"
+#include "lpc17xx_timer.h"
 
 #include <cr_section_macros.h>
 
+#include "acquisition.h"
+#include "filters.h"
+
 #define ADC_PIN 23 // P0.25
 #define DAC_PIN 26 // P0.26
 
 #define ADC_CONVERSION_RATE 200000
 
-#define GPDMA_CHANNEL_0 0
-#define GPDMA_BUFFER_SIZE 16
+/*
+ * Streaming: TIM0 MAT0.1 starts one conversion every 1 / ADC_SAMPLE_RATE, the CIC decimates by R and the DAC
+ * counter plays one sample every R / ADC_SAMPLE_RATE. Both periods are exact divisors of PCLK = CCLK / 4, so input
+ * and output stay locked. Latency is about two output blocks (one to capture, one queued ahead of the DAC) plus the
+ * processing time; the measured value is left in stream_latency_us. STREAM_LOW_LATENCY trades block size (and so
+ * interrupt and call overhead per sample) for latency.
+ */
+#define STREAM_LOW_LATENCY 0
+#define STREAM_BLOCK_SIZE (STREAM_LOW_LATENCY ? 2 : 32) // DAC samples per block
+#define ADC_SAMPLE_RATE 50000
+#define DAC_SAMPLE_RATE (ADC_SAMPLE_RATE >> CIC_RATIO_SHIFT) // 12.5kHz
+
+#define GPDMA_CHANNEL_0 0 // ADC blocks
+#define GPDMA_CHANNEL_1 1 // DAC blocks
+#define GPDMA_CHANNELS 8
+#define GPDMA_BUFFER_SIZE (STREAM_BLOCK_SIZE << CIC_RATIO_SHIFT) // Words per ADC buffer
+#define GPDMA_BUFFERS 3 // Buffers chained in each LLI ring
+
+/*
+ * CIC decimation: CIC_ORDER integrators at the ADC rate, decimation by R = 1 << CIC_RATIO_SHIFT and CIC_ORDER
+ * combs at the output rate, normalised by a shift of CIC_ORDER * CIC_RATIO_SHIFT (gain R^N). Order 1 is the
+ * running-sum moving average over R samples. 12 + CIC_ORDER * CIC_RATIO_SHIFT has to fit in 32 bits.
+ *
+ * Estimated Cortex-M3 cycles, from the instruction sequence with zero wait states:
+ * per input 10 + 7 * N, per output 4 + 8 * N, so per output sample R * (10 + 7 * N) + 4 + 8 * N
+ *   N = 1: R = 4 -> 80, R = 16 -> 284, R = 64 -> 1100
+ *   N = 3: R = 4 -> 152, R = 16 -> 524, R = 64 -> 2012
+ * The measured cost of the last block is left in filter_cycles.
+ */
+#define CIC_ORDER 3
+#define CIC_RATIO_SHIFT 2 // R = 4, one DAC sample per four conversions
+
+// FIR and biquad kernels (filters.h) run on the decimated stream, centred on mid-scale
+#define ADC_MID_SCALE 2048
+
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000) // Data Watchpoint and Trace control
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004) // Core cycle counter
+
+// Hamming windowed sinc, cutoff at fs / 16 (780Hz at 12.5kHz), unity gain at DC
+int16_t static const fir_coefficients[FIR_TAPS] = {
+	27, 131, 450, 1111, 2111, 3280, 4327, 4947, 4947, 4327, 3280, 2111, 1111, 450, 131, 27
+};
 
-uint32_t static average_value;
-uint32_t static list_selection = 0;
-GPDMA_LLI_Type static adc_lli_0;
-GPDMA_LLI_Type static adc_lli_1;
-uint32_t static adc_buffer_0[GPDMA_BUFFER_SIZE];
-uint32_t static adc_buffer_1[GPDMA_BUFFER_SIZE];
+FIRFilter static adc_fir = {.coefficients = fir_coefficients};
+Biquad static adc_biquad = { // Butterworth low-pass at 0.02 fs (250Hz at 12.5kHz)
+	.b0 = 3888751, .b1 = 7777502, .b2 = 3888751,
+	.a1 = 1957103774, .a2 = -898916953,
+};
+int16_t static samples_q15[GPDMA_BUFFER_SIZE];
+int32_t static samples_q31[GPDMA_BUFFER_SIZE];
+uint32_t static filter_cycles = 0; // Cycles spent by the last call to filterBlock(), CIC, FIR and biquad
+uint32_t static stream_latency_cycles = 0; // From the conversion of a block's first sample to its DAC output
+uint32_t static stream_latency_us = 0;
+uint32_t static stream_latency_max_us = 0;
+uint32_t static stream_slips = 0; // ADC blocks dropped because the DAC queue was full
+uint32_t static stream_started = 0;
+uint32_t static stream_origins[GPDMA_BUFFERS]; // DWT_CYCCNT of the first conversion played by each DAC buffer
+CICFilter static adc_filter = {.order = CIC_ORDER, .ratio_shift = CIC_RATIO_SHIFT};
+uint32_t static decimated[GPDMA_BUFFER_SIZE]; // Outputs of the last block, at most one per input
+AcquisitionLLI static adc_lli[GPDMA_BUFFERS] __BSS(RAM2);
+uint32_t static adc_buffers[GPDMA_BUFFERS * GPDMA_BUFFER_SIZE] __BSS(RAM2);
+Acquisition static adc_acquisition = {
+	.channel = GPDMA_CHANNEL_0,
+	.transfer_type = GPDMA_TRANSFERTYPE_P2M,
+	.peripheral = (uint32_t)&LPC_ADC->ADGDR, // Reading ADGDR clears the DONE flag that raises the request
+	.connection = GPDMA_CONN_ADC,
+	.block_size = GPDMA_BUFFER_SIZE,
+	.buffer_count = GPDMA_BUFFERS,
+	.buffers = adc_buffers,
+	.lli = adc_lli,
+};
+AcquisitionLLI static dac_lli[GPDMA_BUFFERS] __BSS(RAM2);
+uint32_t static dac_buffers[GPDMA_BUFFERS * STREAM_BLOCK_SIZE] __BSS(RAM2); // DACR words, value in bits 6-15
+Acquisition static dac_acquisition = {
+	.channel = GPDMA_CHANNEL_1,
+	.transfer_type = GPDMA_TRANSFERTYPE_M2P,
+	.peripheral = (uint32_t)&LPC_DAC->DACR,
+	.connection = GPDMA_CONN_DAC,
+	.block_size = STREAM_BLOCK_SIZE,
+	.buffer_count = GPDMA_BUFFERS,
+	.buffers = dac_buffers,
+	.lli = dac_lli,
+};
+Acquisition static *acquisition_channels[GPDMA_CHANNELS]; // Acquisition running on each GPDMA channel
 
 void configADC();
 void configDAC();
 void configGPDMA();
 void configNVIC();
-void calculateAverage();
-void updateDAC();
-void toggleListSelection();
+void configCycleCounter();
+void configTimer();
+uint32_t configAcquisition(Acquisition *acquisition);
+void updateStream();
+void startDAC();
+uint32_t filterBlock(const uint32_t *block, uint32_t *output);
 
 int main() {
 	SystemInit();
@@ -51,8 +133,11 @@ int main() {
 	configDAC();
 	configGPDMA();
 	configNVIC();
+	configCycleCounter();
+	configTimer();
 	while (1) {
-		updateDAC();
+		updateStream();
+		__WFI(); // Woken by the next completed block
 	}
 	return 0;
 }
@@ -73,8 +158,10 @@ void configADC() {
 
 	//GPIO_SetDir(0, SENSOR_PIN, 0);
 	ADC_Init(LPC_ADC, ADC_CONVERSION_RATE);
+	ADC_IntConfig(LPC_ADC, ADC_ADINTEN0, ENABLE); // Raises the GPDMA request, ADC_IRQn stays disabled
 	ADC_ChannelCmd(LPC_ADC, ADC_CHANNEL_0, ENABLE);
-	ADC_BurstCmd(LPC_ADC, ENABLE);
+	ADC_StartCmd(LPC_ADC, ADC_START_ON_MAT01);
+	ADC_EdgeStartConfig(LPC_ADC, ADC_START_ON_RISING);
 }
 
 void configDAC() {
@@ -87,82 +174,179 @@ void configDAC() {
 	PinCfg.OpenDrain = PINSEL_PINMODE_NORMAL;
 	PINSEL_ConfigPin(&PinCfg);
 	//GPIO_SetDir(0, DAC_PIN, 1);
-	DAC_Init(LPC_DAC);
-	//DAC_CONVERTER_CFG_Type configDAC;
-	//configDAC.DBLBUF_ENA = RESET;
-	//configDAC.CNT_ENA = SET;
-	//configDAC.DMA_ENA = RESET;
+	DAC_Init(LPC_DAC); // PCLK_DAC = CCLK / 4
+	// UM10360 (DAC chapter, DMA counter): the counter counts DACCNTVAL down to 0 and is reloaded
+	// on the next PCLK, so one period is DACCNTVAL + 1 clocks and the reload value is the period - 1
+	DAC_SetDMATimeOut(LPC_DAC, (SystemCoreClock / 4) / DAC_SAMPLE_RATE - 1);
+	// The counter is only started by startDAC(), once the first processed block is queued
 }
 
 void configGPDMA() {
 	GPDMA_Init();
+	if (!configAcquisition(&adc_acquisition) || !configAcquisition(&dac_acquisition)) {
+		while (1); // A ring the GPDMA can't run, stop here rather than stream from the wrong buffers
+	}
+}
+
+// Links the buffers in an LLI ring and starts the channel, returns 0 without touching the GPDMA when
+// buffer_count or block_size is out of range
+uint32_t configAcquisition(Acquisition *acquisition) {
+	uint32_t p2m = (acquisition->transfer_type == GPDMA_TRANSFERTYPE_P2M);
+	if (acquisition->block_size > 0xfff || !resetAcquisition(acquisition, !p2m)) {
+		return 0; // Bad ring, or more words than the 12-bit transfer size of the LLI control word
+	}
+	acquisition_channels[acquisition->channel] = acquisition;
+
+	for (uint32_t i = 0; i < acquisition->buffer_count; i++) {
+		AcquisitionLLI *lli = &acquisition->lli[i];
+		uint32_t buffer = (uint32_t)&acquisition->buffers[i * acquisition->block_size];
+		lli->SrcAddr = p2m ? acquisition->peripheral : buffer;
+		lli->DstAddr = p2m ? buffer : acquisition->peripheral;
+		lli->NextLLI = (uint32_t)&acquisition->lli[(i + 1) % acquisition->buffer_count];
+		lli->Control = (acquisition->block_size & 0xfff) | (2<<18) | (2<<21) | (p2m ? (1<<27) : (1<<26)) | (1UL<<31); // Word to word, increment the memory side, terminal count interrupt
+	}
 
 	GPDMA_Channel_CFG_Type gpdma_cfg;
-	gpdma_cfg.ChannelNum = GPDMA_CHANNEL_0;
-	gpdma_cfg.TransferSize = GPDMA_BUFFER_SIZE;
+	gpdma_cfg.ChannelNum = acquisition->channel;
+	gpdma_cfg.TransferSize = acquisition->block_size;
 	gpdma_cfg.TransferWidth = GPDMA_WIDTH_WORD;
-	gpdma_cfg.SrcMemAddr = 0;
-	gpdma_cfg.DstMemAddr = (uint32_t)&adc_buffer_0;
-	gpdma_cfg.TransferType = GPDMA_TRANSFERTYPE_P2M;
-	gpdma_cfg.SrcConn = GPDMA_CONN_ADC;
-	gpdma_cfg.DstConn = 0;
-	gpdma_cfg.DMALLI = (uint32_t)&adc_lli_0;
+	gpdma_cfg.SrcMemAddr = p2m ? 0 : acquisition->lli[0].SrcAddr;
+	gpdma_cfg.DstMemAddr = p2m ? acquisition->lli[0].DstAddr : 0;
+	gpdma_cfg.TransferType = acquisition->transfer_type;
+	gpdma_cfg.SrcConn = p2m ? acquisition->connection : 0;
+	gpdma_cfg.DstConn = p2m ? 0 : acquisition->connection;
+	gpdma_cfg.DMALLI = acquisition->lli[0].NextLLI; // The first buffer is loaded by GPDMA_Setup itself
 	GPDMA_Setup(&gpdma_cfg);
 
-	adc_lli_0.SrcAddr = LPC_ADC->ADDR0;
-	adc_lli_0.DstAddr = (uint32_t)&adc_buffer_0[0];
-	adc_lli_0.NextLLI = (uint32_t)&adc_lli_1;
-	adc_lli_0.Control = (GPDMA_BUFFER_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<25) | (1<<27);
-
-	adc_lli_1.SrcAddr = LPC_ADC->ADDR0;
-	adc_lli_1.DstAddr = (uint32_t)&adc_buffer_1[0];
-	adc_lli_1.NextLLI = (uint32_t)&adc_lli_0;
-	adc_lli_1.Control = (GPDMA_BUFFER_SIZE & 0xfff) | (2<<18) | (2<<21) | (1<<25) | (1<<27);
-
-	GPDMA_ChannelCmd(GPDMA_CHANNEL_0, ENABLE);
+	GPDMA_ChannelCmd(acquisition->channel, ENABLE);
+	return 1;
 }
 
 void configNVIC() {
     NVIC_EnableIRQ(DMA_IRQn);
 }
 
+void configCycleCounter() {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // Enable the DWT unit
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= (1<<0); // Start the cycle counter
+}
+
+void configTimer() {
+	TIM_TIMERCFG_Type timerCfg;
+	TIM_MATCHCFG_Type matchCfg;
+
+	timerCfg.PrescaleOption = TIM_PRESCALE_TICKVAL;
+	timerCfg.PrescaleValue  = 1; // PCLK_TIMER0 = CCLK / 4
+	TIM_Init(LPC_TIM0, TIM_TIMER_MODE, &timerCfg);
+
+	matchCfg.MatchChannel = 1;
+	matchCfg.IntOnMatch   = DISABLE;
+	matchCfg.ResetOnMatch = ENABLE;
+	matchCfg.StopOnMatch  = DISABLE;
+	matchCfg.ExtMatchOutputType = TIM_EXTMATCH_TOGGLE; // One rising edge, and one conversion, every two matches
+	matchCfg.MatchValue   = (SystemCoreClock / 4) / (2 * ADC_SAMPLE_RATE) - 1;
+	TIM_ConfigMatch(LPC_TIM0, &matchCfg);
+
+	TIM_Cmd(LPC_TIM0, ENABLE);
+}
+
 /*
  * INTERRUPTION HANDLERS
  */
 
 void DMA_IRQHandler() {
-	GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, GPDMA_CHANNEL_0);
-	calculateAverage();
-	toggleListSelection();
+	for (uint32_t channel = 0; channel < GPDMA_CHANNELS; channel++) {
+		Acquisition *acquisition = acquisition_channels[channel];
+		if (acquisition == 0) {
+			continue;
+		}
+		if (GPDMA_IntGetStatus(GPDMA_STAT_INTTC, channel)) {
+			GPDMA_ClearIntPending(GPDMA_STATCLR_INTTC, channel);
+			completeBlock(acquisition, DWT_CYCCNT);
+		}
+		if (GPDMA_IntGetStatus(GPDMA_STAT_INTERR, channel)) {
+			GPDMA_ClearIntPending(GPDMA_STATCLR_INTERR, channel);
+		}
+	}
 }
 
 /*
  * GENERAL METHODS
  */
 
-void calculateAverage() {
-	average_value = 0;
-	if (list_selection == 0) {
-		for (int i = 0; i < GPDMA_BUFFER_SIZE; i++) {
-			average_value += adc_buffer_0[i];
+// Moves every completed ADC block through the filters straight into the next free DAC buffer
+void updateStream() {
+	uint32_t *input;
+	while ((input = acquireBlock(&adc_acquisition)) != 0) {
+		uint32_t adc_slot = adc_acquisition.released % GPDMA_BUFFERS;
+		uint32_t origin = adc_acquisition.timestamps[adc_slot] - (SystemCoreClock / ADC_SAMPLE_RATE) * GPDMA_BUFFER_SIZE;
+
+		uint32_t *output = acquireBlock(&dac_acquisition);
+		if (output == 0) {
+			stream_slips++; // The DAC is behind, dropping the block keeps the latency bounded
+			releaseBlock(&adc_acquisition);
+			continue;
 		}
-	} else {
-		for (int i = 0; i < GPDMA_BUFFER_SIZE; i++) {
-			average_value += adc_buffer_1[i];
+		uint32_t dac_slot = dac_acquisition.released % GPDMA_BUFFERS;
+		if (dac_acquisition.released >= GPDMA_BUFFERS) {
+			// This buffer has been played, it started when the previous one completed
+			uint32_t start = dac_acquisition.timestamps[(dac_slot + GPDMA_BUFFERS - 1) % GPDMA_BUFFERS];
+			stream_latency_cycles = start - stream_origins[dac_slot];
+			stream_latency_us = stream_latency_cycles / (SystemCoreClock / 1000000);
+			if (stream_latency_us > stream_latency_max_us) {
+				stream_latency_max_us = stream_latency_us;
+			}
+		}
+
+		if (stream_started == 0) {
+			for (uint32_t i = 0; i < STREAM_BLOCK_SIZE; i++) {
+				output[i] = (ADC_MID_SCALE >> 2) << 6; // One block of silence ahead of the first samples
+			}
+			stream_origins[dac_slot] = origin;
+			releaseBlock(&dac_acquisition);
+			output = acquireBlock(&dac_acquisition);
+			dac_slot = dac_acquisition.released % GPDMA_BUFFERS;
+		}
+
+		filterBlock(input, output);
+		stream_origins[dac_slot] = origin;
+		releaseBlock(&adc_acquisition);
+		releaseBlock(&dac_acquisition);
+
+		if (stream_started == 0) {
+			startDAC();
+			stream_started = 1;
 		}
 	}
-	average_value /= GPDMA_BUFFER_SIZE;
-	average_value >>= 2;
 }
 
-void updateDAC() {
-	DAC_UpdateValue(LPC_DAC, average_value);
+void startDAC() {
+	DAC_CONVERTER_CFG_Type dac_cfg;
+	dac_cfg.DBLBUF_ENA = 1; // DACR is latched on every counter timeout, so samples are evenly spaced
+	dac_cfg.CNT_ENA = 1;
+	dac_cfg.DMA_ENA = 1;
+	dac_acquisition.timestamps[GPDMA_BUFFERS - 1] = DWT_CYCCNT; // The first buffer starts now rather than after the last one
+	DAC_ConfigDAConverterControl(LPC_DAC, &dac_cfg);
 }
 
-void toggleListSelection() {
-	if (list_selection == 0) {
-		list_selection = 1;
-	} else {
-		list_selection = 0;
+// Filters one ADC block into one block of DACR words, returns the number of samples written
+uint32_t filterBlock(const uint32_t *block, uint32_t *output) {
+	uint32_t start = DWT_CYCCNT;
+	uint32_t count = cicDecimate(&adc_filter, block, GPDMA_BUFFER_SIZE, decimated);
+	for (uint32_t i = 0; i < count; i++) {
+		samples_q15[i] = ((int32_t)decimated[i] - ADC_MID_SCALE) << 4;
+	}
+	firQ15(&adc_fir, samples_q15, samples_q15, count);
+	for (uint32_t i = 0; i < count; i++) {
+		samples_q31[i] = (int32_t)samples_q15[i] << 16;
+	}
+	biquadQ31(&adc_biquad, samples_q31, samples_q31, count);
+	for (uint32_t i = 0; i < count; i++) {
+		int32_t value = (samples_q31[i] >> 20) + ADC_MID_SCALE;
+		value = value < 0 ? 0 : value > 0xFFF ? 0xFFF : value;
+		output[i] = (value >> 2) << 6; // 12-bit result to the VALUE field of DACR
 	}
+	filter_cycles = DWT_CYCCNT - start;
+	return count;
 }
@@ -0,0 +1,40 @@
+#include "acquisition.h"
+
+// Empties the queue before the GPDMA is started, returns 0 when buffer_count or block_size is out of range.
+// Output (M2P) buffers start owned by main, to be filled
+uint32_t resetAcquisition(Acquisition *acquisition, uint32_t output) {
+	if (acquisition->buffer_count == 0 || acquisition->buffer_count > ACQUISITION_MAX_BUFFERS) {
+		return 0; // No room for the timestamps
+	}
+	if (acquisition->block_size == 0) {
+		return 0;
+	}
+	acquisition->filled = output ? acquisition->buffer_count : 0;
+	acquisition->released = 0;
+	acquisition->overruns = 0;
+	return 1;
+}
+
+// Called on the terminal count of a buffer, the GPDMA has moved on to the next one in the ring
+void completeBlock(Acquisition *acquisition, uint32_t timestamp) {
+	uint32_t filled = acquisition->filled + 1;
+	acquisition->timestamps[acquisition->filled % acquisition->buffer_count] = timestamp;
+	if (filled - acquisition->released >= acquisition->buffer_count) {
+		acquisition->overruns++; // The GPDMA is already writing into the oldest buffer held by main
+	}
+	acquisition->filled = filled; // Publishes the buffer to the consumer
+}
+
+// Returns the oldest filled buffer, owned by the caller until releaseBlock(), or 0 when none is ready
+uint32_t *acquireBlock(Acquisition *acquisition) {
+	uint32_t released = acquisition->released;
+	if (acquisition->filled == released) {
+		return 0;
+	}
+	return &acquisition->buffers[(released % acquisition->buffer_count) * acquisition->block_size];
+}
+
+// Gives the buffer returned by acquireBlock() back to the GPDMA ring
+void releaseBlock(Acquisition *acquisition) {
+	acquisition->released = acquisition->released + 1;
+}
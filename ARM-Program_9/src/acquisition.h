@@ -0,0 +1,44 @@
+/*
+ * Ring of buffers moved by GPDMA between a peripheral register and memory. Completed buffers are handed over
+ * in order through a single producer (DMA_IRQHandler) single consumer (main) queue and processed in place.
+ * For P2M a completed buffer holds new samples, for M2P it has been played and is free to be refilled.
+ *
+ * The queue only touches memory, the GPDMA setup stays in configAcquisition(), so tools/acquisition_bench.c
+ * builds this file on the host and drives it from a mock DMA.
+ */
+
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <stdint.h>
+
+#define ACQUISITION_MAX_BUFFERS 8 // Largest buffer_count of an Acquisition, sizes its timestamps
+
+typedef struct {
+	uint32_t SrcAddr;
+	uint32_t DstAddr;
+	uint32_t NextLLI;
+	uint32_t Control;
+} AcquisitionLLI; // Same layout as GPDMA_LLI_Type, read by the GPDMA
+
+typedef struct {
+	uint32_t channel; // GPDMA channel
+	uint32_t transfer_type; // GPDMA_TRANSFERTYPE_P2M or GPDMA_TRANSFERTYPE_M2P
+	uint32_t peripheral; // Address of the peripheral register read or written by every transfer
+	uint32_t connection; // GPDMA_CONN_* request line
+	uint32_t block_size; // Words per buffer
+	uint32_t buffer_count; // 1 to ACQUISITION_MAX_BUFFERS, checked by resetAcquisition()
+	uint32_t *buffers; // buffer_count * block_size words
+	AcquisitionLLI *lli; // buffer_count items, linked in a ring
+	uint32_t volatile filled; // Buffers completed by the GPDMA, only written by DMA_IRQHandler
+	uint32_t volatile released; // Buffers given back by the consumer, only written by main
+	uint32_t volatile overruns; // Buffers the GPDMA started to reuse while the consumer still held them
+	uint32_t timestamps[ACQUISITION_MAX_BUFFERS]; // DWT_CYCCNT when each buffer was completed
+} Acquisition;
+
+uint32_t resetAcquisition(Acquisition *acquisition, uint32_t output);
+void completeBlock(Acquisition *acquisition, uint32_t timestamp);
+uint32_t *acquireBlock(Acquisition *acquisition);
+void releaseBlock(Acquisition *acquisition);
+
+#endif
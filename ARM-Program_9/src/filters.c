@@ -0,0 +1,70 @@
+#include "filters.h"
+
+// Runs a block of ADGDR words through the filter, returns the number of decimated 12-bit values written to output
+uint32_t cicDecimate(CICFilter *filter, const uint32_t *block, uint32_t length, uint32_t *output) {
+	uint32_t count = 0;
+	uint32_t ratio_mask = (1 << filter->ratio_shift) - 1;
+	uint32_t gain_shift = filter->order * filter->ratio_shift;
+	for (uint32_t i = 0; i < length; i++) {
+		uint32_t value = (block[i] >> 4) & 0xFFF; // Result field of ADGDR
+		for (uint32_t stage = 0; stage < filter->order; stage++) {
+			filter->integrators[stage] += value;
+			value = filter->integrators[stage];
+		}
+		filter->phase = (filter->phase + 1) & ratio_mask;
+		if (filter->phase != 0) {
+			continue;
+		}
+		for (uint32_t stage = 0; stage < filter->order; stage++) {
+			uint32_t delayed = filter->combs[stage];
+			filter->combs[stage] = value;
+			value -= delayed;
+		}
+		output[count++] = value >> gain_shift;
+	}
+	return count;
+}
+
+// Low-pass FIR, input and output may be the same buffer
+void firQ15(FIRFilter *filter, const int16_t *input, int16_t *output, uint32_t length) {
+	const int16_t *h = filter->coefficients;
+	for (uint32_t n = 0; n < length; n++) {
+		filter->index = filter->index == 0 ? FIR_TAPS - 1 : filter->index - 1;
+		filter->state[filter->index] = input[n];
+		filter->state[filter->index + FIR_TAPS] = input[n];
+		const int16_t *x = &filter->state[filter->index]; // x[0] newest, x[FIR_TAPS - 1] oldest
+		int64_t acc = 0;
+		for (uint32_t k = 0; k < FIR_TAPS; k += 4) {
+			acc += (int32_t)x[k] * h[k];
+			acc += (int32_t)x[k + 1] * h[k + 1];
+			acc += (int32_t)x[k + 2] * h[k + 2];
+			acc += (int32_t)x[k + 3] * h[k + 3];
+		}
+		acc = (acc + (1 << 14)) >> 15;
+		output[n] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+	}
+}
+
+// Direct form I biquad, input and output may be the same buffer
+void biquadQ31(Biquad *filter, const int32_t *input, int32_t *output, uint32_t length) {
+	int32_t x1 = filter->x1, x2 = filter->x2, y1 = filter->y1, y2 = filter->y2;
+	for (uint32_t n = 0; n < length; n++) {
+		int32_t x0 = input[n];
+		int64_t acc = (int64_t)filter->b0 * x0;
+		acc += (int64_t)filter->b1 * x1;
+		acc += (int64_t)filter->b2 * x2;
+		acc += (int64_t)filter->a1 * y1;
+		acc += (int64_t)filter->a2 * y2;
+		acc >>= 30;
+		int32_t y0 = acc > 0x7FFFFFFF ? 0x7FFFFFFF : acc < -0x7FFFFFFF - 1 ? -0x7FFFFFFF - 1 : acc;
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+		output[n] = y0;
+	}
+	filter->x1 = x1;
+	filter->x2 = x2;
+	filter->y1 = y1;
+	filter->y2 = y2;
+}
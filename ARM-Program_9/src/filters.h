@@ -0,0 +1,42 @@
+/*
+ * Fixed point filter kernels of the ADC to DAC stream. They only touch memory, so tools/filter_test.c builds
+ * this file on the host and checks the kernels against a double precision reference.
+ *
+ * FIR and biquad kernels run on the decimated stream. Samples are Q15 (FIR) or Q31 (biquad), products are
+ * accumulated in 64 bits so the compiler can keep them in SMLAL, and the FIR inner loop is unrolled by 4 over a
+ * doubled state buffer, so the window of the last FIR_TAPS inputs is always contiguous.
+ */
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdint.h>
+
+#define CIC_MAX_ORDER 4
+#define FIR_TAPS 16 // Multiple of 4
+
+typedef struct {
+	uint32_t order; // Integrator/comb pairs
+	uint32_t ratio_shift; // log2 of the decimation ratio
+	uint32_t phase; // Inputs since the last output
+	uint32_t integrators[CIC_MAX_ORDER]; // Wrap around on purpose, the combs cancel it
+	uint32_t combs[CIC_MAX_ORDER]; // Previous input of each comb
+} CICFilter;
+
+typedef struct {
+	const int16_t *coefficients; // Q15, FIR_TAPS
+	int16_t state[2 * FIR_TAPS]; // Every input stored twice, FIR_TAPS apart
+	uint32_t index; // Position of the newest input
+} FIRFilter;
+
+typedef struct {
+	int32_t b0, b1, b2; // Q30
+	int32_t a1, a2; // Q30, already negated: y = b0 x + b1 x1 + b2 x2 + a1 y1 + a2 y2
+	int32_t x1, x2, y1, y2; // Q31 direct form I state
+} Biquad;
+
+uint32_t cicDecimate(CICFilter *filter, const uint32_t *block, uint32_t length, uint32_t *output);
+void firQ15(FIRFilter *filter, const int16_t *input, int16_t *output, uint32_t length);
+void biquadQ31(Biquad *filter, const int32_t *input, int32_t *output, uint32_t length);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Host test and benchmark of the Program_9 acquisition queue (../src/acquisition.c) against a mock DMA.
+ *
+ * The mock plays the GPDMA and DMA_IRQHandler: it writes one block into the ring slot after the last completed
+ * one, stamping the block number in every word, and then calls completeBlock() as the terminal count interrupt
+ * does. The consumer takes the blocks with acquireBlock() / releaseBlock() as updateStream() does.
+ *
+ *   order: bursts of 0 to buffer_count - 1 blocks between consumer passes, every block has to reach the consumer
+ *   in order, in place in the ring and with its timestamp, and no overrun may be counted. Rings of 2 buffers or
+ *   more, the GPDMA is always writing into one of them.
+ *   overrun: with the consumer stalled the mock may complete buffer_count - 1 blocks, the next one is an overrun.
+ *   limits: resetAcquisition() has to refuse rings with no buffers or more than ACQUISITION_MAX_BUFFERS.
+ *   benchmark: ns per block for the queue alone, and for the filter chain of filterBlock() run in place in the
+ *   ring against the same chain on a copy of every block.
+ *
+ * Build and run on Linux (not part of the firmware build), or "make test" in this directory:
+ *
+ *   gcc -O2 -Wall -I ../src -o acquisition_bench acquisition_bench.c ../src/acquisition.c ../src/filters.c
+ *   ./acquisition_bench [blocks]
+ *
+ * Returns 0 when every check passes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "acquisition.h"
+#include "filters.h"
+
+#define BLOCK_SIZE 128 // Words per block, GPDMA_BUFFER_SIZE of the firmware
+#define BUFFERS 3
+#define BENCH_BLOCKS 200000
+
+uint32_t static buffers[ACQUISITION_MAX_BUFFERS * BLOCK_SIZE];
+AcquisitionLLI static lli[ACQUISITION_MAX_BUFFERS];
+uint32_t static copy[BLOCK_SIZE];
+uint32_t static decimated[BLOCK_SIZE];
+int16_t static samples_q15[BLOCK_SIZE];
+int32_t static samples_q31[BLOCK_SIZE];
+uint32_t static produced = 0; // Blocks written by the mock, also the stamp of the next one
+
+int16_t static const fir_coefficients[FIR_TAPS] = {
+	27, 131, 450, 1111, 2111, 3280, 4327, 4947, 4947, 4327, 3280, 2111, 1111, 450, 131, 27
+};
+CICFilter static cic = {.order = 3, .ratio_shift = 2};
+FIRFilter static fir = {.coefficients = fir_coefficients};
+Biquad static biquad = {
+	.b0 = 3888751, .b1 = 7777502, .b2 = 3888751,
+	.a1 = 1957103774, .a2 = -898916953,
+};
+
+void initRing(Acquisition *acquisition, uint32_t buffer_count);
+void mockTransfer(Acquisition *acquisition);
+uint32_t filterChain(const uint32_t *block);
+int checkOrder();
+int checkOverrun();
+int checkLimits();
+void benchmark(uint32_t blocks);
+double now();
+
+int main(int argc, char **argv) {
+	int failures = checkLimits();
+	failures += checkOrder();
+	failures += checkOverrun();
+	benchmark(argc > 1 ? strtoul(argv[1], 0, 0) : BENCH_BLOCKS);
+	printf(failures ? "FAILED\n" : "acquisition queue ok\n");
+	return failures ? 1 : 0;
+}
+
+void initRing(Acquisition *acquisition, uint32_t buffer_count) {
+	memset(acquisition, 0, sizeof(*acquisition));
+	acquisition->block_size = BLOCK_SIZE;
+	acquisition->buffer_count = buffer_count;
+	acquisition->buffers = buffers;
+	acquisition->lli = lli;
+	resetAcquisition(acquisition, 0);
+	produced = 0;
+}
+
+// One block moved by the GPDMA into the slot after the last completed one, then its terminal count interrupt
+void mockTransfer(Acquisition *acquisition) {
+	uint32_t *block = &acquisition->buffers[(acquisition->filled % acquisition->buffer_count) * acquisition->block_size];
+	for (uint32_t i = 0; i < acquisition->block_size; i++) {
+		block[i] = (produced << 16) | (((produced + i) & 0xFFF) << 4); // ADGDR layout, block number above the result
+	}
+	completeBlock(acquisition, produced * 1000);
+	produced++;
+}
+
+// CIC, FIR and biquad of filterBlock(), returns a value that depends on every output so nothing is optimised away
+uint32_t filterChain(const uint32_t *block) {
+	uint32_t count = cicDecimate(&cic, block, BLOCK_SIZE, decimated);
+	for (uint32_t i = 0; i < count; i++) {
+		samples_q15[i] = ((int32_t)(decimated[i] & 0xFFF) - 2048) << 4;
+	}
+	firQ15(&fir, samples_q15, samples_q15, count);
+	for (uint32_t i = 0; i < count; i++) {
+		samples_q31[i] = (int32_t)samples_q15[i] << 16;
+	}
+	biquadQ31(&biquad, samples_q31, samples_q31, count);
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		sum += samples_q31[i];
+	}
+	return sum;
+}
+
+int checkLimits() {
+	Acquisition acquisition;
+	int failures = 0;
+	initRing(&acquisition, 0);
+	failures += resetAcquisition(&acquisition, 0) != 0;
+	initRing(&acquisition, ACQUISITION_MAX_BUFFERS + 1);
+	failures += resetAcquisition(&acquisition, 0) != 0;
+	initRing(&acquisition, ACQUISITION_MAX_BUFFERS);
+	failures += resetAcquisition(&acquisition, 0) != 1;
+	failures += resetAcquisition(&acquisition, 1) != 1 || acquisition.filled != ACQUISITION_MAX_BUFFERS; // Output ring
+	printf("limits: %s\n", failures ? "FAILED" : "ok");
+	return failures != 0;
+}
+
+int checkOrder() {
+	Acquisition acquisition;
+	uint32_t expected = 0;
+	int failures = 0;
+	srand(1);
+	for (uint32_t buffer_count = 2; buffer_count <= ACQUISITION_MAX_BUFFERS; buffer_count++) {
+		initRing(&acquisition, buffer_count);
+		expected = 0;
+		for (uint32_t pass = 0; pass < 10000; pass++) {
+			uint32_t burst = rand() % buffer_count; // Never more than the ring can queue
+			for (uint32_t i = 0; i < burst; i++) {
+				mockTransfer(&acquisition);
+			}
+			uint32_t *block;
+			while ((block = acquireBlock(&acquisition)) != 0) {
+				uint32_t slot = acquisition.released % buffer_count;
+				if (block != &buffers[slot * BLOCK_SIZE] || block[0] >> 16 != (expected & 0xFFFF)
+						|| block[BLOCK_SIZE - 1] >> 16 != (expected & 0xFFFF) || acquisition.timestamps[slot] != expected * 1000) {
+					failures++;
+				}
+				expected++;
+				releaseBlock(&acquisition);
+			}
+		}
+		if (expected != produced || acquisition.overruns != 0) {
+			failures++;
+		}
+	}
+	printf("order: %s, rings of 2 to %u buffers\n", failures ? "FAILED" : "ok", ACQUISITION_MAX_BUFFERS);
+	return failures != 0;
+}
+
+int checkOverrun() {
+	Acquisition acquisition;
+	int failures = 0;
+	initRing(&acquisition, BUFFERS);
+	for (uint32_t i = 0; i < BUFFERS - 1; i++) {
+		mockTransfer(&acquisition);
+	}
+	failures += acquisition.overruns != 0;
+	mockTransfer(&acquisition); // Every buffer is full, the GPDMA goes on into the oldest one
+	failures += acquisition.overruns != 1;
+	printf("overrun: %s, counted on block %u of a %u buffer ring\n", failures ? "FAILED" : "ok", BUFFERS, BUFFERS);
+	return failures != 0;
+}
+
+void benchmark(uint32_t blocks) {
+	Acquisition acquisition;
+	uint32_t volatile sink = 0;
+
+	initRing(&acquisition, BUFFERS);
+	double start = now();
+	for (uint32_t n = 0; n < blocks; n++) {
+		completeBlock(&acquisition, n);
+		sink += acquireBlock(&acquisition)[0];
+		releaseBlock(&acquisition);
+	}
+	double queue = (now() - start) / blocks;
+
+	initRing(&acquisition, BUFFERS);
+	start = now();
+	for (uint32_t n = 0; n < blocks; n++) {
+		mockTransfer(&acquisition);
+	}
+	double transfer = (now() - start) / blocks;
+
+	initRing(&acquisition, BUFFERS);
+	start = now();
+	for (uint32_t n = 0; n < blocks; n++) {
+		mockTransfer(&acquisition);
+		sink += filterChain(acquireBlock(&acquisition)); // In place in the ring
+		releaseBlock(&acquisition);
+	}
+	double in_place = (now() - start) / blocks - transfer;
+
+	initRing(&acquisition, BUFFERS);
+	start = now();
+	for (uint32_t n = 0; n < blocks; n++) {
+		mockTransfer(&acquisition);
+		memcpy(copy, acquireBlock(&acquisition), sizeof(copy)); // The block copied out before it's processed
+		releaseBlock(&acquisition);
+		sink += filterChain(copy);
+	}
+	double copied = (now() - start) / blocks - transfer;
+
+	printf("benchmark: %u blocks of %u words, %u buffers\n", blocks, BLOCK_SIZE, BUFFERS);
+	printf("  queue (complete, acquire, release)  %8.1f ns/block\n", queue * 1e9);
+	printf("  filter chain in place              %8.1f ns/block  %6.2f ns/sample\n", in_place * 1e9, in_place * 1e9 / BLOCK_SIZE);
+	printf("  filter chain on a copy             %8.1f ns/block  %6.2f ns/sample\n", copied * 1e9, copied * 1e9 / BLOCK_SIZE);
+	(void)sink;
+}
+
+double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,193 @@
+/*
+ * Host test of the Program_9 filter kernels (../src/filters.c).
+ *
+ * A fixed vector (a sine pair plus pseudo-random noise, full scale steps and an impulse) is fed through firQ15()
+ * and biquadQ31() in blocks of uneven length, as filterBlock() does, and every output is compared with a double
+ * precision reference that uses the same quantised coefficients:
+ *   firQ15: the kernel rounds once per output, so it has to be within 0.5 LSB of the reference.
+ *   biquadQ31: the kernel truncates once per output and the error is fed back through the poles, so it has to be
+ *   within sum |g[n]| LSB, g being the impulse response of 1 / (1 - a1 z^-1 - a2 z^-2).
+ * The FIR output is also checked to reproduce the coefficients exactly for an impulse of -32768.
+ *
+ * Build and run on Linux (not part of the firmware build):
+ *
+ *   gcc -O2 -Wall -I ../src -o filter_test filter_test.c ../src/filters.c -lm
+ *   ./filter_test
+ *
+ * Returns 0 when every kernel is within its bound.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "filters.h"
+
+#define VECTOR_LENGTH 4096
+#define SAMPLE_RATE 12500.0
+
+// Same coefficients as ../src/ARM-Program_9.c
+int16_t static const fir_coefficients[FIR_TAPS] = {
+	27, 131, 450, 1111, 2111, 3280, 4327, 4947, 4947, 4327, 3280, 2111, 1111, 450, 131, 27
+};
+Biquad static const biquad_coefficients = {
+	.b0 = 3888751, .b1 = 7777502, .b2 = 3888751,
+	.a1 = 1957103774, .a2 = -898916953,
+};
+
+// Block lengths the vector is cut into, so the state is carried across calls of every length
+uint32_t static const block_lengths[] = {1, 8, 3, 32, 7, 16, 5, 2};
+
+int16_t static input_q15[VECTOR_LENGTH];
+int16_t static fir_output[VECTOR_LENGTH];
+int32_t static biquad_input[VECTOR_LENGTH];
+int32_t static biquad_output[VECTOR_LENGTH];
+
+void makeVector(int16_t *vector);
+void runFIR(const int16_t *input, int16_t *output);
+void runBiquad(const int32_t *input, int32_t *output);
+int checkFIR(const int16_t *input, const int16_t *output);
+int checkBiquad(const int32_t *input, const int32_t *output);
+int checkImpulse();
+
+int main() {
+	makeVector(input_q15);
+	runFIR(input_q15, fir_output);
+	for (uint32_t n = 0; n < VECTOR_LENGTH; n++) {
+		biquad_input[n] = (int32_t)fir_output[n] << 16; // As filterBlock() widens the FIR output
+	}
+	runBiquad(biquad_input, biquad_output);
+
+	int failures = checkImpulse();
+	failures += checkFIR(input_q15, fir_output);
+	failures += checkBiquad(biquad_input, biquad_output);
+	printf(failures ? "FAILED\n" : "all kernels within their rounding bound\n");
+	return failures ? 1 : 0;
+}
+
+/*
+ * Fills the test vector: 100Hz and 3kHz sines with noise at 0.6 of full scale, then a step to each end of the
+ * Q15 range, then silence with a single impulse.
+ */
+void makeVector(int16_t *vector) {
+	uint32_t seed = 12345;
+	for (uint32_t n = 0; n < VECTOR_LENGTH; n++) {
+		seed = seed * 1103515245 + 12345; // Fixed LCG, the vector is the same on every run
+		double noise = ((int32_t)(seed >> 8) % 2000) / 2000.0;
+		double value;
+		if (n < 2048) {
+			value = 0.35 * sin(2 * M_PI * 100 * n / SAMPLE_RATE) + 0.2 * sin(2 * M_PI * 3000 * n / SAMPLE_RATE) + 0.05 * noise;
+		} else if (n < 2560) {
+			value = 0.9;
+		} else if (n < 3072) {
+			value = -0.9;
+		} else {
+			value = n == 3500 ? 0.9 : 0;
+		}
+		vector[n] = (int16_t)lrint(value * 32767);
+	}
+}
+
+// Runs the vector through a fresh FIR in blocks, in place like filterBlock()
+void runFIR(const int16_t *input, int16_t *output) {
+	FIRFilter fir = {.coefficients = fir_coefficients};
+	uint32_t n = 0;
+	for (uint32_t block = 0; n < VECTOR_LENGTH; block++) {
+		uint32_t length = block_lengths[block % (sizeof(block_lengths) / sizeof(block_lengths[0]))];
+		if (length > VECTOR_LENGTH - n) {
+			length = VECTOR_LENGTH - n;
+		}
+		for (uint32_t i = 0; i < length; i++) {
+			output[n + i] = input[n + i];
+		}
+		firQ15(&fir, &output[n], &output[n], length);
+		n += length;
+	}
+}
+
+// Runs the vector through a fresh biquad in blocks
+void runBiquad(const int32_t *input, int32_t *output) {
+	Biquad biquad = biquad_coefficients;
+	uint32_t n = 0;
+	for (uint32_t block = 0; n < VECTOR_LENGTH; block++) {
+		uint32_t length = block_lengths[(block + 3) % (sizeof(block_lengths) / sizeof(block_lengths[0]))];
+		if (length > VECTOR_LENGTH - n) {
+			length = VECTOR_LENGTH - n;
+		}
+		biquadQ31(&biquad, &input[n], &output[n], length);
+		n += length;
+	}
+}
+
+// Returns 1 when the FIR output of a -32768 impulse isn't exactly the negated coefficients
+int checkImpulse() {
+	FIRFilter fir = {.coefficients = fir_coefficients};
+	int16_t samples[FIR_TAPS + 4] = {-32768};
+	firQ15(&fir, samples, samples, FIR_TAPS + 4);
+	for (uint32_t n = 0; n < FIR_TAPS + 4; n++) {
+		int32_t expected = n < FIR_TAPS ? -fir_coefficients[n] : 0;
+		if (samples[n] != expected) {
+			printf("firQ15 impulse: output %u is %d, expected %d\n", n, samples[n], expected);
+			return 1;
+		}
+	}
+	printf("firQ15 impulse: coefficients reproduced exactly\n");
+	return 0;
+}
+
+// Compares the FIR output with the double reference, returns 1 when an output is off by more than 0.5 LSB
+int checkFIR(const int16_t *input, const int16_t *output) {
+	double max_error = 0;
+	uint32_t worst = 0;
+	for (uint32_t n = 0; n < VECTOR_LENGTH; n++) {
+		double reference = 0;
+		for (uint32_t k = 0; k < FIR_TAPS && k <= n; k++) {
+			reference += (double)input[n - k] * fir_coefficients[k] / 32768.0;
+		}
+		reference = reference > 32767 ? 32767 : reference < -32768 ? -32768 : reference;
+		double error = fabs(output[n] - reference);
+		if (error > max_error) {
+			max_error = error;
+			worst = n;
+		}
+	}
+	printf("firQ15: max error %.3f LSB at sample %u, bound 0.5 LSB\n", max_error, worst);
+	return max_error > 0.5;
+}
+
+// Compares the biquad output with the double reference, returns 1 when an output is off by more than the bound
+int checkBiquad(const int32_t *input, const int32_t *output) {
+	const Biquad *c = &biquad_coefficients;
+	double b0 = c->b0 / 1073741824.0, b1 = c->b1 / 1073741824.0, b2 = c->b2 / 1073741824.0;
+	double a1 = c->a1 / 1073741824.0, a2 = c->a2 / 1073741824.0;
+
+	// Bound of the truncation error, sum |g[n]| over the impulse response of the feedback path
+	double bound = 0, g1 = 0, g2 = 0;
+	for (uint32_t n = 0; n < 100000; n++) {
+		double g0 = (n == 0 ? 1 : 0) + a1 * g1 + a2 * g2;
+		bound += fabs(g0);
+		g2 = g1;
+		g1 = g0;
+	}
+	bound += 1; // Margin for the rounding of the double reference itself, far below 1 LSB
+
+	double x1 = 0, x2 = 0, y1 = 0, y2 = 0, max_error = 0, mean_error = 0;
+	uint32_t worst = 0;
+	for (uint32_t n = 0; n < VECTOR_LENGTH; n++) {
+		double x0 = input[n];
+		double y0 = b0 * x0 + b1 * x1 + b2 * x2 + a1 * y1 + a2 * y2;
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+		double error = output[n] - y0;
+		mean_error += error / VECTOR_LENGTH;
+		if (fabs(error) > max_error) {
+			max_error = fabs(error);
+			worst = n;
+		}
+	}
+	printf("biquadQ31: max error %.1f LSB at sample %u (mean %.1f), bound %.1f LSB = %.2e of full scale\n",
+	       max_error, worst, mean_error, bound, bound / 2147483648.0);
+	return max_error > bound;
+}